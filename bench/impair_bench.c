@@ -0,0 +1,364 @@
+/**
+ * Benchmark of the tail latency of APDUs over an impaired network. An ICC on a
+ * loopback TCP connection answers the TPDUs of a command, while the network
+ * impairment of the IFD handler delays messages, splits reads and writes, and
+ * resets the connection. For each impairment it reports the latency quantiles
+ * of the APDUs, how long presence checks (keep-alive exchanges) take, and how
+ * many lost connections the presence checks found.
+ */
+
+#include <arpa/inet.h>
+#include <debuglog.h>
+#include <lat.h>
+#include <msg.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <tpdu.h>
+#include <unistd.h>
+#include <wire.h>
+
+#define BENCH_ROUNDS_DEF 2000U
+/* A presence check is done after this many APDUs. */
+#define BENCH_PRESENCE_INTERVAL 10U
+
+typedef struct link_s
+{
+    int32_t sock_ifd;
+    int32_t sock_icc;
+    pthread_t icc_thread;
+    ifd_wire_st wire_ifd;
+    ifd_wire_st wire_icc;
+    ifd_impair_st impair;
+    ifd_msg_st msg_tx;
+    ifd_msg_st msg_rx;
+    ifd_msg_st msg_rx_spec;
+} link_st;
+
+typedef struct scenario_s
+{
+    char const *name;
+    ifd_impair_cfg_st cfg;
+} scenario_st;
+
+/**
+ * Logger of PC/SC-lite, only needed if logging was not compiled out.
+ */
+void log_msg(const int priority, const char *fmt, ...)
+{
+}
+
+/**
+ * The swICC framing (wire version 1) is not used by this benchmark.
+ */
+swicc_ret_et swicc_net_send(int32_t const sock,
+                            swicc_net_msg_st const *const msg)
+{
+    return SWICC_RET_ERROR;
+}
+
+swicc_ret_et swicc_net_recv(int32_t const sock, swicc_net_msg_st *const msg)
+{
+    return SWICC_RET_ERROR;
+}
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Answer messages until the connection is lost. Keep-alives get a
+ * success, a header with data gets an ACK, and everything else gets a success
+ * status.
+ * @param[in, out] arg Link (link_st).
+ * @return NULL.
+ */
+static void *icc_main(void *const arg)
+{
+    link_st *const link = arg;
+    static _Thread_local ifd_msg_st msg_icc;
+    ifd_msg_init(&msg_icc);
+    while (ifd_wire_recv(link->sock_icc, &link->wire_icc, &msg_icc) == 0)
+    {
+        swicc_net_msg_st *const msg = msg_icc.msg;
+        uint32_t const buf_len =
+            (uint32_t)(msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+        uint8_t const ctrl = msg->data.ctrl;
+        msg->data.ctrl = SWICC_NET_MSG_CTRL_SUCCESS;
+        msg->data.buf_len_exp = 5U;
+        if (ctrl == SWICC_NET_MSG_CTRL_KEEPALIVE)
+        {
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+        }
+        else if (buf_len == 5U && msg->data.buf[4U] > 0U)
+        {
+            msg->data.buf_len_exp = msg->data.buf[4U];
+            msg->data.buf[0U] = msg->data.buf[1U];
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 1U;
+        }
+        else
+        {
+            msg->data.buf[0U] = 0x90;
+            msg->data.buf[1U] = 0x00;
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 2U;
+        }
+        if (ifd_wire_send(link->sock_icc, &link->wire_icc, msg) != 0)
+        {
+            break;
+        }
+    }
+    ifd_msg_free(&msg_icc);
+    return NULL;
+}
+
+static int32_t link_send(void *const ctx)
+{
+    link_st *const link = ctx;
+    return ifd_wire_send(link->sock_ifd, &link->wire_ifd, link->msg_tx.msg);
+}
+
+static int32_t link_recv(void *const ctx)
+{
+    link_st *const link = ctx;
+    return ifd_wire_recv(link->sock_ifd, &link->wire_ifd, &link->msg_rx);
+}
+
+/**
+ * @brief Connect the IFD handler and the ICC over loopback TCP.
+ * @param[out] link
+ * @param[in] cfg Impairment of the IFD handler side.
+ * @param[in] stream
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t link_open(link_st *const link,
+                         ifd_impair_cfg_st const *const cfg,
+                         uint32_t const stream)
+{
+    int32_t const sock_listen = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    if (sock_listen < 0 ||
+        bind(sock_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(sock_listen, 1) != 0 ||
+        getsockname(sock_listen, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        close(sock_listen);
+        return -1;
+    }
+    link->sock_icc = socket(AF_INET, SOCK_STREAM, 0);
+    if (link->sock_icc < 0 ||
+        connect(link->sock_icc, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(link->sock_icc);
+        close(sock_listen);
+        return -1;
+    }
+    link->sock_ifd = accept(sock_listen, NULL, NULL);
+    close(sock_listen);
+    if (link->sock_ifd < 0)
+    {
+        close(link->sock_icc);
+        return -1;
+    }
+    int const nodelay = 1;
+    setsockopt(link->sock_ifd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+               sizeof(nodelay));
+    setsockopt(link->sock_icc, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+               sizeof(nodelay));
+
+    ifd_msg_init(&link->msg_tx);
+    ifd_msg_init(&link->msg_rx);
+    ifd_msg_init(&link->msg_rx_spec);
+    ifd_wire_reset(&link->wire_ifd);
+    ifd_wire_reset(&link->wire_icc);
+    ifd_wire_version_set(&link->wire_ifd, IFD_WIRE_VERSION_2);
+    ifd_wire_version_set(&link->wire_icc, IFD_WIRE_VERSION_2);
+    link->wire_icc.impair = NULL;
+    link->wire_ifd.impair = NULL;
+    if (ifd_impair_enabled(cfg))
+    {
+        ifd_impair_init(&link->impair, cfg, stream);
+        link->wire_ifd.impair = &link->impair;
+    }
+    if (pthread_create(&link->icc_thread, NULL, icc_main, link) != 0)
+    {
+        close(link->sock_ifd);
+        close(link->sock_icc);
+        return -1;
+    }
+    return 0;
+}
+
+static void link_close(link_st *const link)
+{
+    shutdown(link->sock_ifd, SHUT_RDWR);
+    pthread_join(link->icc_thread, NULL);
+    close(link->sock_ifd);
+    close(link->sock_icc);
+}
+
+/**
+ * @brief Check if the ICC is present, like IFDHICCPresence does.
+ * @param[in, out] link
+ * @param[in, out] hist Where to add how long the check took.
+ * @return true if present, false if not.
+ */
+static bool presence(link_st *const link, ifd_lat_hist_st *const hist)
+{
+    uint64_t const start_ns = time_ns();
+    swicc_net_msg_st *const msg_tx = link->msg_tx.msg;
+    memset(&msg_tx->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx->data.ctrl = SWICC_NET_MSG_CTRL_KEEPALIVE;
+    msg_tx->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+    bool const present =
+        link_send(link) == 0 && link_recv(link) == 0 &&
+        link->msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS;
+    ifd_lat_hist_add(hist, time_ns() - start_ns);
+    return present;
+}
+
+/**
+ * @brief Run one command many times over an impaired link and print the
+ * latency.
+ * @param[in] scenario
+ * @param[in] rounds
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench(scenario_st const *const scenario, uint32_t const rounds)
+{
+    /* Case 3, SELECT by path. */
+    static uint8_t const apdu[] = {0x00, 0xA4, 0x08, 0x04,
+                                   0x04, 0x7F, 0xFF, 0x6F, 0x07};
+    static link_st link;
+    static ifd_lat_hist_st hist_apdu;
+    static ifd_lat_hist_st hist_presence;
+    memset(&hist_apdu, 0U, sizeof(hist_apdu));
+    memset(&hist_presence, 0U, sizeof(hist_presence));
+
+    uint32_t stream = 0U;
+    if (link_open(&link, &scenario->cfg, stream++) != 0)
+    {
+        fprintf(stderr, "%s: Failed to connect.\n", scenario->name);
+        return -1;
+    }
+    ifd_tpdu_io_st const io = {.send = link_send,
+                               .recv = link_recv,
+                               .ctx = &link,
+                               .msg_tx = &link.msg_tx,
+                               .msg_rx = &link.msg_rx,
+                               .msg_rx_spec = &link.msg_rx_spec};
+    ifd_tpdu_icc_st icc = {.buf_len_exp = 5U};
+    uint64_t apdu_fail_count = 0U;
+    uint64_t gone_count = 0U;
+    uint64_t gone_missed_count = 0U;
+    uint64_t reset_count = 0U;
+    uint64_t delay_us_sum = 0U;
+    uint64_t partial_count = 0U;
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        uint8_t rsp[256U + 2U];
+        uint32_t rsp_len = sizeof(rsp);
+        uint64_t const start_ns = time_ns();
+        bool const ok = ifd_tpdu_transceive(&io, &icc, apdu, sizeof(apdu), rsp,
+                                            &rsp_len) == 0;
+        uint64_t const lat_ns = time_ns() - start_ns;
+        if (ok)
+        {
+            ifd_lat_hist_add(&hist_apdu, lat_ns);
+        }
+        else
+        {
+            ++apdu_fail_count;
+        }
+
+        /* A failed APDU is followed by a presence check, like in PC/SC. */
+        if (!ok || (round + 1U) % BENCH_PRESENCE_INTERVAL == 0U)
+        {
+            if (presence(&link, &hist_presence))
+            {
+                gone_missed_count += ok ? 0U : 1U;
+                continue;
+            }
+            ++gone_count;
+            reset_count += link.impair.reset_count;
+            delay_us_sum += link.impair.delay_us_sum;
+            partial_count += link.impair.partial_count;
+            link_close(&link);
+            memset(&link.impair, 0U, sizeof(link.impair));
+            icc.buf_len_exp = 5U;
+            if (link_open(&link, &scenario->cfg, stream++) != 0)
+            {
+                fprintf(stderr, "%s: Failed to reconnect.\n", scenario->name);
+                return -1;
+            }
+        }
+    }
+    reset_count += link.impair.reset_count;
+    delay_us_sum += link.impair.delay_us_sum;
+    partial_count += link.impair.partial_count;
+    link_close(&link);
+
+    printf("%-8s APDU p50 %9lu p99 %9lu p999 %9lu max %9lu ns, %lu failed | "
+           "presence p99 %9lu ns, %lu gone, %lu missed | %lu resets, %lu "
+           "partial, %.1f us delay/APDU\n",
+           scenario->name,
+           (unsigned long)ifd_lat_hist_quantile(&hist_apdu, 500000U),
+           (unsigned long)ifd_lat_hist_quantile(&hist_apdu, 990000U),
+           (unsigned long)ifd_lat_hist_quantile(&hist_apdu, 999000U),
+           (unsigned long)hist_apdu.max_ns, (unsigned long)apdu_fail_count,
+           (unsigned long)ifd_lat_hist_quantile(&hist_presence, 990000U),
+           (unsigned long)gone_count, (unsigned long)gone_missed_count,
+           (unsigned long)reset_count, (unsigned long)partial_count,
+           (double)delay_us_sum / (double)rounds);
+    return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+    uint32_t rounds = BENCH_ROUNDS_DEF;
+    if (argc > 1)
+    {
+        rounds = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+
+    static scenario_st const scenario[] = {
+        {"none", {0U}},
+        {"delay", {.delay_us = 100U, .seed = 1U}},
+        {"uniform",
+         {.delay_us = 100U,
+          .jitter_us = 100U,
+          .dist = IFD_IMPAIR_DIST_UNIFORM,
+          .seed = 1U}},
+        {"exp",
+         {.delay_us = 100U,
+          .jitter_us = 100U,
+          .dist = IFD_IMPAIR_DIST_EXP,
+          .seed = 1U}},
+        {"pareto",
+         {.delay_us = 100U,
+          .jitter_us = 100U,
+          .dist = IFD_IMPAIR_DIST_PARETO,
+          .seed = 1U}},
+        {"partial", {.partial_ppm = 500000U, .seed = 1U}},
+        {"reset", {.reset_ppm = 2000U, .seed = 1U}},
+    };
+    for (uint32_t scenario_i = 0U;
+         scenario_i < sizeof(scenario) / sizeof(scenario[0U]); ++scenario_i)
+    {
+        if (bench(&scenario[scenario_i], rounds) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
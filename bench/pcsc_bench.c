@@ -0,0 +1,453 @@
+/**
+ * End-to-end benchmark through the PC/SC middleware. It connects to a running
+ * pcscd which has this IFD handler installed and cards connected to it, and
+ * measures what applications see: connecting to a card, resetting it with
+ * SCardReconnect, and transmitting APDUs of different sizes from 1 or more
+ * threads. For the APDUs, the time the IFD handler took (from its slot
+ * statistics) is subtracted from what the application saw, which leaves the
+ * time spent in pcscd and its IPC.
+ */
+
+#include <ifd_vendor.h>
+#include <pthread.h>
+#include <reader.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <winscard.h>
+
+#define BENCH_ROUNDS_DEF 1000U
+/* Only readers whose name contains this are used, unless another is given. */
+#define BENCH_READER_FILTER_DEF "swICC"
+#define BENCH_READER_COUNT_MAX 16U
+#define BENCH_THREAD_COUNT_MAX 8U
+/* Connecting and resetting are slow, so they get fewer rounds. */
+#define BENCH_ROUNDS_SLOW_DIV 10U
+
+typedef struct reader_s
+{
+    char const *name;
+    /* Kept connected by the main thread for reading the slot statistics. */
+    SCARDHANDLE card;
+} reader_st;
+
+typedef struct thread_s
+{
+    pthread_t thread;
+    reader_st const *reader;
+    uint32_t rounds;
+    uint8_t const *apdu;
+    uint32_t apdu_len;
+    /* Latency of each APDU in nanoseconds. */
+    uint64_t *lat_ns;
+    int32_t ret;
+} thread_st;
+
+static reader_st reader[BENCH_READER_COUNT_MAX];
+static uint32_t reader_count = 0U;
+static thread_st thread[BENCH_THREAD_COUNT_MAX];
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static int lat_cmp(void const *const a, void const *const b)
+{
+    uint64_t const lat_a = *(uint64_t const *)a;
+    uint64_t const lat_b = *(uint64_t const *)b;
+    return (lat_a > lat_b) - (lat_a < lat_b);
+}
+
+/**
+ * @brief Print the throughput and latency of some operations.
+ * @param[in] name
+ * @param[in, out] lat_ns Latency of each operation. Gets sorted.
+ * @param[in] op_count
+ * @param[in] dur_ns How long all operations took.
+ */
+static void lat_print(char const *const name, uint64_t *const lat_ns,
+                      size_t const op_count, uint64_t const dur_ns)
+{
+    uint64_t lat_ns_sum = 0U;
+    for (size_t op_i = 0U; op_i < op_count; ++op_i)
+    {
+        lat_ns_sum += lat_ns[op_i];
+    }
+    qsort(lat_ns, op_count, sizeof(lat_ns[0U]), lat_cmp);
+    printf("%-24s %10.0f op/s %9.1f us avg %9.1f us p50 %9.1f us p99 "
+           "%9.1f us max\n",
+           name, (double)op_count * 1e9 / (double)dur_ns,
+           (double)lat_ns_sum / (double)op_count / 1e3,
+           (double)lat_ns[op_count / 2U] / 1e3,
+           (double)lat_ns[op_count * 99U / 100U] / 1e3,
+           (double)lat_ns[op_count - 1U] / 1e3);
+}
+
+/**
+ * @brief Read the statistics of the slot of a reader from the IFD handler.
+ * @param[in, out] r
+ * @param[out] stats
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t slot_stats_get(reader_st *const r,
+                              ifd_vendor_slot_stats_st *const stats)
+{
+    for (uint32_t attempt = 0U; attempt < 2U; ++attempt)
+    {
+        DWORD stats_len = sizeof(*stats);
+        LONG const rv = SCardGetAttrib(r->card, IFD_VENDOR_TAG_SLOT_STATS,
+                                       (LPBYTE)stats, &stats_len);
+        if (rv == SCARD_S_SUCCESS && stats_len == sizeof(*stats))
+        {
+            return 0;
+        }
+        /* The card may have been reset by another connection. */
+        DWORD proto;
+        if (rv != SCARD_W_RESET_CARD ||
+            SCardReconnect(r->card, SCARD_SHARE_SHARED,
+                           SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                           SCARD_LEAVE_CARD, &proto) != SCARD_S_SUCCESS)
+        {
+            break;
+        }
+    }
+    fprintf(stderr, "%s: Failed to read the slot statistics.\n", r->name);
+    return -1;
+}
+
+/**
+ * @brief Connect to a card and disconnect again, many times.
+ * @param[in] ctx
+ * @param[in] rounds
+ * @param[out] lat_ns Space for the latency of all rounds.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench_connect(SCARDCONTEXT const ctx, uint32_t const rounds,
+                             uint64_t *const lat_ns)
+{
+    uint64_t const start_ns = time_ns();
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        uint64_t const round_start_ns = time_ns();
+        SCARDHANDLE card;
+        DWORD proto;
+        LONG const rv = SCardConnect(ctx, reader[0U].name, SCARD_SHARE_SHARED,
+                                     SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                                     &card, &proto);
+        if (rv != SCARD_S_SUCCESS)
+        {
+            fprintf(stderr, "Failed to connect: %s.\n",
+                    pcsc_stringify_error(rv));
+            return -1;
+        }
+        SCardDisconnect(card, SCARD_LEAVE_CARD);
+        lat_ns[round] = time_ns() - round_start_ns;
+    }
+    lat_print("connect", lat_ns, rounds, time_ns() - start_ns);
+    return 0;
+}
+
+/**
+ * @brief Reset a card with SCardReconnect, many times.
+ * @param[in] rounds
+ * @param[out] lat_ns Space for the latency of all rounds.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench_reset(uint32_t const rounds, uint64_t *const lat_ns)
+{
+    uint64_t const start_ns = time_ns();
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        uint64_t const round_start_ns = time_ns();
+        DWORD proto;
+        LONG const rv = SCardReconnect(
+            reader[0U].card, SCARD_SHARE_SHARED,
+            SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, SCARD_RESET_CARD, &proto);
+        if (rv != SCARD_S_SUCCESS)
+        {
+            fprintf(stderr, "Failed to reset: %s.\n",
+                    pcsc_stringify_error(rv));
+            return -1;
+        }
+        lat_ns[round] = time_ns() - round_start_ns;
+    }
+    lat_print("reconnect reset", lat_ns, rounds, time_ns() - start_ns);
+    return 0;
+}
+
+static void *thread_main(void *const arg)
+{
+    thread_st *const t = arg;
+    t->ret = -1;
+    SCARDCONTEXT ctx;
+    if (SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &ctx) !=
+        SCARD_S_SUCCESS)
+    {
+        return NULL;
+    }
+    SCARDHANDLE card;
+    DWORD proto;
+    LONG rv = SCardConnect(ctx, t->reader->name, SCARD_SHARE_SHARED,
+                           SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, &card,
+                           &proto);
+    if (rv == SCARD_S_SUCCESS)
+    {
+        SCARD_IO_REQUEST const *const pci =
+            proto == SCARD_PROTOCOL_T1 ? SCARD_PCI_T1 : SCARD_PCI_T0;
+        uint8_t rsp[MAX_BUFFER_SIZE];
+        uint32_t round = 0U;
+        for (; round < t->rounds; ++round)
+        {
+            DWORD rsp_len = sizeof(rsp);
+            uint64_t const start_ns = time_ns();
+            rv = SCardTransmit(card, pci, t->apdu, t->apdu_len, NULL, rsp,
+                               &rsp_len);
+            t->lat_ns[round] = time_ns() - start_ns;
+            if (rv != SCARD_S_SUCCESS || rsp_len < 2U)
+            {
+                break;
+            }
+        }
+        t->ret = round == t->rounds ? 0 : -1;
+        SCardDisconnect(card, SCARD_LEAVE_CARD);
+    }
+    if (t->ret != 0)
+    {
+        fprintf(stderr, "%s: Failed to transmit: %s.\n", t->reader->name,
+                pcsc_stringify_error(rv));
+    }
+    SCardReleaseContext(ctx);
+    return NULL;
+}
+
+/**
+ * @brief Transmit an APDU from several threads at once, each with its own
+ * context, spread over the readers. Prints what the application saw, and how
+ * much of it was spent in the IFD handler and how much in pcscd.
+ * @param[in] thread_count
+ * @param[in] apdu
+ * @param[in] apdu_len
+ * @param[in] rounds APDUs per thread.
+ * @param[out] lat_ns Space for the latency of all APDUs.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench_transmit(uint32_t const thread_count,
+                              uint8_t const *const apdu,
+                              uint32_t const apdu_len, uint32_t const rounds,
+                              uint64_t *const lat_ns)
+{
+    ifd_vendor_slot_stats_st stats_before[BENCH_READER_COUNT_MAX];
+    for (uint32_t reader_i = 0U; reader_i < reader_count; ++reader_i)
+    {
+        if (slot_stats_get(&reader[reader_i], &stats_before[reader_i]) != 0)
+        {
+            return -1;
+        }
+    }
+
+    int32_t ret = 0;
+    uint64_t const start_ns = time_ns();
+    uint32_t thread_running = 0U;
+    for (; thread_running < thread_count; ++thread_running)
+    {
+        thread_st *const t = &thread[thread_running];
+        t->reader = &reader[thread_running % reader_count];
+        t->rounds = rounds;
+        t->apdu = apdu;
+        t->apdu_len = apdu_len;
+        t->lat_ns = &lat_ns[thread_running * rounds];
+        if (pthread_create(&t->thread, NULL, thread_main, t) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    for (uint32_t thread_i = 0U; thread_i < thread_running; ++thread_i)
+    {
+        pthread_join(thread[thread_i].thread, NULL);
+        ret = thread[thread_i].ret == 0 ? ret : -1;
+    }
+    uint64_t const dur_ns = time_ns() - start_ns;
+    if (ret != 0)
+    {
+        return -1;
+    }
+
+    /* Time the IFD handler spent in IFDHTransmitToICC. */
+    uint64_t ifd_apdu_count = 0U;
+    uint64_t ifd_lat_ns_sum = 0U;
+    for (uint32_t reader_i = 0U; reader_i < reader_count; ++reader_i)
+    {
+        ifd_vendor_slot_stats_st stats_after;
+        if (slot_stats_get(&reader[reader_i], &stats_after) != 0)
+        {
+            return -1;
+        }
+        ifd_vendor_slot_stats_st const *const before = &stats_before[reader_i];
+        ifd_apdu_count += stats_after.apdu_count - before->apdu_count;
+        ifd_lat_ns_sum += stats_after.apdu_lat_ns_sum - before->apdu_lat_ns_sum;
+    }
+
+    size_t const apdu_count = (size_t)thread_count * rounds;
+    uint64_t app_lat_ns_sum = 0U;
+    for (size_t apdu_i = 0U; apdu_i < apdu_count; ++apdu_i)
+    {
+        app_lat_ns_sum += lat_ns[apdu_i];
+    }
+    char name[32U];
+    snprintf(name, sizeof(name), "transmit %3uB %u thr", apdu_len,
+             thread_count);
+    lat_print(name, lat_ns, apdu_count, dur_ns);
+    if (ifd_apdu_count > 0U)
+    {
+        double const app_us = (double)app_lat_ns_sum / (double)apdu_count / 1e3;
+        double const ifd_us =
+            (double)ifd_lat_ns_sum / (double)ifd_apdu_count / 1e3;
+        printf("%-24s %9.1f us IFD handler %9.1f us pcscd and IPC\n", "",
+               ifd_us, app_us - ifd_us);
+    }
+    return 0;
+}
+
+/**
+ * @brief Create a SELECT by path to a file that does not exist. The card has to
+ * receive all the data before it can fail, so the size of the data is what
+ * gets measured, and the state of the card does not change.
+ * @param[out] apdu Space for 5 + data_len bytes.
+ * @param[in] data_len Even, at most 254.
+ * @return Length of the APDU.
+ */
+static uint32_t apdu_select_make(uint8_t *const apdu, uint32_t const data_len)
+{
+    apdu[0U] = 0x00;
+    apdu[1U] = 0xA4;
+    apdu[2U] = 0x08;
+    apdu[3U] = 0x0C;
+    apdu[4U] = (uint8_t)data_len;
+    for (uint32_t data_i = 0U; data_i < data_len; data_i += 2U)
+    {
+        apdu[5U + data_i] = 0x7F;
+        apdu[5U + data_i + 1U] = 0xFE;
+    }
+    return 5U + data_len;
+}
+
+/**
+ * @brief Keep a connection to every reader which has a card.
+ * @param[in] ctx
+ * @param[in] readers List of reader names from SCardListReaders.
+ * @param[in] filter Only readers whose name contains this are used.
+ */
+static void readers_connect(SCARDCONTEXT const ctx, char const *const readers,
+                            char const *const filter)
+{
+    for (char const *name = readers;
+         *name != '\0' && reader_count < BENCH_READER_COUNT_MAX;
+         name += strlen(name) + 1U)
+    {
+        if (strstr(name, filter) == NULL)
+        {
+            continue;
+        }
+        DWORD proto;
+        if (SCardConnect(ctx, name, SCARD_SHARE_SHARED,
+                         SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                         &reader[reader_count].card,
+                         &proto) == SCARD_S_SUCCESS)
+        {
+            reader[reader_count++].name = name;
+            printf("Using '%s'.\n", name);
+        }
+    }
+}
+
+int main(int const argc, char const *const argv[])
+{
+    static uint32_t const data_len[] = {2U, 32U, 128U, 254U};
+    uint32_t rounds = BENCH_ROUNDS_DEF;
+    char const *filter = BENCH_READER_FILTER_DEF;
+    if (argc > 1)
+    {
+        rounds = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        filter = argv[2U];
+    }
+    if (rounds < BENCH_ROUNDS_SLOW_DIV)
+    {
+        return EXIT_FAILURE;
+    }
+
+    SCARDCONTEXT ctx;
+    LONG rv = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &ctx);
+    if (rv != SCARD_S_SUCCESS)
+    {
+        fprintf(stderr, "Failed to connect to pcscd: %s.\n",
+                pcsc_stringify_error(rv));
+        return EXIT_FAILURE;
+    }
+    DWORD readers_len = 0U;
+    char *readers = NULL;
+    rv = SCardListReaders(ctx, NULL, NULL, &readers_len);
+    if (rv == SCARD_S_SUCCESS && (readers = malloc(readers_len)) != NULL)
+    {
+        rv = SCardListReaders(ctx, NULL, readers, &readers_len);
+    }
+    uint64_t *const lat_ns =
+        malloc((size_t)BENCH_THREAD_COUNT_MAX * rounds * sizeof(lat_ns[0U]));
+    if (rv != SCARD_S_SUCCESS || readers == NULL || lat_ns == NULL)
+    {
+        fprintf(stderr, "Failed to list readers.\n");
+        free(lat_ns);
+        free(readers);
+        SCardReleaseContext(ctx);
+        return EXIT_FAILURE;
+    }
+    readers_connect(ctx, readers, filter);
+
+    int ret = EXIT_SUCCESS;
+    uint8_t apdu[5U + 255U];
+    if (reader_count == 0U)
+    {
+        fprintf(stderr, "No reader with '%s' in its name has a card.\n",
+                filter);
+        ret = EXIT_FAILURE;
+    }
+    else if (bench_connect(ctx, rounds / BENCH_ROUNDS_SLOW_DIV, lat_ns) != 0 ||
+             bench_reset(rounds / BENCH_ROUNDS_SLOW_DIV, lat_ns) != 0)
+    {
+        ret = EXIT_FAILURE;
+    }
+    for (uint32_t len_i = 0U;
+         ret == EXIT_SUCCESS && len_i < sizeof(data_len) / sizeof(data_len[0U]);
+         ++len_i)
+    {
+        uint32_t const apdu_len = apdu_select_make(apdu, data_len[len_i]);
+        ret = bench_transmit(1U, apdu, apdu_len, rounds, lat_ns) == 0
+                  ? EXIT_SUCCESS
+                  : EXIT_FAILURE;
+    }
+    for (uint32_t thread_count = 2U;
+         ret == EXIT_SUCCESS && thread_count <= BENCH_THREAD_COUNT_MAX;
+         thread_count *= 2U)
+    {
+        uint32_t const apdu_len = apdu_select_make(apdu, data_len[0U]);
+        ret = bench_transmit(thread_count, apdu, apdu_len, rounds, lat_ns) == 0
+                  ? EXIT_SUCCESS
+                  : EXIT_FAILURE;
+    }
+
+    for (uint32_t reader_i = 0U; reader_i < reader_count; ++reader_i)
+    {
+        SCardDisconnect(reader[reader_i].card, SCARD_LEAVE_CARD);
+    }
+    free(lat_ns);
+    free(readers);
+    SCardReleaseContext(ctx);
+    return ret;
+}
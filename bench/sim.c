@@ -0,0 +1,484 @@
+/**
+ * Simulated ICCs for reproducible performance tests.
+ */
+
+#include <clock.h>
+#include <math.h>
+#include <msg.h>
+#include <net.h>
+#include <poll.h>
+#include <sim.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wire.h>
+
+/* FNV-1a of the digest. */
+#define SIM_HASH_OFFSET 0xCBF29CE484222325U
+#define SIM_HASH_PRIME 0x100000001B3U
+
+typedef struct sim_icc_s
+{
+    uint32_t id;
+    /* End of the connection of the ICC, -1 if it is not connected. */
+    int32_t sock;
+    /* End of the connection of the IFD handler. */
+    int32_t sock_ifd;
+    ifd_wire_st wire;
+    /* When the ICC goes away, 0 if never. */
+    uint64_t leave_ns;
+    /* When the ICC is done with what it got so far. */
+    uint64_t busy_until_ns;
+    /* When the last reply arrives at the IFD handler. */
+    uint64_t rx_ns;
+    /* Header of the command whose data is expected next. */
+    uint8_t hdr[5U];
+    uint32_t data_len_exp;
+    /* Told that the reader is busy, so it connects again once disconnected. */
+    bool busy;
+    struct sim_icc_s *next;
+} sim_icc_st;
+
+static ifd_sim_cfg_st sim_cfg = {0U};
+static sim_icc_st *sim_icc = NULL;
+/* Connected ICCs. */
+static sim_icc_st *sim_icc_conn = NULL;
+/**
+ * ICCs are connected in order, this is the next one. ICCs which connect again
+ * go first, in the order they were disconnected.
+ */
+static uint32_t sim_icc_next = 0U;
+static sim_icc_st *sim_icc_again = NULL;
+static sim_icc_st *sim_icc_again_last = NULL;
+/* Stands in for the listening socket. */
+static int32_t sim_sock_server = -1;
+static uint64_t sim_rng = 0U;
+static ifd_sim_stats_st sim_stats = {0U};
+/* The ICCs take turns, so they share one message, which is full-size. */
+static ifd_msg_st sim_msg = {0U};
+
+/* ATR with only the historical bytes "SIM", i.e., T=0. */
+static uint8_t const sim_atr[] = {0x3B, 0x03, 'S', 'I', 'M'};
+
+/**
+ * @brief Get the next random number (splitmix64).
+ * @return Random number.
+ */
+static uint64_t sim_rand(void)
+{
+    sim_rng += 0x9E3779B97F4A7C15U;
+    uint64_t z = sim_rng;
+    z = (z ^ (z >> 30U)) * 0xBF58476D1CE4E5B9U;
+    z = (z ^ (z >> 27U)) * 0x94D049BB133111EBU;
+    return z ^ (z >> 31U);
+}
+
+/**
+ * @brief Mix some bytes into the digest.
+ * @param[in] buf
+ * @param[in] buf_len
+ */
+static void sim_digest(void const *const buf, size_t const buf_len)
+{
+    uint8_t const *const bytes = buf;
+    for (size_t byte_i = 0U; byte_i < buf_len; ++byte_i)
+    {
+        sim_stats.digest ^= bytes[byte_i];
+        sim_stats.digest *= SIM_HASH_PRIME;
+    }
+}
+
+/**
+ * @brief Find the ICC on a connection.
+ * @param[in] sock Socket of the IFD handler.
+ * @return The ICC, or NULL if there is none.
+ */
+static sim_icc_st *sim_icc_find(int32_t const sock)
+{
+    for (sim_icc_st *icc = sim_icc_conn; icc != NULL; icc = icc->next)
+    {
+        if (icc->sock_ifd == sock)
+        {
+            return icc;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Let an ICC go away, or wait to connect again if it was told that the
+ * reader is busy. The IFD handler sees its connection closed.
+ * @param[in, out] icc
+ */
+static void sim_icc_leave(sim_icc_st *const icc)
+{
+    for (sim_icc_st **link = &sim_icc_conn; *link != NULL;
+         link = &(*link)->next)
+    {
+        if (*link == icc)
+        {
+            *link = icc->next;
+            break;
+        }
+    }
+    close(icc->sock);
+    icc->sock = -1;
+    icc->next = NULL;
+    --sim_stats.icc_connected;
+    if (!icc->busy)
+    {
+        ++sim_stats.icc_gone;
+        return;
+    }
+    if (sim_icc_again_last != NULL)
+    {
+        sim_icc_again_last->next = icc;
+    }
+    else
+    {
+        sim_icc_again = icc;
+    }
+    sim_icc_again_last = icc;
+    ++sim_stats.icc_waiting;
+}
+
+/**
+ * @brief Make the message a reply with a given buffer.
+ * @param[in] buf
+ * @param[in] buf_len
+ * @param[in] buf_len_exp How much the ICC expects in the next message.
+ */
+static void sim_rsp(uint8_t const *const buf, uint32_t const buf_len,
+                    uint32_t const buf_len_exp)
+{
+    sim_msg.msg->data.ctrl = SWICC_NET_MSG_CTRL_SUCCESS;
+    sim_msg.msg->data.buf_len_exp = buf_len_exp;
+    if (buf_len > 0U)
+    {
+        memmove(sim_msg.msg->data.buf, buf, buf_len);
+    }
+    sim_msg.msg->hdr.size =
+        (uint32_t)offsetof(swicc_net_msg_data_st, buf) + buf_len;
+}
+
+/**
+ * @brief Answer a TPDU the way tpdu.h expects a T=0 ICC to: reads (READ BINARY
+ * and READ RECORD) get zeros, other headers with a P3 get an ACK for their
+ * data, and everything else gets a success status.
+ * @param[in, out] icc
+ * @param[in] buf_len
+ */
+static void sim_icc_tpdu(sim_icc_st *const icc, uint32_t const buf_len)
+{
+    static uint8_t const sw_success[2U] = {0x90, 0x00};
+    if (icc->data_len_exp > 0U)
+    {
+        icc->data_len_exp = 0U;
+        sim_rsp(sw_success, sizeof(sw_success), 5U);
+    }
+    else if (buf_len == 5U && (sim_msg.msg->data.buf[1U] == 0xB0 ||
+                               sim_msg.msg->data.buf[1U] == 0xB2))
+    {
+        /* P3 of 0 means 256 bytes are expected. */
+        uint32_t const le =
+            sim_msg.msg->data.buf[4U] == 0U ? 256U : sim_msg.msg->data.buf[4U];
+        uint8_t rsp[256U + 2U] = {0U};
+        rsp[le] = 0x90;
+        sim_rsp(rsp, le + 2U, 5U);
+    }
+    else if (buf_len == 5U && sim_msg.msg->data.buf[4U] > 0U)
+    {
+        memcpy(icc->hdr, sim_msg.msg->data.buf, sizeof(icc->hdr));
+        icc->data_len_exp = icc->hdr[4U];
+        sim_rsp(&icc->hdr[1U], 1U, icc->data_len_exp);
+    }
+    else
+    {
+        sim_rsp(sw_success, sizeof(sw_success), 5U);
+    }
+}
+
+/**
+ * @brief Answer the message. The reply replaces it.
+ * @param[in, out] icc
+ * @return Wire format version to switch to after replying, 0 to keep it.
+ */
+static uint8_t sim_icc_answer(sim_icc_st *const icc)
+{
+    uint32_t const buf_len =
+        (uint32_t)(sim_msg.msg->hdr.size -
+                   offsetof(swicc_net_msg_data_st, buf));
+    switch (sim_msg.msg->data.ctrl)
+    {
+    case SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_Y:
+    case SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_N:
+    case SWICC_NET_MSG_CTRL_MOCK_RESET_WARM_PPS_N:
+        icc->data_len_exp = 0U;
+        sim_rsp(sim_atr, sizeof(sim_atr), 5U);
+        return 0U;
+    case IFD_NET_MSG_CTRL_WIRE_VERSION: {
+        uint8_t version = IFD_WIRE_VERSION_1;
+        if (buf_len >= 1U && sim_msg.msg->data.buf[0U] >= IFD_WIRE_VERSION_2)
+        {
+            version = IFD_WIRE_VERSION_2;
+        }
+        uint8_t const rsp[2U] = {version, 0U};
+        sim_rsp(rsp, sizeof(rsp), 0U);
+        return version;
+    }
+    case SWICC_NET_MSG_CTRL_KEEPALIVE:
+    case IFD_NET_MSG_CTRL_POWER_DOWN:
+    case IFD_NET_MSG_CTRL_RESUME_TOKEN_SET:
+    /* Without a token, the ICC starts a new session. */
+    case IFD_NET_MSG_CTRL_RESUME_TOKEN_GET:
+        sim_rsp(NULL, 0U, sim_msg.msg->data.buf_len_exp);
+        return 0U;
+    default:
+        sim_icc_tpdu(icc, buf_len);
+        return 0U;
+    }
+}
+
+int32_t ifd_sim_start(ifd_sim_cfg_st const *const cfg)
+{
+    ifd_sim_stop();
+    ifd_msg_init(&sim_msg);
+    if (ifd_msg_reserve(&sim_msg, IFD_MSG_BUF_LEN_MAX) != 0)
+    {
+        return -1;
+    }
+    int sock_pair[2U];
+    sim_icc = calloc(cfg->icc_count, sizeof(*sim_icc));
+    if (sim_icc == NULL ||
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sock_pair) != 0)
+    {
+        free(sim_icc);
+        sim_icc = NULL;
+        return -1;
+    }
+    /* Nothing is ever sent on the other end. */
+    close(sock_pair[1U]);
+    sim_sock_server = sock_pair[0U];
+
+    sim_cfg = *cfg;
+    for (uint32_t icc_i = 0U; icc_i < cfg->icc_count; ++icc_i)
+    {
+        sim_icc[icc_i].id = icc_i;
+        sim_icc[icc_i].sock = -1;
+        sim_icc[icc_i].sock_ifd = -1;
+    }
+    sim_icc_conn = NULL;
+    sim_icc_next = 0U;
+    sim_icc_again = NULL;
+    sim_icc_again_last = NULL;
+    sim_rng = cfg->seed;
+    memset(&sim_stats, 0U, sizeof(sim_stats));
+    sim_stats.icc_waiting = cfg->icc_count;
+    sim_stats.digest = SIM_HASH_OFFSET;
+    ifd_clock_virtual_set(true);
+    return sim_sock_server;
+}
+
+void ifd_sim_stop(void)
+{
+    while (sim_icc_conn != NULL)
+    {
+        sim_icc_leave(sim_icc_conn);
+    }
+    free(sim_icc);
+    sim_icc = NULL;
+    if (sim_msg.msg != NULL)
+    {
+        ifd_msg_free(&sim_msg);
+    }
+    if (sim_sock_server >= 0)
+    {
+        close(sim_sock_server);
+        sim_sock_server = -1;
+        ifd_clock_virtual_set(false);
+    }
+}
+
+/**
+ * @brief Check if an ICC is waiting to be connected.
+ * @param[in] sock_server
+ * @return true if one is, false if not.
+ */
+static bool sim_io_pending(int32_t const sock_server)
+{
+    return sim_icc != NULL &&
+           (sim_icc_again != NULL || sim_icc_next < sim_cfg.icc_count);
+}
+
+/**
+ * @brief Connect the next waiting ICC.
+ * @param[in] sock_server
+ * @return Socket of the connection on success, -1 on failure.
+ */
+static int32_t sim_io_accept(int32_t const sock_server)
+{
+    int sock_pair[2U];
+    if (!sim_io_pending(sock_server) ||
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sock_pair) != 0)
+    {
+        return -1;
+    }
+    sim_icc_st *icc = sim_icc_again;
+    if (icc != NULL)
+    {
+        sim_icc_again = icc->next;
+        if (sim_icc_again == NULL)
+        {
+            sim_icc_again_last = NULL;
+        }
+    }
+    else
+    {
+        icc = &sim_icc[sim_icc_next++];
+    }
+    icc->busy = false;
+    icc->sock = sock_pair[1U];
+    icc->sock_ifd = sock_pair[0U];
+    ifd_wire_reset(&icc->wire);
+    icc->leave_ns = 0U;
+    if (sim_cfg.life_ms > 0U)
+    {
+        /* Exponential with a mean of the life. */
+        double const unit =
+            (double)((sim_rand() >> 11U) + 1U) / 9007199254740992.0;
+        icc->leave_ns = ifd_clock_ns() +
+                        (uint64_t)(-log(unit) * sim_cfg.life_ms * 1000000.0);
+    }
+    icc->busy_until_ns = 0U;
+    icc->rx_ns = 0U;
+    icc->data_len_exp = 0U;
+    icc->next = sim_icc_conn;
+    sim_icc_conn = icc;
+    --sim_stats.icc_waiting;
+    ++sim_stats.icc_connected;
+    return icc->sock_ifd;
+}
+
+/**
+ * @brief Let the ICC on a connection answer the messages that were sent to it.
+ * Nothing is done if the socket is not that of a simulated ICC.
+ * @param[in] sock
+ */
+static void sim_serve(int32_t const sock)
+{
+    sim_icc_st *const icc = sim_icc_find(sock);
+    if (icc == NULL)
+    {
+        return;
+    }
+    uint64_t const now = ifd_clock_ns();
+    uint64_t const rtt_half_ns = (uint64_t)sim_cfg.rtt_us * 500U;
+    struct pollfd pfd = {.fd = icc->sock, .events = POLLIN};
+    while (poll(&pfd, 1U, 0) > 0)
+    {
+        if (ifd_wire_recv(icc->sock, &icc->wire, &sim_msg) != 0 ||
+            (icc->leave_ns != 0U && now >= icc->leave_ns))
+        {
+            sim_icc_leave(icc);
+            return;
+        }
+        ++sim_stats.msg_count;
+        sim_digest(&now, sizeof(now));
+        sim_digest(&icc->id, sizeof(icc->id));
+        sim_digest(&sim_msg.msg->data, sim_msg.msg->hdr.size);
+        if (sim_msg.msg->data.ctrl == IFD_NET_MSG_CTRL_BUSY)
+        {
+            /* Not answered, the IFD handler disconnects it next. */
+            icc->busy = true;
+            ++sim_stats.busy_count;
+            continue;
+        }
+
+        /* The ICC does one thing at a time. */
+        uint64_t const start_ns = now + rtt_half_ns > icc->busy_until_ns
+                                      ? now + rtt_half_ns
+                                      : icc->busy_until_ns;
+        icc->busy_until_ns = start_ns + (uint64_t)sim_cfg.icc_us * 1000U;
+        icc->rx_ns = icc->busy_until_ns + rtt_half_ns;
+
+        uint8_t const version = sim_icc_answer(icc);
+        if (ifd_wire_send(icc->sock, &icc->wire, sim_msg.msg) != 0)
+        {
+            sim_icc_leave(icc);
+            return;
+        }
+        if (version != 0U)
+        {
+            ifd_wire_version_set(&icc->wire, version);
+        }
+    }
+}
+
+/**
+ * @brief Send a message to the ICC on a connection, which answers it right
+ * away.
+ * @param[in] sock
+ * @param[in, out] wire
+ * @param[in] msg
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t sim_io_send(int32_t const sock, ifd_wire_st *const wire,
+                           swicc_net_msg_st const *const msg)
+{
+    if (ifd_wire_send(sock, wire, msg) != 0)
+    {
+        return -1;
+    }
+    sim_serve(sock);
+    return 0;
+}
+
+/**
+ * @brief Receive a message from the ICC on a connection, and move virtual time
+ * to when its last reply arrived.
+ * @param[in] sock
+ * @param[in, out] wire
+ * @param[out] msg
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t sim_io_recv(int32_t const sock, ifd_wire_st *const wire,
+                           ifd_msg_st *const msg)
+{
+    if (ifd_wire_recv(sock, wire, msg) != 0)
+    {
+        return -1;
+    }
+    sim_icc_st const *const icc = sim_icc_find(sock);
+    if (icc != NULL)
+    {
+        ifd_clock_advance_to(icc->rx_ns);
+    }
+    return 0;
+}
+
+/**
+ * @brief Let the ICC on a connection go away, and close the socket.
+ * @param[in] sock
+ */
+static void sim_io_close(int32_t const sock)
+{
+    sim_icc_st *const icc = sim_icc_find(sock);
+    if (icc != NULL)
+    {
+        sim_icc_leave(icc);
+    }
+    close(sock);
+}
+
+ifd_io_st const ifd_sim_io = {.send = sim_io_send,
+                              .recv = sim_io_recv,
+                              .pending = sim_io_pending,
+                              .accept = sim_io_accept,
+                              .close = sim_io_close};
+
+void ifd_sim_stats(ifd_sim_stats_st *const stats)
+{
+    *stats = sim_stats;
+}
@@ -0,0 +1,76 @@
+#pragma once
+/**
+ * Simulated ICCs for reproducible performance tests. They are installed as the
+ * I/O of the IFD handler (see io.h), which then takes them from here instead
+ * of listening for ICCs on the network. Each one is connected over a socket
+ * pair and answers a message as soon as it is sent, in the thread that sent
+ * it. The time the network and the ICC take only passes
+ * in virtual time (see clock.h): a reply is received at the time it would have
+ * arrived over a network with the configured round-trip time.
+ *
+ * All ICCs are waiting to be connected when the simulation starts. Each one
+ * stays for a random time (exponential with a mean of the configured life) and
+ * goes away at the first message it gets after that, so thousands of ICCs can
+ * pass through the slots of the reader. An ICC which is told that the reader is
+ * busy waits to be connected again, ahead of those which never were. Every
+ * message the ICCs get is summed up in a digest, which is the same whenever the
+ * configuration and the calls to the IFD handler are the same.
+ *
+ * The ICCs answer like a card with a file system that can't be changed: reads
+ * get zeros, and every command succeeds. They support wire format version 2
+ * but no optional features.
+ */
+
+#include <io.h>
+#include <stdint.h>
+
+typedef struct ifd_sim_cfg_s
+{
+    /* How many ICCs there are. */
+    uint32_t icc_count;
+    /* Round-trip time of the network. */
+    uint32_t rtt_us;
+    /* How long an ICC takes to answer a message. */
+    uint32_t icc_us;
+    /* Mean of how long an ICC stays connected. 0 means forever. */
+    uint32_t life_ms;
+    uint32_t seed;
+} ifd_sim_cfg_st;
+
+typedef struct ifd_sim_stats_s
+{
+    /* ICCs by what they are doing. */
+    uint32_t icc_waiting;
+    uint32_t icc_connected;
+    uint32_t icc_gone;
+    /* Times ICCs were told that the reader is busy. */
+    uint64_t busy_count;
+    /* Messages the ICCs got, and the digest of them. */
+    uint64_t msg_count;
+    uint64_t digest;
+} ifd_sim_stats_st;
+
+/**
+ * I/O of the IFD handler with the simulated ICCs, which is installed with
+ * ifd_io_set along with the socket from ifd_sim_start.
+ */
+extern ifd_io_st const ifd_sim_io;
+
+/**
+ * @brief Start the simulation and switch the clock to virtual time.
+ * @param[in] cfg Copied.
+ * @return A descriptor which stands in for the listening socket on success, -1
+ * on failure. Nothing can be accepted from it other than with ifd_sim_io.
+ */
+int32_t ifd_sim_start(ifd_sim_cfg_st const *const cfg);
+
+/**
+ * @brief Stop the simulation, disconnect all ICCs, and switch the clock back.
+ */
+void ifd_sim_stop(void);
+
+/**
+ * @brief Get the statistics of the simulation.
+ * @param[out] stats
+ */
+void ifd_sim_stats(ifd_sim_stats_st *const stats);
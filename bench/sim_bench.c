@@ -0,0 +1,227 @@
+/**
+ * Simulation of a reader with many cards over hours, in virtual time (see
+ * sim.h), so it runs in seconds and does the same on every run. It calls the
+ * IFD handler the way the PC/SC daemon does: every slot is checked for a card
+ * on each poll interval, and a card that shows up is powered up, then gets a
+ * SELECT and a READ BINARY on every interval until it goes away. It is run
+ * with presence checks of one slot at a time and with sweeps of all slots, and
+ * reports the virtual time spent in presence checks per interval, what the
+ * cards did, and the digest of all messages the cards got. The digest only
+ * changes between commits if what is sent to the cards changed.
+ */
+
+#include <cfg.h>
+#include <clock.h>
+#include <ifdhandler.h>
+#include <io.h>
+#include <sim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <swicc/swicc.h>
+#include <time.h>
+
+#define BENCH_ICC_COUNT_DEF 1000U
+#define BENCH_HOURS_DEF 1U
+#define BENCH_SLOT_COUNT IFD_CFG_SLOT_COUNT_MAX
+/* How often the PC/SC daemon checks every slot for a card. */
+#define BENCH_POLL_MS 400U
+#define BENCH_RTT_US 500U
+#define BENCH_ICC_US 2000U
+/* Cards stay for a minute on average. */
+#define BENCH_LIFE_MS 60000U
+#define BENCH_DEVICE_LEN_MAX 256U
+
+typedef struct scenario_s
+{
+    char const *name;
+    uint32_t presence_window_ms;
+} scenario_st;
+
+/**
+ * Logger of PC/SC-lite, only needed if logging was not compiled out.
+ */
+void log_msg(const int priority, const char *fmt, ...)
+{
+}
+
+static uint64_t time_real_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Give the card in a slot the APDUs of one interval.
+ * @param[in] lun
+ * @return How many APDUs succeeded.
+ */
+static uint32_t apdus(DWORD const lun)
+{
+    static UCHAR apdu_select[] = {0x00, 0xA4, 0x00, 0x04, 0x02, 0x3F, 0x00};
+    static UCHAR apdu_read[] = {0x00, 0xB0, 0x00, 0x00, 0x10};
+    static struct
+    {
+        UCHAR *apdu;
+        DWORD apdu_len;
+    } const apdu_list[] = {
+        {apdu_select, sizeof(apdu_select)},
+        {apdu_read, sizeof(apdu_read)},
+    };
+
+    uint32_t count = 0U;
+    for (uint32_t apdu_i = 0U;
+         apdu_i < sizeof(apdu_list) / sizeof(apdu_list[0U]); ++apdu_i)
+    {
+        SCARD_IO_HEADER const pci_tx = {.Protocol = SCARD_PROTOCOL_T0,
+                                        .Length = sizeof(pci_tx)};
+        SCARD_IO_HEADER pci_rx;
+        UCHAR rsp[256U + 2U];
+        DWORD rsp_len = sizeof(rsp);
+        if (IFDHTransmitToICC(lun, pci_tx, apdu_list[apdu_i].apdu,
+                              apdu_list[apdu_i].apdu_len, rsp, &rsp_len,
+                              &pci_rx) == IFD_SUCCESS)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Run a scenario and print what happened.
+ * @param[in] scenario
+ * @param[in] icc_count
+ * @param[in] hours Of virtual time.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench(scenario_st const *const scenario,
+                     uint32_t const icc_count, uint32_t const hours)
+{
+    ifd_sim_cfg_st const sim_cfg = {.icc_count = icc_count,
+                                    .rtt_us = BENCH_RTT_US,
+                                    .icc_us = BENCH_ICC_US,
+                                    .life_ms = BENCH_LIFE_MS,
+                                    .seed = 1U};
+    int32_t const sock_server = ifd_sim_start(&sim_cfg);
+    if (sock_server < 0)
+    {
+        fprintf(stderr, "%s: Failed to start the simulation.\n",
+                scenario->name);
+        return -1;
+    }
+    ifd_io_set(&ifd_sim_io, sock_server);
+
+    char device[BENCH_DEVICE_LEN_MAX];
+    snprintf(device, sizeof(device),
+             "tcp://?persist=0&slots=%u&presence_window_ms=%u",
+             BENCH_SLOT_COUNT, scenario->presence_window_ms);
+    for (DWORD lun = 0U; lun < BENCH_SLOT_COUNT; ++lun)
+    {
+        if (IFDHCreateChannelByName(lun, device) != IFD_SUCCESS)
+        {
+            fprintf(stderr, "%s: Failed to create the reader.\n",
+                    scenario->name);
+            ifd_io_set(NULL, -1);
+            ifd_sim_stop();
+            return -1;
+        }
+    }
+
+    bool powered[BENCH_SLOT_COUNT] = {false};
+    uint64_t poll_count = 0U;
+    uint64_t presence_ns_sum = 0U;
+    uint64_t apdu_count = 0U;
+    uint64_t const real_start_ns = time_real_ns();
+    uint64_t const start_ns = ifd_clock_ns();
+    uint64_t const end_ns = start_ns + (uint64_t)hours * 3600000000000U;
+    while (ifd_clock_ns() < end_ns)
+    {
+        uint64_t const poll_start_ns = ifd_clock_ns();
+        for (DWORD lun = 0U; lun < BENCH_SLOT_COUNT; ++lun)
+        {
+            uint64_t const presence_start_ns = ifd_clock_ns();
+            RESPONSECODE const present = IFDHICCPresence(lun);
+            presence_ns_sum += ifd_clock_ns() - presence_start_ns;
+            if (present != IFD_ICC_PRESENT)
+            {
+                powered[lun] = false;
+                continue;
+            }
+            UCHAR atr[MAX_ATR_SIZE];
+            DWORD atr_len = sizeof(atr);
+            if (!powered[lun] &&
+                IFDHPowerICC(lun, IFD_POWER_UP, atr, &atr_len) == IFD_SUCCESS)
+            {
+                powered[lun] = true;
+            }
+            if (powered[lun])
+            {
+                apdu_count += apdus(lun);
+            }
+        }
+        ++poll_count;
+
+        uint64_t const poll_end_ns =
+            poll_start_ns + (uint64_t)BENCH_POLL_MS * 1000000U;
+        uint64_t const now_ns = ifd_clock_ns();
+        if (now_ns < poll_end_ns)
+        {
+            ifd_clock_sleep_ns(poll_end_ns - now_ns);
+        }
+    }
+    uint64_t const dur_ns = ifd_clock_ns() - start_ns;
+    uint64_t const real_dur_ns = time_real_ns() - real_start_ns;
+
+    ifd_sim_stats_st stats;
+    ifd_sim_stats(&stats);
+    for (DWORD lun = 0U; lun < BENCH_SLOT_COUNT; ++lun)
+    {
+        IFDHCloseChannel(lun);
+    }
+    ifd_io_set(NULL, -1);
+    ifd_sim_stop();
+
+    printf("%-8s %8.3f ms presence/poll %10lu APDUs %6u cards gone %8lu busy "
+           "%10lu msgs | %7.2f s real %7.0fx | digest %016lx\n",
+           scenario->name,
+           (double)presence_ns_sum / (double)poll_count / 1e6,
+           (unsigned long)apdu_count, stats.icc_gone,
+           (unsigned long)stats.busy_count, (unsigned long)stats.msg_count,
+           (double)real_dur_ns / 1e9,
+           (double)dur_ns / (double)real_dur_ns, (unsigned long)stats.digest);
+    return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+    uint32_t icc_count = BENCH_ICC_COUNT_DEF;
+    uint32_t hours = BENCH_HOURS_DEF;
+    if (argc > 1)
+    {
+        icc_count = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        hours = (uint32_t)strtoul(argv[2U], NULL, 10);
+    }
+    if (icc_count == 0U || hours == 0U)
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* A sweep is done on every poll interval. */
+    static scenario_st const scenario[] = {
+        {"serial", 0U},
+        {"sweep", BENCH_POLL_MS / 2U},
+    };
+    for (uint32_t scenario_i = 0U;
+         scenario_i < sizeof(scenario) / sizeof(scenario[0U]); ++scenario_i)
+    {
+        if (bench(&scenario[scenario_i], icc_count, hours) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
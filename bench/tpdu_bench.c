@@ -0,0 +1,415 @@
+/**
+ * Microbenchmark of the TPDU state machine. It drives the state machine with an
+ * in-memory ICC so only the cost of the state machine itself is measured, and
+ * reports state machine steps (messages exchanged with the ICC) per second for
+ * each TPDU case, with and without pipelining. Each case is also run against
+ * an ICC which first answers every header with a NULL procedure byte. Runs of
+ * reads are also sent one by one and as a batch in one message. Any command
+ * which does not succeed fails the benchmark.
+ */
+
+#include <debuglog.h>
+#include <msg.h>
+#include <net.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tpdu.h>
+
+#define BENCH_ROUNDS_DEF 1000000U
+/* Commands in a run of reads. */
+#define BENCH_BATCH_LEN 8U
+/* Replies the in-memory ICC can have queued up (2 when pipelining). */
+#define ICC_RSP_COUNT_MAX 2U
+
+/**
+ * An ICC which answers every command with success, and with data when it asks
+ * for data from the ICC (INS of READ BINARY or READ RECORD). It answers batches
+ * of commands too. It can also ask for more time with a NULL procedure byte
+ * before answering a header, and then discards data that was pipelined.
+ */
+typedef struct icc_fake_s
+{
+    ifd_msg_st msg_tx;
+    ifd_msg_st msg_rx;
+    ifd_msg_st msg_rx_spec;
+    swicc_net_msg_st rsp[ICC_RSP_COUNT_MAX];
+    uint32_t rsp_count;
+    uint32_t rsp_idx;
+    /* The header of the command that is being processed. */
+    uint8_t hdr[5U];
+    /* Data that is expected from the interface after the header. */
+    uint32_t data_len_exp;
+    /* Answer every header with a NULL procedure byte first. */
+    bool null_proc;
+    /* A NULL procedure byte was sent and the header is not answered yet. */
+    bool null_sent;
+    uint64_t step_count;
+} icc_fake_st;
+
+/**
+ * Logger of PC/SC-lite, only needed if logging was not compiled out.
+ */
+void log_msg(const int priority, const char *fmt, ...)
+{
+}
+
+/**
+ * @brief Queue a reply of the in-memory ICC.
+ * @param[in, out] icc
+ * @param[in] buf
+ * @param[in] buf_len
+ * @param[in] buf_len_exp
+ */
+static void icc_fake_rsp(icc_fake_st *const icc, uint8_t const *const buf,
+                         uint32_t const buf_len, uint32_t const buf_len_exp)
+{
+    swicc_net_msg_st *const rsp = &icc->rsp[icc->rsp_count++];
+    rsp->hdr.size = offsetof(swicc_net_msg_data_st, buf) + buf_len;
+    rsp->data.cont_state = 0U;
+    rsp->data.ctrl = SWICC_NET_MSG_CTRL_SUCCESS;
+    rsp->data.buf_len_exp = buf_len_exp;
+    memcpy(rsp->data.buf, buf, buf_len);
+}
+
+/**
+ * @brief Check if a command asks for data from the ICC.
+ * @param[in] hdr
+ * @return true if it does, false if not.
+ */
+static bool icc_fake_read(uint8_t const *const hdr)
+{
+    return hdr[1U] == 0xB0 || hdr[1U] == 0xB2;
+}
+
+/**
+ * @brief Answer a batch of commands.
+ * @param[in, out] icc
+ * @param[in] buf_len
+ */
+static void icc_fake_batch(icc_fake_st *const icc, uint32_t const buf_len)
+{
+    static uint8_t rsp[IFD_MSG_BUF_LEN_MAX];
+    uint32_t rsp_len = 0U;
+    for (uint32_t idx = 0U; idx + 5U <= buf_len; idx += 5U)
+    {
+        uint8_t const *const hdr = &icc->msg_tx.msg->data.buf[idx];
+        uint32_t len = 2U;
+        if (icc_fake_read(hdr))
+        {
+            len += hdr[4U] == 0U ? 256U : hdr[4U];
+        }
+        if (rsp_len + 2U + len > sizeof(rsp))
+        {
+            break;
+        }
+        rsp[rsp_len] = (uint8_t)(len >> 8U);
+        rsp[rsp_len + 1U] = (uint8_t)len;
+        memset(&rsp[rsp_len + 2U], 0U, len - 2U);
+        rsp[rsp_len + len] = 0x90;
+        rsp[rsp_len + len + 1U] = 0x00;
+        rsp_len += 2U + len;
+    }
+    icc_fake_rsp(icc, rsp, rsp_len, 5U);
+}
+
+/**
+ * @brief Answer the header of the command that is being processed.
+ * @param[in, out] icc
+ */
+static void icc_fake_hdr(icc_fake_st *const icc)
+{
+    static uint8_t const sw_success[2U] = {0x90, 0x00};
+    if (icc_fake_read(icc->hdr))
+    {
+        /* P3 of 0 means 256 bytes are expected. */
+        uint32_t const le = icc->hdr[4U] == 0U ? 256U : icc->hdr[4U];
+        uint8_t rsp[256U + 2U] = {0U};
+        rsp[le] = 0x90;
+        icc_fake_rsp(icc, rsp, le + 2U, 5U);
+    }
+    else if (icc->hdr[4U] > 0U)
+    {
+        /* ACK, the data follows. */
+        icc->data_len_exp = icc->hdr[4U];
+        icc_fake_rsp(icc, &icc->hdr[1U], 1U, icc->data_len_exp);
+    }
+    else
+    {
+        icc_fake_rsp(icc, sw_success, sizeof(sw_success), 5U);
+    }
+}
+
+static int32_t icc_fake_send(void *const ctx)
+{
+    icc_fake_st *const icc = ctx;
+    uint32_t const buf_len = (uint32_t)(icc->msg_tx.msg->hdr.size -
+                                        offsetof(swicc_net_msg_data_st, buf));
+    static uint8_t const sw_success[2U] = {0x90, 0x00};
+    static uint8_t const proc_null[1U] = {0x60};
+
+    ++icc->step_count;
+    if (icc->rsp_idx == icc->rsp_count)
+    {
+        icc->rsp_idx = 0U;
+        icc->rsp_count = 0U;
+    }
+    if (icc->msg_tx.msg->data.ctrl == IFD_NET_MSG_CTRL_BATCH)
+    {
+        icc_fake_batch(icc, buf_len);
+    }
+    else if (icc->null_sent && buf_len == 0U)
+    {
+        /* Done taking more time. */
+        icc->null_sent = false;
+        icc_fake_hdr(icc);
+    }
+    else if (icc->null_sent)
+    {
+        /* Data which was pipelined before the header was acknowledged. */
+        icc_fake_rsp(icc, proc_null, 0U, 0U);
+        icc->rsp[icc->rsp_count - 1U].data.ctrl = IFD_NET_MSG_CTRL_DISCARD;
+    }
+    else if (icc->data_len_exp > 0U)
+    {
+        /* Got the data of a command. */
+        icc->data_len_exp = 0U;
+        icc_fake_rsp(icc, sw_success, sizeof(sw_success), 5U);
+    }
+    else if (buf_len == 5U)
+    {
+        memcpy(icc->hdr, icc->msg_tx.msg->data.buf, 5U);
+        if (icc->null_proc)
+        {
+            icc->null_sent = true;
+            icc_fake_rsp(icc, proc_null, sizeof(proc_null), 0U);
+        }
+        else
+        {
+            icc_fake_hdr(icc);
+        }
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t icc_fake_recv(void *const ctx)
+{
+    icc_fake_st *const icc = ctx;
+    if (icc->rsp_idx >= icc->rsp_count)
+    {
+        return -1;
+    }
+    swicc_net_msg_st const *const rsp = &icc->rsp[icc->rsp_idx++];
+    if (ifd_msg_reserve(&icc->msg_rx,
+                        (uint32_t)(rsp->hdr.size -
+                                   offsetof(swicc_net_msg_data_st, buf))) != 0)
+    {
+        return -1;
+    }
+    memcpy(icc->msg_rx.msg, rsp, sizeof(rsp->hdr) + rsp->hdr.size);
+    return 0;
+}
+
+/**
+ * @brief Reset the in-memory ICC.
+ * @param[in, out] icc
+ */
+static void icc_fake_reset(icc_fake_st *const icc)
+{
+    if (icc->msg_tx.msg != NULL)
+    {
+        ifd_msg_free(&icc->msg_tx);
+        ifd_msg_free(&icc->msg_rx);
+        ifd_msg_free(&icc->msg_rx_spec);
+    }
+    memset(icc, 0U, sizeof(*icc));
+    ifd_msg_init(&icc->msg_tx);
+    ifd_msg_init(&icc->msg_rx);
+    ifd_msg_init(&icc->msg_rx_spec);
+}
+
+/**
+ * @brief Run one command many times and print the rate.
+ * @param[in] name
+ * @param[in] apdu
+ * @param[in] apdu_len
+ * @param[in] pipeline
+ * @param[in] null_proc If the ICC sends a NULL procedure byte first.
+ * @param[in] rounds
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench(char const *const name, uint8_t const *const apdu,
+                     uint32_t const apdu_len, bool const pipeline,
+                     bool const null_proc, uint32_t const rounds)
+{
+    static icc_fake_st icc;
+    icc_fake_reset(&icc);
+    icc.null_proc = null_proc;
+    ifd_tpdu_io_st const io = {.send = icc_fake_send,
+                               .recv = icc_fake_recv,
+                               .ctx = &icc,
+                               .msg_tx = &icc.msg_tx,
+                               .msg_rx = &icc.msg_rx,
+                               .msg_rx_spec = &icc.msg_rx_spec};
+    ifd_tpdu_icc_st state = {.cont_iface = 0U,
+                             .cont_icc = 0U,
+                             .buf_len_exp = 5U,
+                             .pipeline = pipeline};
+    uint8_t rsp[256U + 2U];
+
+    struct timespec ts_start;
+    struct timespec ts_end;
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        uint32_t rsp_len = sizeof(rsp);
+        if (ifd_tpdu_transceive(&io, &state, apdu, apdu_len, rsp, &rsp_len) !=
+                0 ||
+            rsp_len < 2U || rsp[rsp_len - 2U] != 0x90)
+        {
+            fprintf(stderr, "%s: Command failed in round %u.\n", name, round);
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    double const dur_s = (double)(ts_end.tv_sec - ts_start.tv_sec) +
+                         (double)(ts_end.tv_nsec - ts_start.tv_nsec) / 1e9;
+    printf("%-24s %-8s %-5s %12.0f steps/s %12.0f APDU/s %8.1f ns/APDU\n",
+           name, pipeline ? "pipe" : "no-pipe", null_proc ? "null" : "-",
+           (double)icc.step_count / dur_s, (double)rounds / dur_s,
+           dur_s * 1e9 / (double)rounds);
+    return 0;
+}
+
+/**
+ * @brief Run a run of reads many times, one by one or as a batch, and print the
+ * rate.
+ * @param[in] name
+ * @param[in] hdr Header of the read.
+ * @param[in] batch
+ * @param[in] rounds
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench_batch(char const *const name, uint8_t const *const hdr,
+                           bool const batch, uint32_t const rounds)
+{
+    static icc_fake_st icc;
+    icc_fake_reset(&icc);
+    ifd_tpdu_io_st const io = {.send = icc_fake_send,
+                               .recv = icc_fake_recv,
+                               .ctx = &icc,
+                               .msg_tx = &icc.msg_tx,
+                               .msg_rx = &icc.msg_rx,
+                               .msg_rx_spec = &icc.msg_rx_spec};
+    ifd_tpdu_icc_st state = {.buf_len_exp = 5U};
+    uint8_t hdrs[BENCH_BATCH_LEN * 5U];
+    for (uint32_t hdr_i = 0U; hdr_i < BENCH_BATCH_LEN; ++hdr_i)
+    {
+        memcpy(&hdrs[hdr_i * 5U], hdr, 5U);
+    }
+    static uint8_t rsp[IFD_MSG_BUF_LEN_MAX];
+
+    struct timespec ts_start;
+    struct timespec ts_end;
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        uint32_t rsp_len = sizeof(rsp);
+        uint32_t rsp_count = 0U;
+        if (batch)
+        {
+            if (ifd_tpdu_batch(&io, &state, hdrs, BENCH_BATCH_LEN, rsp,
+                               &rsp_len, &rsp_count) != 0)
+            {
+                rsp_count = 0U;
+            }
+        }
+        else
+        {
+            for (; rsp_count < BENCH_BATCH_LEN; ++rsp_count)
+            {
+                rsp_len = sizeof(rsp);
+                if (ifd_tpdu_transceive(&io, &state, hdr, 5U, rsp, &rsp_len) !=
+                    0)
+                {
+                    break;
+                }
+            }
+        }
+        if (rsp_count != BENCH_BATCH_LEN)
+        {
+            fprintf(stderr, "%s: Command failed in round %u.\n", name, round);
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    double const dur_s = (double)(ts_end.tv_sec - ts_start.tv_sec) +
+                         (double)(ts_end.tv_nsec - ts_start.tv_nsec) / 1e9;
+    double const apdu_count = (double)rounds * BENCH_BATCH_LEN;
+    printf("%-24s %-8s %12.0f steps/s %12.0f APDU/s %8.1f ns/APDU %5.2f "
+           "msg/APDU\n",
+           name, batch ? "batch" : "single", (double)icc.step_count / dur_s,
+           apdu_count / dur_s, dur_s * 1e9 / apdu_count,
+           (double)icc.step_count / apdu_count);
+    return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+    uint32_t rounds = BENCH_ROUNDS_DEF;
+    if (argc > 1)
+    {
+        rounds = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+
+    /* Case 1, e.g. a VERIFY which checks the retry counter. */
+    static uint8_t const case_1[] = {0x00, 0x20, 0x00, 0x01, 0x00};
+    /* Case 2, READ BINARY of 255 bytes. */
+    static uint8_t const case_2[] = {0x00, 0xB0, 0x00, 0x00, 0xFF};
+    /* Case 3, SELECT by path. */
+    static uint8_t const case_3[] = {0x00, 0xA4, 0x08, 0x04,
+                                     0x04, 0x7F, 0xFF, 0x6F, 0x07};
+    /* Case 3, UPDATE BINARY of 255 bytes. */
+    static uint8_t case_3_long[5U + 255U] = {0x00, 0xD6, 0x00, 0x00, 0xFF};
+
+    for (uint32_t null_proc = 0U; null_proc < 2U; ++null_proc)
+    {
+        for (uint32_t pipeline = 0U; pipeline < 2U; ++pipeline)
+        {
+            if (bench("case 1", case_1, sizeof(case_1), pipeline, null_proc,
+                      rounds) != 0 ||
+                bench("case 2 (255B)", case_2, sizeof(case_2), pipeline,
+                      null_proc, rounds) != 0 ||
+                bench("case 3", case_3, sizeof(case_3), pipeline, null_proc,
+                      rounds) != 0 ||
+                bench("case 3 (255B)", case_3_long, sizeof(case_3_long),
+                      pipeline, null_proc, rounds) != 0)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    /* Runs of READ RECORD of 28 bytes and of READ BINARY of 48 bytes. */
+    static uint8_t const read_record[] = {0x00, 0xB2, 0x01, 0x04, 0x1C};
+    static uint8_t const read_binary[] = {0x00, 0xB0, 0x00, 0x00, 0x30};
+    for (uint32_t batch = 0U; batch < 2U; ++batch)
+    {
+        if (bench_batch("8x READ RECORD (28B)", read_record, batch, rounds) !=
+                0 ||
+            bench_batch("8x READ BINARY (48B)", read_binary, batch, rounds) !=
+                0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
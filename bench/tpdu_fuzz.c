@@ -0,0 +1,246 @@
+/**
+ * Fuzzer (libFuzzer) of the TPDU state machine. It drives the state machine
+ * with an in-memory ICC whose replies are scripted by the input, so any reply
+ * an ICC could send over the network gets tried. The input is:
+ * - 1 byte of flags (FUZZ_FLAG_*).
+ * - 1 byte of how much the ICC expects first.
+ * - 2 bytes (big endian) of the size of the response buffer.
+ * - 2 bytes (big endian) of the length of the command, then the command. For a
+ *   batch, the command is the headers back to back.
+ * - The replies of the ICC, each 1 byte of control, 1 byte of how much the ICC
+ *   expects next, 2 bytes (big endian) of length, then the data. The ICC fails
+ *   to reply once the input runs out.
+ * Lengths are clipped to what is left of the input and to what fits a message.
+ *
+ * The fuzzer starts from the inputs in ./tpdu_fuzz_seed, which cover ICCs that
+ * answer a header with a NULL procedure byte (0x60), with and without
+ * pipelining.
+ */
+
+#include <debuglog.h>
+#include <msg.h>
+#include <net.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tpdu.h>
+
+/* Send the data of a command right after its header. */
+#define FUZZ_FLAG_PIPELINE (1U << 0U)
+/* Transmit the command as a batch of headers. */
+#define FUZZ_FLAG_BATCH (1U << 1U)
+
+/**
+ * An ICC which answers every message with the next reply of the script.
+ */
+typedef struct icc_script_s
+{
+    ifd_msg_st msg_tx;
+    ifd_msg_st msg_rx;
+    ifd_msg_st msg_rx_spec;
+    uint8_t const *script;
+    size_t script_len;
+} icc_script_st;
+
+/**
+ * Logger of PC/SC-lite, only needed if logging was not compiled out.
+ */
+void log_msg(const int priority, const char *fmt, ...)
+{
+}
+
+/**
+ * @brief Take bytes from the front of the input.
+ * @param[in, out] data
+ * @param[in, out] data_len
+ * @param[in] len How many bytes to take.
+ * @return The bytes, or NULL if the input is shorter.
+ */
+static uint8_t const *take(uint8_t const **const data, size_t *const data_len,
+                           size_t const len)
+{
+    if (*data_len < len)
+    {
+        return NULL;
+    }
+    uint8_t const *const taken = *data;
+    *data += len;
+    *data_len -= len;
+    return taken;
+}
+
+/**
+ * @brief Take a length from the front of the input and clip it.
+ * @param[in, out] data
+ * @param[in, out] data_len
+ * @param[in] len_max Longest length there can be.
+ * @param[out] len
+ * @return 0 on success, -1 if the input is shorter.
+ */
+static int32_t take_len(uint8_t const **const data, size_t *const data_len,
+                        uint32_t const len_max, uint32_t *const len)
+{
+    uint8_t const *const len_be = take(data, data_len, 2U);
+    if (len_be == NULL)
+    {
+        return -1;
+    }
+    *len = (uint32_t)(len_be[0U] << 8U) | len_be[1U];
+    if (*len > len_max)
+    {
+        *len = len_max;
+    }
+    return 0;
+}
+
+static int32_t icc_script_send(void *const ctx)
+{
+    icc_script_st *const icc = ctx;
+    /**
+     * The state machine must only ever send messages which are valid, and
+     * which fit the buffer they are in.
+     */
+    swicc_net_msg_st const *const msg = icc->msg_tx.msg;
+    if (msg->hdr.size < offsetof(swicc_net_msg_data_st, buf) ||
+        msg->hdr.size >
+            offsetof(swicc_net_msg_data_st, buf) + icc->msg_tx.buf_size)
+    {
+        abort();
+    }
+    return 0;
+}
+
+static int32_t icc_script_recv(void *const ctx)
+{
+    icc_script_st *const icc = ctx;
+    uint8_t const *const hdr = take(&icc->script, &icc->script_len, 2U);
+    uint32_t buf_len;
+    if (hdr == NULL ||
+        take_len(&icc->script, &icc->script_len, IFD_MSG_BUF_LEN_MAX,
+                 &buf_len) != 0)
+    {
+        return -1;
+    }
+    if (buf_len > icc->script_len)
+    {
+        buf_len = (uint32_t)icc->script_len;
+    }
+    /* The same as what the swICC net functions let through. */
+    if (ifd_msg_reserve(&icc->msg_rx, buf_len) != 0)
+    {
+        abort();
+    }
+    swicc_net_msg_st *const msg = icc->msg_rx.msg;
+    memset(&msg->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg->data.ctrl = hdr[0U];
+    msg->data.buf_len_exp = hdr[1U];
+    memcpy(msg->data.buf, take(&icc->script, &icc->script_len, buf_len),
+           buf_len);
+    msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + buf_len;
+    return 0;
+}
+
+/**
+ * @brief Check that the responses of a batch are what ifd_tpdu_batch says.
+ * @param[in] rsp
+ * @param[in] rsp_len
+ * @param[in] rsp_count
+ * @param[in] hdr_count
+ */
+static void batch_check(uint8_t const *const rsp, uint32_t const rsp_len,
+                        uint32_t const rsp_count, uint32_t const hdr_count)
+{
+    uint32_t count = 0U;
+    for (uint32_t idx = 0U; idx < rsp_len; ++count)
+    {
+        uint32_t const len = (uint32_t)(rsp[idx] << 8U) | rsp[idx + 1U];
+        if (len < 2U)
+        {
+            abort();
+        }
+        idx += 2U + len;
+    }
+    if (count != rsp_count || count > hdr_count)
+    {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t data_len)
+{
+    /* Messages start out short in every run, so growing them gets tried. */
+    static icc_script_st icc;
+    if (icc.msg_tx.msg != NULL)
+    {
+        ifd_msg_free(&icc.msg_tx);
+        ifd_msg_free(&icc.msg_rx);
+        ifd_msg_free(&icc.msg_rx_spec);
+    }
+    memset(&icc, 0U, sizeof(icc));
+    ifd_msg_init(&icc.msg_tx);
+    ifd_msg_init(&icc.msg_rx);
+    ifd_msg_init(&icc.msg_rx_spec);
+    ifd_tpdu_io_st const io = {.send = icc_script_send,
+                               .recv = icc_script_recv,
+                               .ctx = &icc,
+                               .msg_tx = &icc.msg_tx,
+                               .msg_rx = &icc.msg_rx,
+                               .msg_rx_spec = &icc.msg_rx_spec};
+
+    uint8_t const *const hdr = take(&data, &data_len, 2U);
+    uint32_t rsp_size;
+    uint32_t cmd_len;
+    if (hdr == NULL ||
+        take_len(&data, &data_len, IFD_MSG_BUF_LEN_MAX, &rsp_size) != 0 ||
+        take_len(&data, &data_len, (uint32_t)data_len, &cmd_len) != 0)
+    {
+        return 0;
+    }
+    ifd_tpdu_icc_st state = {.cont_iface = 0U,
+                             .cont_icc = 0U,
+                             .buf_len_exp = hdr[1U],
+                             .pipeline = (hdr[0U] & FUZZ_FLAG_PIPELINE) != 0U};
+    if (cmd_len > data_len)
+    {
+        cmd_len = (uint32_t)data_len;
+    }
+
+    /* Exact sizes so that any access out of bounds gets caught. */
+    uint8_t *const cmd = malloc(cmd_len > 0U ? cmd_len : 1U);
+    uint8_t *const rsp = malloc(rsp_size > 0U ? rsp_size : 1U);
+    if (cmd == NULL || rsp == NULL)
+    {
+        abort();
+    }
+    memcpy(cmd, take(&data, &data_len, cmd_len), cmd_len);
+    icc.script = data;
+    icc.script_len = data_len;
+
+    uint32_t rsp_len = rsp_size;
+    if (hdr[0U] & FUZZ_FLAG_BATCH)
+    {
+        uint32_t rsp_count = 0U;
+        if (ifd_tpdu_batch(&io, &state, cmd, cmd_len / 5U, rsp, &rsp_len,
+                           &rsp_count) == 0)
+        {
+            if (rsp_len > rsp_size)
+            {
+                abort();
+            }
+            batch_check(rsp, rsp_len, rsp_count, cmd_len / 5U);
+        }
+    }
+    else if (ifd_tpdu_transceive(&io, &state, cmd, cmd_len, rsp, &rsp_len) ==
+             0)
+    {
+        /* A response has at least a status. */
+        if (rsp_len > rsp_size || rsp_len < 2U)
+        {
+            abort();
+        }
+    }
+
+    free(cmd);
+    free(rsp);
+    return 0;
+}
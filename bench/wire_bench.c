@@ -0,0 +1,603 @@
+/**
+ * Benchmark of the wire formats. First checks the codec: messages make the
+ * round trip in both versions, version 2 only sends the header fields which
+ * changed, and malformed, oversized, and truncated frames are rejected. Then,
+ * for each version, it runs keep-alive, procedure byte, and short APDU
+ * exchanges with an ICC on a loopback TCP connection and reports the bytes and
+ * time per exchange.
+ */
+
+#include <arpa/inet.h>
+#include <msg.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <wire.h>
+
+#define BENCH_ROUNDS_DEF 100000U
+/* Length of the data of the short APDU (Lc). */
+#define BENCH_APDU_DATA_LEN 4U
+
+typedef struct link_s
+{
+    int32_t sock_ifd;
+    int32_t sock_icc;
+    pthread_t icc_thread;
+    ifd_wire_st wire_ifd;
+    ifd_wire_st wire_icc;
+    ifd_msg_st msg_tx;
+    ifd_msg_st msg_rx;
+} link_st;
+
+typedef enum exchange_e
+{
+    EXCHANGE_KEEPALIVE,
+    EXCHANGE_PROC_BYTE,
+    EXCHANGE_APDU,
+} exchange_et;
+
+/**
+ * A frame that has to be rejected when received.
+ */
+typedef struct frame_bad_s
+{
+    char const *name;
+    uint8_t version;
+    uint8_t buf[4U + IFD_MSG_BUF_LEN_MAX];
+    uint32_t buf_len;
+} frame_bad_st;
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Fill in the header fields and data of a message.
+ * @param[out] msg
+ * @param[in] cont_state
+ * @param[in] ctrl
+ * @param[in] buf_len_exp
+ * @param[in] buf_len Length of the data, which is filled with a pattern.
+ */
+static void msg_fill(swicc_net_msg_st *const msg, uint32_t const cont_state,
+                     uint8_t const ctrl, uint32_t const buf_len_exp,
+                     uint32_t const buf_len)
+{
+    msg->data.cont_state = cont_state;
+    msg->data.ctrl = ctrl;
+    msg->data.buf_len_exp = buf_len_exp;
+    for (uint32_t buf_i = 0U; buf_i < buf_len; ++buf_i)
+    {
+        msg->data.buf[buf_i] = (uint8_t)(buf_i * 31U + buf_len);
+    }
+    msg->hdr.size = (uint32_t)offsetof(swicc_net_msg_data_st, buf) + buf_len;
+}
+
+/**
+ * @brief Check if two messages have the same header fields and data.
+ * @return true if they do, false if not.
+ */
+static bool msg_eq(swicc_net_msg_st const *const a,
+                   swicc_net_msg_st const *const b)
+{
+    return a->hdr.size == b->hdr.size &&
+           a->data.cont_state == b->data.cont_state &&
+           a->data.ctrl == b->data.ctrl &&
+           a->data.buf_len_exp == b->data.buf_len_exp &&
+           memcmp(a->data.buf, b->data.buf,
+                  a->hdr.size - offsetof(swicc_net_msg_data_st, buf)) == 0;
+}
+
+/**
+ * @brief Check that messages of all sizes and header values make the round
+ * trip, including messages whose header is the same as the last one.
+ * @param[in] version
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t test_round_trip(uint8_t const version)
+{
+    static struct
+    {
+        uint32_t cont_state;
+        uint8_t ctrl;
+        uint32_t buf_len_exp;
+        uint32_t buf_len;
+    } const test[] = {
+        {0U, SWICC_NET_MSG_CTRL_KEEPALIVE, 0U, 0U},
+        {0U, SWICC_NET_MSG_CTRL_KEEPALIVE, 0U, 0U},
+        {7U, SWICC_NET_MSG_CTRL_NONE, 5U, 5U},
+        {7U, SWICC_NET_MSG_CTRL_NONE, 5U, 5U},
+        {7U, SWICC_NET_MSG_CTRL_SUCCESS, 5U, 1U},
+        {127U, SWICC_NET_MSG_CTRL_SUCCESS, 127U, 2U},
+        {128U, SWICC_NET_MSG_CTRL_SUCCESS, 128U, 2U},
+        {16384U, SWICC_NET_MSG_CTRL_FAILURE, 65536U, 0U},
+        {UINT32_MAX, 0xFF, UINT32_MAX, IFD_MSG_BUF_LEN_INLINE},
+        {UINT32_MAX, 0xFF, UINT32_MAX, IFD_MSG_BUF_LEN_INLINE + 1U},
+        {0U, SWICC_NET_MSG_CTRL_NONE, 0U, IFD_MSG_BUF_LEN_MAX},
+        {0U, SWICC_NET_MSG_CTRL_NONE, 0U, 0U},
+    };
+    int sock[2U];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) != 0)
+    {
+        return -1;
+    }
+    static ifd_wire_st wire_tx;
+    static ifd_wire_st wire_rx;
+    static swicc_net_msg_st msg_tx;
+    static ifd_msg_st msg_rx;
+    ifd_wire_reset(&wire_tx);
+    ifd_wire_reset(&wire_rx);
+    ifd_wire_version_set(&wire_tx, version);
+    ifd_wire_version_set(&wire_rx, version);
+    ifd_msg_init(&msg_rx);
+
+    int32_t ret = 0;
+    for (uint32_t test_i = 0U; test_i < sizeof(test) / sizeof(test[0U]);
+         ++test_i)
+    {
+        msg_fill(&msg_tx, test[test_i].cont_state, test[test_i].ctrl,
+                 test[test_i].buf_len_exp, test[test_i].buf_len);
+        if (ifd_wire_send(sock[0U], &wire_tx, &msg_tx) != 0 ||
+            ifd_wire_recv(sock[1U], &wire_rx, &msg_rx) != 0 ||
+            !msg_eq(&msg_tx, msg_rx.msg))
+        {
+            fprintf(stderr, "v%u round trip: Message %u differs.\n", version,
+                    test_i);
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0 && (wire_tx.tx_len != wire_rx.rx_len ||
+                     wire_tx.tx_count != wire_rx.rx_count))
+    {
+        fprintf(stderr, "v%u round trip: Byte counts differ.\n", version);
+        ret = -1;
+    }
+    ifd_msg_free(&msg_rx);
+    close(sock[0U]);
+    close(sock[1U]);
+    return ret;
+}
+
+/**
+ * @brief Check that version 2 only sends the header fields which changed since
+ * the last message, and that the receiver fills in the others from the last
+ * message it got.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t test_hdr_delta(void)
+{
+    /* The first message has all header fields set. */
+    static uint8_t const frame_0[] = {0x07, IFD_WIRE_FLAG_CONT_STATE |
+                                                IFD_WIRE_FLAG_CTRL |
+                                                IFD_WIRE_FLAG_BUF_LEN_EXP,
+                                      0x07, SWICC_NET_MSG_CTRL_SUCCESS,
+                                      0x80, 0x01, 0x90, 0x00};
+    /* The same message again has no header fields. */
+    static uint8_t const frame_1[] = {0x03, 0x00, 0x90, 0x00};
+    /* Only the control changed. */
+    static uint8_t const frame_2[] = {0x04, IFD_WIRE_FLAG_CTRL,
+                                      SWICC_NET_MSG_CTRL_FAILURE, 0x90, 0x00};
+    static struct
+    {
+        uint8_t const *frame;
+        uint32_t frame_len;
+        uint8_t ctrl;
+    } const test[] = {
+        {frame_0, sizeof(frame_0), SWICC_NET_MSG_CTRL_SUCCESS},
+        {frame_1, sizeof(frame_1), SWICC_NET_MSG_CTRL_SUCCESS},
+        {frame_2, sizeof(frame_2), SWICC_NET_MSG_CTRL_FAILURE},
+    };
+    int sock[2U];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) != 0)
+    {
+        return -1;
+    }
+    static ifd_wire_st wire_tx;
+    static ifd_wire_st wire_rx;
+    static swicc_net_msg_st msg_tx;
+    static ifd_msg_st msg_rx;
+    ifd_wire_reset(&wire_tx);
+    ifd_wire_reset(&wire_rx);
+    ifd_wire_version_set(&wire_tx, IFD_WIRE_VERSION_2);
+    ifd_wire_version_set(&wire_rx, IFD_WIRE_VERSION_2);
+    ifd_msg_init(&msg_rx);
+
+    int32_t ret = 0;
+    for (uint32_t test_i = 0U; test_i < sizeof(test) / sizeof(test[0U]);
+         ++test_i)
+    {
+        msg_fill(&msg_tx, 7U, test[test_i].ctrl, 128U, 2U);
+        msg_tx.data.buf[0U] = 0x90;
+        msg_tx.data.buf[1U] = 0x00;
+
+        /* The frame is read as is, and then sent back to be decoded. */
+        uint8_t frame[32U];
+        if (ifd_wire_send(sock[0U], &wire_tx, &msg_tx) != 0 ||
+            recv(sock[1U], frame, sizeof(frame), MSG_DONTWAIT) !=
+                (ssize_t)test[test_i].frame_len ||
+            memcmp(frame, test[test_i].frame, test[test_i].frame_len) != 0)
+        {
+            fprintf(stderr, "Header delta: Frame %u is not as expected.\n",
+                    test_i);
+            ret = -1;
+            break;
+        }
+        if (send(sock[1U], frame, test[test_i].frame_len, MSG_NOSIGNAL) !=
+                (ssize_t)test[test_i].frame_len ||
+            ifd_wire_recv(sock[0U], &wire_rx, &msg_rx) != 0 ||
+            !msg_eq(&msg_tx, msg_rx.msg))
+        {
+            fprintf(stderr, "Header delta: Frame %u decoded wrong.\n", test_i);
+            ret = -1;
+            break;
+        }
+    }
+    ifd_msg_free(&msg_rx);
+    close(sock[0U]);
+    close(sock[1U]);
+    return ret;
+}
+
+/**
+ * @brief Check that malformed, oversized, and truncated frames are rejected
+ * without changing the header fields of the receiver, and that messages which
+ * do not fit are not sent.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t test_reject(void)
+{
+    /**
+     * The first frames are filled in below. The v1 header is the size of the
+     * data in host byte order.
+     */
+    uint32_t const v1_size_short = offsetof(swicc_net_msg_data_st, buf) - 1U;
+    uint32_t const v1_size_long =
+        (uint32_t)sizeof(((swicc_net_msg_st *)NULL)->data) + 1U;
+    static frame_bad_st frame_bad[] = {
+        {"v1 size under header", IFD_WIRE_VERSION_1, {0U}, 4U},
+        {"v1 size over maximum", IFD_WIRE_VERSION_1, {0U}, 4U},
+        {"v2 data over maximum", IFD_WIRE_VERSION_2, {0U}, 0U},
+        {"v1 truncated header", IFD_WIRE_VERSION_1, {0x10}, 2U},
+        {"v1 truncated data",
+         IFD_WIRE_VERSION_1,
+         {0x0B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01},
+         9U},
+        {"v2 empty", IFD_WIRE_VERSION_2, {0U}, 0U},
+        {"v2 zero length", IFD_WIRE_VERSION_2, {0x00}, 1U},
+        {"v2 length over maximum", IFD_WIRE_VERSION_2, {0x80, 0x80, 0x04}, 3U},
+        {"v2 length over 32 bits",
+         IFD_WIRE_VERSION_2,
+         {0xFF, 0xFF, 0xFF, 0xFF, 0x7F},
+         5U},
+        {"v2 length varint too long",
+         IFD_WIRE_VERSION_2,
+         {0x81, 0x80, 0x80, 0x80, 0x80, 0x00},
+         6U},
+        {"v2 truncated length", IFD_WIRE_VERSION_2, {0x80}, 1U},
+        {"v2 truncated frame", IFD_WIRE_VERSION_2, {0x05, 0x00, 0x90}, 3U},
+        {"v2 truncated cont_state",
+         IFD_WIRE_VERSION_2,
+         {0x02, IFD_WIRE_FLAG_CONT_STATE, 0x80},
+         3U},
+        {"v2 cont_state over 32 bits",
+         IFD_WIRE_VERSION_2,
+         {0x06, IFD_WIRE_FLAG_CONT_STATE, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F},
+         7U},
+        {"v2 missing ctrl", IFD_WIRE_VERSION_2, {0x01, IFD_WIRE_FLAG_CTRL}, 2U},
+        {"v2 truncated buf_len_exp",
+         IFD_WIRE_VERSION_2,
+         {0x03, IFD_WIRE_FLAG_CTRL | IFD_WIRE_FLAG_BUF_LEN_EXP, 0x01, 0xFF},
+         4U},
+    };
+    memcpy(frame_bad[0U].buf, &v1_size_short, sizeof(v1_size_short));
+    memcpy(frame_bad[1U].buf, &v1_size_long, sizeof(v1_size_long));
+    /* Flags and one byte more data than a message can hold. */
+    frame_bad_st *const data_long = &frame_bad[2U];
+    data_long->buf[0U] = (uint8_t)(0x80 | ((2U + IFD_MSG_BUF_LEN_MAX) & 0x7F));
+    data_long->buf[1U] = (uint8_t)((2U + IFD_MSG_BUF_LEN_MAX) >> 7U);
+    data_long->buf_len = 2U + 2U + (uint32_t)IFD_MSG_BUF_LEN_MAX;
+
+    int32_t ret = 0;
+    static ifd_wire_st wire;
+    static ifd_msg_st msg;
+    for (uint32_t frame_i = 0U;
+         frame_i < sizeof(frame_bad) / sizeof(frame_bad[0U]); ++frame_i)
+    {
+        frame_bad_st const *const bad = &frame_bad[frame_i];
+        int sock[2U];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) != 0)
+        {
+            return -1;
+        }
+        ifd_wire_reset(&wire);
+        ifd_wire_version_set(&wire, bad->version);
+        wire.hdr_rx.cont_state = 7U;
+        ifd_msg_init(&msg);
+        /* The end of the stream makes a truncated frame fail right away. */
+        if (send(sock[1U], bad->buf, bad->buf_len, MSG_NOSIGNAL) !=
+                (ssize_t)bad->buf_len ||
+            shutdown(sock[1U], SHUT_WR) != 0 ||
+            ifd_wire_recv(sock[0U], &wire, &msg) != -1 ||
+            wire.hdr_rx.cont_state != 7U || wire.rx_count != 0U)
+        {
+            fprintf(stderr, "Reject: '%s' was accepted.\n", bad->name);
+            ret = -1;
+        }
+        ifd_msg_free(&msg);
+        close(sock[0U]);
+        close(sock[1U]);
+    }
+
+    /* A message with a size outside of the data buffer is not sent at all. */
+    static swicc_net_msg_st msg_tx;
+    uint32_t const size_bad[] = {v1_size_short, v1_size_long};
+    for (uint8_t version = IFD_WIRE_VERSION_1; version <= IFD_WIRE_VERSION_2;
+         ++version)
+    {
+        for (uint32_t size_i = 0U;
+             size_i < sizeof(size_bad) / sizeof(size_bad[0U]); ++size_i)
+        {
+            ifd_wire_reset(&wire);
+            ifd_wire_version_set(&wire, version);
+            msg_tx.hdr.size = size_bad[size_i];
+            if (ifd_wire_send(-1, &wire, &msg_tx) != -1 || wire.tx_len != 0U)
+            {
+                fprintf(stderr, "Reject: v%u sent size %u.\n", version,
+                        size_bad[size_i]);
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Answer messages until the connection is lost. Keep-alives get a
+ * success, a header with data gets the INS procedure byte, and everything else
+ * gets a success status.
+ * @param[in, out] arg Link (link_st).
+ * @return NULL.
+ */
+static void *icc_main(void *const arg)
+{
+    link_st *const link = arg;
+    static _Thread_local ifd_msg_st msg_icc;
+    ifd_msg_init(&msg_icc);
+    while (ifd_wire_recv(link->sock_icc, &link->wire_icc, &msg_icc) == 0)
+    {
+        swicc_net_msg_st *const msg = msg_icc.msg;
+        uint32_t const buf_len =
+            (uint32_t)(msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+        uint8_t const ctrl = msg->data.ctrl;
+        msg->data.cont_state = FSM_STATE_CONT_READY;
+        msg->data.ctrl = SWICC_NET_MSG_CTRL_SUCCESS;
+        msg->data.buf_len_exp = 5U;
+        if (ctrl == SWICC_NET_MSG_CTRL_KEEPALIVE)
+        {
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+        }
+        else if (buf_len == 5U && msg->data.buf[4U] > 0U)
+        {
+            msg->data.buf_len_exp = msg->data.buf[4U];
+            msg->data.buf[0U] = msg->data.buf[1U];
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 1U;
+        }
+        else
+        {
+            msg->data.buf[0U] = 0x90;
+            msg->data.buf[1U] = 0x00;
+            msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 2U;
+        }
+        if (ifd_wire_send(link->sock_icc, &link->wire_icc, msg) != 0)
+        {
+            break;
+        }
+    }
+    ifd_msg_free(&msg_icc);
+    return NULL;
+}
+
+/**
+ * @brief Connect the IFD handler and the ICC over loopback TCP.
+ * @param[out] link
+ * @param[in] version Wire version of both ends.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t link_open(link_st *const link, uint8_t const version)
+{
+    int32_t const sock_listen = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    if (sock_listen < 0 ||
+        bind(sock_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(sock_listen, 1) != 0 ||
+        getsockname(sock_listen, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        close(sock_listen);
+        return -1;
+    }
+    link->sock_icc = socket(AF_INET, SOCK_STREAM, 0);
+    if (link->sock_icc < 0 ||
+        connect(link->sock_icc, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(link->sock_icc);
+        close(sock_listen);
+        return -1;
+    }
+    link->sock_ifd = accept(sock_listen, NULL, NULL);
+    close(sock_listen);
+    if (link->sock_ifd < 0)
+    {
+        close(link->sock_icc);
+        return -1;
+    }
+    int const nodelay = 1;
+    setsockopt(link->sock_ifd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+               sizeof(nodelay));
+    setsockopt(link->sock_icc, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+               sizeof(nodelay));
+
+    ifd_msg_init(&link->msg_tx);
+    ifd_msg_init(&link->msg_rx);
+    ifd_wire_reset(&link->wire_ifd);
+    ifd_wire_reset(&link->wire_icc);
+    ifd_wire_version_set(&link->wire_ifd, version);
+    ifd_wire_version_set(&link->wire_icc, version);
+    if (pthread_create(&link->icc_thread, NULL, icc_main, link) != 0)
+    {
+        close(link->sock_ifd);
+        close(link->sock_icc);
+        return -1;
+    }
+    return 0;
+}
+
+static void link_close(link_st *const link)
+{
+    shutdown(link->sock_ifd, SHUT_RDWR);
+    pthread_join(link->icc_thread, NULL);
+    close(link->sock_ifd);
+    close(link->sock_icc);
+    ifd_msg_free(&link->msg_tx);
+    ifd_msg_free(&link->msg_rx);
+}
+
+/**
+ * @brief Send a message to the ICC and receive its reply.
+ * @param[in, out] link
+ * @param[in] ctrl
+ * @param[in] buf
+ * @param[in] buf_len
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t link_exchange(link_st *const link, uint8_t const ctrl,
+                             uint8_t const *const buf, uint32_t const buf_len)
+{
+    swicc_net_msg_st *const msg_tx = link->msg_tx.msg;
+    /* Like the IFD handler, the state of the ICC is sent back to it. */
+    msg_tx->data.cont_state = link->msg_rx.msg->data.cont_state;
+    msg_tx->data.ctrl = ctrl;
+    msg_tx->data.buf_len_exp = 0U;
+    memcpy(msg_tx->data.buf, buf, buf_len);
+    msg_tx->hdr.size = (uint32_t)offsetof(swicc_net_msg_data_st, buf) + buf_len;
+    if (ifd_wire_send(link->sock_ifd, &link->wire_ifd, msg_tx) != 0 ||
+        ifd_wire_recv(link->sock_ifd, &link->wire_ifd, &link->msg_rx) != 0 ||
+        link->msg_rx.msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run one kind of exchange many times and print the bytes and time it
+ * takes per exchange.
+ * @param[in] exchange
+ * @param[in] version
+ * @param[in] rounds
+ * @param[out] bytes Bytes per exchange in both directions.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench(exchange_et const exchange, uint8_t const version,
+                     uint32_t const rounds, double *const bytes)
+{
+    /* Case 3, UPDATE BINARY of 4 bytes. */
+    static uint8_t const apdu[5U + BENCH_APDU_DATA_LEN] = {
+        0x00, 0xD6, 0x00, 0x00, BENCH_APDU_DATA_LEN, 0x01, 0x02, 0x03, 0x04};
+    static char const *const name[] = {
+        [EXCHANGE_KEEPALIVE] = "keep-alive",
+        [EXCHANGE_PROC_BYTE] = "procedure byte",
+        [EXCHANGE_APDU] = "short APDU",
+    };
+    static link_st link;
+    if (link_open(&link, version) != 0)
+    {
+        fprintf(stderr, "%s: Failed to connect.\n", name[exchange]);
+        return -1;
+    }
+
+    uint64_t const start_ns = time_ns();
+    for (uint32_t round = 0U; round < rounds; ++round)
+    {
+        int32_t ret;
+        switch (exchange)
+        {
+        case EXCHANGE_KEEPALIVE:
+            ret = link_exchange(&link, SWICC_NET_MSG_CTRL_KEEPALIVE, apdu, 0U);
+            break;
+        case EXCHANGE_PROC_BYTE:
+            ret = link_exchange(&link, SWICC_NET_MSG_CTRL_NONE, apdu, 5U);
+            break;
+        default:
+            /* The header gets the procedure byte and the data the status. */
+            ret = link_exchange(&link, SWICC_NET_MSG_CTRL_NONE, apdu, 5U);
+            if (ret == 0)
+            {
+                ret = link_exchange(&link, SWICC_NET_MSG_CTRL_NONE, &apdu[5U],
+                                    BENCH_APDU_DATA_LEN);
+            }
+            break;
+        }
+        if (ret != 0)
+        {
+            fprintf(stderr, "%s: Exchange failed in round %u.\n",
+                    name[exchange], round);
+            link_close(&link);
+            return -1;
+        }
+    }
+    double const elapsed_ns = (double)(time_ns() - start_ns);
+
+    *bytes = (double)(link.wire_ifd.tx_len + link.wire_ifd.rx_len) / rounds;
+    printf("%-16s v%u %6.1f B/exchange (%5.1f TX %5.1f RX) %8.1f ns/exchange\n",
+           name[exchange], version, *bytes,
+           (double)link.wire_ifd.tx_len / rounds,
+           (double)link.wire_ifd.rx_len / rounds, elapsed_ns / rounds);
+    link_close(&link);
+    return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+    uint32_t rounds = BENCH_ROUNDS_DEF;
+    if (argc > 1)
+    {
+        rounds = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+
+    if (test_round_trip(IFD_WIRE_VERSION_1) != 0 ||
+        test_round_trip(IFD_WIRE_VERSION_2) != 0 || test_hdr_delta() != 0 ||
+        test_reject() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Codec checks passed.\n");
+
+    for (exchange_et exchange = EXCHANGE_KEEPALIVE; exchange <= EXCHANGE_APDU;
+         ++exchange)
+    {
+        double bytes_v1;
+        double bytes_v2;
+        if (bench(exchange, IFD_WIRE_VERSION_1, rounds, &bytes_v1) != 0 ||
+            bench(exchange, IFD_WIRE_VERSION_2, rounds, &bytes_v2) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+        printf("%-16s v2 sends %.0f%% fewer bytes\n", "",
+               100.0 * (1.0 - bytes_v2 / bytes_v1));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/**
+ * Benchmark of the slot workers. Every slot gets a caller thread (standing in
+ * for the PC/SC daemon) which runs a small piece of work (an APDU-sized copy)
+ * for its slot, either directly or on the slot's worker. It reports the latency
+ * of a call as the number of slots, and so the number of concurrent callers,
+ * grows.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <worker.h>
+
+#define BENCH_ROUNDS_DEF 100000U
+#define BENCH_SLOT_COUNT_MAX 16U
+/* How often the idle function runs when a worker gets no calls. */
+#define BENCH_IDLE_MS 10U
+
+typedef struct slot_s
+{
+    pthread_t thread;
+    ifd_worker_st worker;
+    bool use_worker;
+    uint32_t rounds;
+    uint8_t apdu[261U];
+    uint8_t rsp[261U];
+    /* Latency of each call in nanoseconds. */
+    uint64_t *lat_ns;
+    int32_t ret;
+} slot_st;
+
+static slot_st slot[BENCH_SLOT_COUNT_MAX];
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static int32_t work(void *const arg)
+{
+    slot_st *const s = arg;
+    memcpy(s->rsp, s->apdu, sizeof(s->rsp));
+    return 0;
+}
+
+static int32_t idle(void *const arg)
+{
+    return 0;
+}
+
+static int lat_cmp(void const *const a, void const *const b)
+{
+    uint64_t const lat_a = *(uint64_t const *)a;
+    uint64_t const lat_b = *(uint64_t const *)b;
+    return (lat_a > lat_b) - (lat_a < lat_b);
+}
+
+static void *caller_main(void *const arg)
+{
+    slot_st *const s = arg;
+    s->ret = 0;
+    for (uint32_t round = 0U; round < s->rounds; ++round)
+    {
+        uint64_t const start_ns = time_ns();
+        int32_t ret = 0;
+        if (s->use_worker)
+        {
+            if (ifd_worker_call(&s->worker, work, s, &ret) != 0)
+            {
+                s->ret = -1;
+                break;
+            }
+        }
+        else
+        {
+            ret = work(s);
+        }
+        s->lat_ns[round] = time_ns() - start_ns;
+        if (ret != 0)
+        {
+            s->ret = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run the callers of all slots at once and print the latency.
+ * @param[in] slot_count
+ * @param[in] use_worker
+ * @param[in] rounds Calls per slot.
+ * @param[in, out] lat_ns Space for the latency of all calls.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t bench(uint32_t const slot_count, bool const use_worker,
+                     uint32_t const rounds, uint64_t *const lat_ns)
+{
+    int32_t ret = 0;
+    uint32_t slot_started = 0U;
+    for (; slot_started < slot_count; ++slot_started)
+    {
+        slot_st *const s = &slot[slot_started];
+        s->use_worker = use_worker;
+        s->rounds = rounds;
+        s->lat_ns = &lat_ns[slot_started * rounds];
+        if (use_worker &&
+            ifd_worker_start(&s->worker, idle, NULL, BENCH_IDLE_MS) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    uint64_t const start_ns = time_ns();
+    uint32_t slot_running = 0U;
+    for (; ret == 0 && slot_running < slot_count; ++slot_running)
+    {
+        if (pthread_create(&slot[slot_running].thread, NULL, caller_main,
+                           &slot[slot_running]) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    for (uint32_t slot_i = 0U; slot_i < slot_running; ++slot_i)
+    {
+        pthread_join(slot[slot_i].thread, NULL);
+        ret = slot[slot_i].ret == 0 ? ret : -1;
+    }
+    uint64_t const dur_ns = time_ns() - start_ns;
+    for (uint32_t slot_i = 0U; slot_i < slot_started; ++slot_i)
+    {
+        ifd_worker_stop(&slot[slot_i].worker);
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "%u slots: Calls failed.\n", slot_count);
+        return -1;
+    }
+
+    size_t const call_count = (size_t)slot_count * rounds;
+    uint64_t lat_ns_sum = 0U;
+    for (size_t call_i = 0U; call_i < call_count; ++call_i)
+    {
+        lat_ns_sum += lat_ns[call_i];
+    }
+    qsort(lat_ns, call_count, sizeof(lat_ns[0U]), lat_cmp);
+    printf("%3u slots %-7s %12.0f calls/s %9.1f ns avg %9lu ns p50 %9lu ns "
+           "p99 %9lu ns max\n",
+           slot_count, use_worker ? "worker" : "direct",
+           (double)call_count * 1e9 / (double)dur_ns,
+           (double)lat_ns_sum / (double)call_count,
+           (unsigned long)lat_ns[call_count / 2U],
+           (unsigned long)lat_ns[call_count * 99U / 100U],
+           (unsigned long)lat_ns[call_count - 1U]);
+    return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+    uint32_t rounds = BENCH_ROUNDS_DEF;
+    if (argc > 1)
+    {
+        rounds = (uint32_t)strtoul(argv[1U], NULL, 10);
+    }
+    if (rounds == 0U)
+    {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t *const lat_ns =
+        malloc((size_t)BENCH_SLOT_COUNT_MAX * rounds * sizeof(lat_ns[0U]));
+    if (lat_ns == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    int ret = EXIT_SUCCESS;
+    for (uint32_t slot_count = 1U; slot_count <= BENCH_SLOT_COUNT_MAX;
+         slot_count *= 2U)
+    {
+        if (bench(slot_count, false, rounds, lat_ns) != 0 ||
+            bench(slot_count, true, rounds, lat_ns) != 0)
+        {
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+    free(lat_ns);
+    return ret;
+}
@@ -0,0 +1,53 @@
+#pragma once
+/**
+ * Parsing of the answer-to-reset (ISO 7816-3:2006 sec.8.2).
+ */
+
+#include <stdint.h>
+
+/* At most 15 historical bytes can be indicated by T0. */
+#define IFD_ATR_HIST_LEN_MAX 15U
+
+/**
+ * Fields of an ATR which are of interest to the IFD handler.
+ */
+typedef struct ifd_atr_s
+{
+    /* TA1 (Fi and Di). Set to the default value 0x11 when absent. */
+    uint8_t ta1;
+    /* TC1 (extra guard time N). Set to 0 when absent. */
+    uint8_t tc1;
+    /**
+     * Protocols offered by the ICC as SCARD_PROTOCOL_* flags. T=0 is offered
+     * when no protocol is indicated.
+     */
+    uint32_t proto;
+    /* IFSC from the first TA for T=1. Set to the default 32 when absent. */
+    uint32_t ifsc;
+    uint8_t hist[IFD_ATR_HIST_LEN_MAX];
+    uint8_t hist_len;
+} ifd_atr_st;
+
+/**
+ * @brief Parse an ATR.
+ * @param[in] atr
+ * @param[in] atr_len
+ * @param[out] atr_parsed Where to write the parsed ATR fields.
+ * @return 0 on success, -1 on failure (malformed ATR).
+ */
+int32_t ifd_atr_parse(uint8_t const *const atr, uint32_t const atr_len,
+                      ifd_atr_st *const atr_parsed);
+
+/**
+ * @brief Get the clock rate conversion integer Fi encoded in TA1.
+ * @param[in] ta1
+ * @return Fi, or 0 if the value is RFU.
+ */
+uint32_t ifd_atr_fi(uint8_t const ta1);
+
+/**
+ * @brief Get the baud rate adjustment integer Di encoded in TA1.
+ * @param[in] ta1
+ * @return Di, or 0 if the value is RFU.
+ */
+uint32_t ifd_atr_di(uint8_t const ta1);
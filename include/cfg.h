@@ -0,0 +1,218 @@
+#pragma once
+/**
+ * Runtime configuration of the IFD handler.
+ *
+ * The configuration is built up in layers, each overriding the one before it:
+ * 1. The defaults.
+ * 2. The config file named by SWICC_PCSC_CONFIG.
+ * 3. The DEVICENAME of the reader (from reader.conf), which is either the
+ *    default device (no configuration), or a URL:
+ *      tcp://[host][:port][?key=val&...]
+ *      unix:///path[?key=val&...]
+ *    The query key 'config' loads a config file at that point.
+ * 4. The environment variables SWICC_PCSC_<KEY> (key in upper case).
+ *
+ * A config file has one 'key = val' per line. Empty lines and lines starting
+ * with '#' are ignored. The keys are the same everywhere.
+ */
+
+#include <impair.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <swicc/swicc.h>
+
+#define IFD_CFG_HOST_LEN_MAX 256U
+#define IFD_CFG_PORT_LEN_MAX 6U
+/* Same as the size of sun_path in sockaddr_un. */
+#define IFD_CFG_PATH_LEN_MAX 108U
+/**
+ * Most slots a reader can have: the swICC client limit, but no more than the
+ * slot count which the PC/SC daemon reads in one byte (TAG_IFD_SLOTS_NUMBER).
+ */
+#define IFD_CFG_SLOT_COUNT_MAX                                                 \
+    (SWICC_NET_CLIENT_COUNT_MAX < 255U ? SWICC_NET_CLIENT_COUNT_MAX : 255U)
+
+/**
+ * How the ICCs connect to the IFD handler.
+ */
+typedef enum ifd_transport_e
+{
+    IFD_TRANSPORT_TCP,
+    IFD_TRANSPORT_UNIX,
+} ifd_transport_et;
+
+/**
+ * How the presence of a connected ICC is checked.
+ */
+typedef enum ifd_liveness_e
+{
+    /* Exchange a keep-alive message with the ICC. */
+    IFD_LIVENESS_KEEPALIVE,
+    /**
+     * Rely on TCP keepalive and check the socket for errors without sending
+     * anything to the ICC.
+     */
+    IFD_LIVENESS_SOCK,
+} ifd_liveness_et;
+
+typedef struct ifd_cfg_s
+{
+    ifd_transport_et transport;
+    /* Address to listen on for TCP. Empty means all addresses. */
+    char host[IFD_CFG_HOST_LEN_MAX];
+    char port[IFD_CFG_PORT_LEN_MAX];
+    /* Path of the socket for UNIX. */
+    char path[IFD_CFG_PATH_LEN_MAX];
+    /* 'slots' is how many slots the reader has. */
+    uint16_t slot_count;
+    /* 'backlog' is the length of the listen queue. */
+    uint32_t backlog;
+    /* 'reuseport' lets other processes bind the same port (SO_REUSEPORT). */
+    bool reuseport;
+    /**
+     * 'listen_fd' is an inherited listening socket to use instead of creating
+     * one. 0 means none.
+     */
+    uint32_t listen_fd;
+    /**
+     * 'persist' keeps (1) the listening socket and the connected ICCs when the
+     * reader is closed, so they are attached again when the reader is created
+     * again. With 0 (default), they are closed along with the reader.
+     */
+    bool persist;
+    /* 'nodelay' disables (1) Nagle's algorithm on TCP sockets (default). */
+    bool nodelay;
+    /**
+     * 'rcvbuf' and 'sndbuf' are the socket buffer sizes in bytes. 0 keeps the
+     * system default.
+     */
+    uint32_t rcvbuf;
+    uint32_t sndbuf;
+    /**
+     * 'busy_poll' is for how many microseconds a blocking receive busy-polls
+     * the device queue (SO_BUSY_POLL). 0 disables busy polling.
+     */
+    uint32_t busy_poll;
+    /* 'liveness' is either 'keepalive' (default) or 'sock'. */
+    ifd_liveness_et liveness;
+    /**
+     * 'workers' gives (1) each occupied slot a thread which does all I/O with
+     * its ICC and checks that the ICC is alive every 'keepalive_ms'. Presence
+     * checks then only look at the result. Disabled (0) by default.
+     */
+    bool workers;
+    uint32_t keepalive_ms;
+    /**
+     * 'presence_window_ms' lets presence checks without workers check all
+     * occupied slots at once, and answer from the results for this long. A
+     * sweep waits for at most 'keepalive_ms'. 0 (default) checks each slot on
+     * its own.
+     */
+    uint32_t presence_window_ms;
+    /**
+     * 'slot_active_max' limits how many slots can be occupied. It is lowered
+     * to 'slots' if it is above.
+     */
+    uint16_t slot_active_max;
+    /**
+     * 'accept_rate' limits how many ICCs get connected per second. 0 means no
+     * limit.
+     */
+    uint32_t accept_rate;
+    /**
+     * 'apdu_rate' limits how many APDUs per second each slot can transmit. 0
+     * means no limit.
+     */
+    uint32_t apdu_rate;
+    /**
+     * 'resume_grace_ms' is for how long the slot of a disconnected ICC is held
+     * for it to reconnect and resume its session. 0 disables session
+     * resumption.
+     */
+    uint32_t resume_grace_ms;
+    /**
+     * 'wire_version_max' is the newest wire format version that gets offered
+     * to ICCs when they connect. 1 (default) disables negotiation.
+     */
+    uint8_t wire_version_max;
+    /**
+     * 'pipeline' enables (1) sending the data of a command right after its
+     * header, without waiting for the ACK procedure byte, to ICCs which
+     * support it. Disabled (0) by default.
+     */
+    bool pipeline;
+    /**
+     * 'batch' enables (1) sending runs of commands without a data phase in one
+     * message, to ICCs which support it, when they come in a batch (see
+     * IFD_VENDOR_CTL_BATCH). Disabled (0) by default.
+     */
+    bool batch;
+    /**
+     * 'events' lets (1) ICCs which support it tell about events (e.g., that
+     * they are about to go away) without being asked. Presence checks then
+     * only exchange a keep-alive with an ICC that was quiet for 'keepalive_ms'.
+     * Disabled (0) by default.
+     */
+    bool events;
+    /**
+     * 'memo' enables (1) caching the responses of ICCs to read-only commands
+     * (SELECT, READ BINARY, READ RECORD, GET RESPONSE), so reading the same
+     * static files again is answered without asking the ICC. Disabled (0) by
+     * default.
+     */
+    bool memo;
+    /**
+     * 'trace' is the trace level (IFD_VENDOR_TRACE_*) which all slots start
+     * out with. Defaults to 2 (every message) in debug builds and to 0 (off)
+     * otherwise.
+     */
+    uint8_t trace;
+    /**
+     * 'sched_concurrency' limits how many slots can exchange messages with
+     * their ICCs at once. Slots waiting for their turn go by priority class
+     * (IFD_VENDOR_PRIO_CLASS_*, lowest first), then in proportion to their
+     * weights. 0 means no limit (default), so nothing ever waits.
+     */
+    uint16_t sched_concurrency;
+    /**
+     * 'prio_class' (default 1) and 'prio_weight' (1 to 1000, default 1) are
+     * what all slots start out with.
+     */
+    uint8_t prio_class;
+    uint16_t prio_weight;
+    /**
+     * Network impairment of the connections to the ICCs, for testing. All
+     * disabled (0) by default:
+     * - 'impair_delay_us' delays every message sent to an ICC.
+     * - 'impair_jitter_us' adds a random delay on top, distributed as
+     *   'impair_dist': 'uniform' (default), 'exp', or 'pareto'.
+     * - 'impair_partial_ppm' splits reads and writes into short pieces.
+     * - 'impair_reset_ppm' resets the connection before sending a message.
+     * - 'impair_seed' makes the random numbers repeatable.
+     */
+    ifd_impair_cfg_st impair;
+} ifd_cfg_st;
+
+/**
+ * @brief Load the configuration from all layers.
+ * @param[out] cfg
+ * @param[in] port_def Port to listen on when none is configured.
+ * @param[in] device_name DEVICENAME of the reader. NULL or the default device
+ * are the same as an empty URL.
+ * @param[in] device_def The default device.
+ * @return 0 on success, -1 on failure (the configuration is invalid).
+ */
+int32_t ifd_cfg_load(ifd_cfg_st *const cfg, char const *const port_def,
+                     char const *const device_name,
+                     char const *const device_def);
+
+/**
+ * @brief Set one key of the configuration.
+ * @param[in, out] cfg
+ * @param[in] key
+ * @param[in] val
+ * @return 0 on success, -1 on failure (unknown key, or invalid or out of
+ * range value).
+ */
+int32_t ifd_cfg_set(ifd_cfg_st *const cfg, char const *const key,
+                    char const *const val);
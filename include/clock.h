@@ -0,0 +1,49 @@
+#pragma once
+/**
+ * Clock of the IFD handler. It is the monotonic clock of the system, unless
+ * it was switched to virtual time for a simulation (see ./bench/sim.h).
+ * Virtual time only moves when it is told to, e.g., when something waits or
+ * when a message arrives, so a simulation runs as fast as it can and does the
+ * same every time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Virtual time starts here and not at 0, since 0 is used to mean 'never' for
+ * deadlines and timestamps.
+ */
+#define IFD_CLOCK_VIRTUAL_START_NS 1000000000U
+
+/**
+ * @brief Get the current time.
+ * @return Time in nanoseconds.
+ */
+uint64_t ifd_clock_ns(void);
+
+/**
+ * @brief Wait for some time. In virtual time, the time is skipped instead.
+ * @param[in] dur_ns
+ */
+void ifd_clock_sleep_ns(uint64_t const dur_ns);
+
+/**
+ * @brief Switch between the clock of the system and virtual time. Virtual time
+ * starts over at IFD_CLOCK_VIRTUAL_START_NS every time it is switched on.
+ * @param[in] enable
+ */
+void ifd_clock_virtual_set(bool const enable);
+
+/**
+ * @brief Check if the clock is in virtual time.
+ * @return true if it is, false if not.
+ */
+bool ifd_clock_virtual(void);
+
+/**
+ * @brief Move virtual time forward to a given time. Nothing is done if it is
+ * already past it, or if the clock is not in virtual time.
+ * @param[in] time_ns
+ */
+void ifd_clock_advance_to(uint64_t const time_ns);
@@ -0,0 +1,180 @@
+#pragma once
+/**
+ * Vendor-specific interface of the swICC IFD handler. Applications can use
+ * these with SCardGetAttrib/SCardSetAttrib and SCardControl.
+ */
+
+#include <stdint.h>
+
+/**
+ * Vendor tags are in the user-defined range 0x0180 to 0x01F0. 0x0180 is used
+ * by PC/SC-lite (TAG_IFD_SLOTNUM) so it is skipped.
+ */
+#define IFD_VENDOR_TAG_CHAN_STATS 0x0181
+/* Historical bytes of the ATR which identify the ICC. */
+#define IFD_VENDOR_TAG_ICC_HIST 0x0182
+#define IFD_VENDOR_TAG_READER_STATS 0x0183
+#define IFD_VENDOR_TAG_SLOT_STATS 0x0184
+/**
+ * Trace level (IFD_VENDOR_TRACE_*) of a slot as 1 byte. Can be set at runtime
+ * with SCardSetAttrib.
+ */
+#define IFD_VENDOR_TAG_TRACE_LEVEL 0x0185
+/**
+ * Priority of a slot as 3 bytes: the class (IFD_VENDOR_PRIO_CLASS_*), then the
+ * weight within the class (2 bytes, big endian). Can be set at runtime with
+ * SCardSetAttrib. Only matters when 'sched_concurrency' is configured.
+ */
+#define IFD_VENDOR_TAG_SLOT_PRIO 0x0186
+#define IFD_VENDOR_TAG_CLASS_STATS 0x0187
+/**
+ * Whether responses to read-only commands are cached for a slot, as 1 byte (0
+ * or 1). Can be set at runtime with SCardSetAttrib, and takes effect when the
+ * ICC is next reset.
+ */
+#define IFD_VENDOR_TAG_MEMO 0x0188
+
+/**
+ * Vendor control codes are used with SCardControl as SCARD_CTL_CODE(code).
+ *
+ * IFD_VENDOR_CTL_BATCH transmits several APDUs to the ICC in one call. The
+ * input is the APDUs back to back, each preceded by its length (2 bytes, big
+ * endian), and the output is their responses in the same form. The batch stops
+ * at the first APDU that fails, and only the responses before it are returned.
+ * Runs of APDUs without data (only a header) are sent to the ICC in one message
+ * when batching is enabled in the configuration and the ICC supports it.
+ */
+#define IFD_VENDOR_CTL_BATCH 3600U
+
+/* Logical channels are numbered 0 to 19 (ISO 7816-4:2020 sec.5.4.1). */
+#define IFD_VENDOR_CHAN_COUNT_MAX 20U
+/* Longest SELECT data (e.g. a path or an AID) that is kept per channel. */
+#define IFD_VENDOR_CHAN_SEL_LEN_MAX 16U
+
+/**
+ * What gets logged for a slot (at the PC/SC-lite info level). Every level
+ * includes the ones below it.
+ */
+#define IFD_VENDOR_TRACE_OFF 0U
+/* Command and response APDUs, and how long each command took. */
+#define IFD_VENDOR_TRACE_APDU 1U
+/* Every message exchanged with the ICC, e.g., the TPDUs of a command. */
+#define IFD_VENDOR_TRACE_MSG 2U
+
+/**
+ * Priority classes of slots. When slots wait for their turn to exchange
+ * messages with their ICCs, a lower class always goes first, e.g., interactive
+ * authentication before bulk personalization.
+ */
+#define IFD_VENDOR_PRIO_CLASS_INTERACTIVE 0U
+#define IFD_VENDOR_PRIO_CLASS_DEFAULT 1U
+#define IFD_VENDOR_PRIO_CLASS_BULK 2U
+#define IFD_VENDOR_PRIO_CLASS_COUNT 3U
+/* Within a class, slots get turns in proportion to weights of 1 up to this. */
+#define IFD_VENDOR_PRIO_WEIGHT_MAX 1000U
+
+/**
+ * Statistics of one logical channel. The value of IFD_VENDOR_TAG_CHAN_STATS is
+ * an array of these, one for each open channel of the slot.
+ */
+typedef struct ifd_vendor_chan_stats_s
+{
+    uint8_t chan;
+    /* P1 and data of the last successful SELECT on this channel. */
+    uint8_t sel_p1;
+    uint8_t sel_len;
+    uint8_t sel[IFD_VENDOR_CHAN_SEL_LEN_MAX];
+    uint64_t apdu_count;
+    uint64_t tx_len;
+    uint64_t rx_len;
+    /* Total time spent exchanging APDUs with the ICC in nanoseconds. */
+    uint64_t io_ns;
+} __attribute__((packed)) ifd_vendor_chan_stats_st;
+
+/**
+ * Statistics of the reader, i.e., of all slots. The value of
+ * IFD_VENDOR_TAG_READER_STATS is one of these.
+ */
+typedef struct ifd_vendor_reader_stats_s
+{
+    uint32_t slot_active;
+    uint32_t slot_active_max;
+    /* Clients waiting to be accepted, and how many can wait at most. */
+    uint32_t accept_queue_len;
+    uint32_t accept_queue_max;
+    uint64_t accept_count;
+    /* Clients which were deferred by the accept rate limit. */
+    uint64_t accept_defer_count;
+    /* Clients which were told that the reader is busy. */
+    uint64_t reject_busy_count;
+    /* APDUs which were refused by the per-slot APDU rate limit. */
+    uint64_t apdu_throttle_count;
+    /**
+     * Presence sweeps of all slots (see 'presence_window_ms'), and keep-alives
+     * that were exchanged in them.
+     */
+    uint64_t sweep_count;
+    uint64_t sweep_keepalive_count;
+} __attribute__((packed)) ifd_vendor_reader_stats_st;
+
+/**
+ * Statistics of one slot. The value of IFD_VENDOR_TAG_SLOT_STATS is one of
+ * these.
+ */
+typedef struct ifd_vendor_slot_stats_s
+{
+    /* Wire format version that was negotiated with the ICC. */
+    uint8_t wire_version;
+    /* Messages and bytes that were exchanged with the ICC. */
+    uint64_t msg_tx_count;
+    uint64_t msg_rx_count;
+    uint64_t msg_tx_len;
+    uint64_t msg_rx_len;
+    /* APDUs which were refused by the APDU rate limit. */
+    uint64_t apdu_throttle_count;
+    /**
+     * Latency of the APDUs which were exchanged, as seen by the PC/SC daemon,
+     * in nanoseconds.
+     */
+    uint64_t apdu_count;
+    uint64_t apdu_lat_ns_sum;
+    uint64_t apdu_lat_ns_max;
+    /* Within 25% of the true quantiles. */
+    uint64_t apdu_lat_ns_p99;
+    uint64_t apdu_lat_ns_p999;
+    /* What the network impairment did to the connection (if enabled). */
+    uint64_t impair_delay_count;
+    uint64_t impair_partial_count;
+    uint64_t impair_reset_count;
+    /* Events the ICC told about without being asked. */
+    uint64_t event_count;
+    /* Keep-alives that were skipped since the ICC was heard from recently. */
+    uint64_t keepalive_skip_count;
+    /**
+     * APDUs which were answered from the response cache, and those which could
+     * have been but were not cached. The time saved is how long the ICC took
+     * to answer the APDUs when they were cached.
+     */
+    uint64_t memo_hit_count;
+    uint64_t memo_miss_count;
+    uint64_t memo_saved_ns;
+} __attribute__((packed)) ifd_vendor_slot_stats_st;
+
+/**
+ * Statistics of one priority class, i.e., of all slots in it. The value of
+ * IFD_VENDOR_TAG_CLASS_STATS is an array of these, one for each class.
+ */
+typedef struct ifd_vendor_class_stats_s
+{
+    uint8_t cls;
+    /* Latency of the APDUs, the same as in the slot statistics. */
+    uint64_t apdu_count;
+    uint64_t apdu_lat_ns_sum;
+    uint64_t apdu_lat_ns_max;
+    uint64_t apdu_lat_ns_p99;
+    uint64_t apdu_lat_ns_p999;
+    /* Times a slot had to wait for its turn, and for how long in total. */
+    uint64_t wait_count;
+    uint64_t wait_ns_sum;
+    uint64_t wait_ns_max;
+} __attribute__((packed)) ifd_vendor_class_stats_st;
@@ -0,0 +1,85 @@
+#pragma once
+/**
+ * Network impairment of the connections to the ICCs, for testing how the IFD
+ * handler copes with a real network. It sits in the wire layer and can delay
+ * every message sent to an ICC, split reads and writes into short pieces, and
+ * reset connections at random.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Distribution of the random part (jitter) of the delay.
+ */
+typedef enum ifd_impair_dist_e
+{
+    /* Uniform between 0 and jitter. */
+    IFD_IMPAIR_DIST_UNIFORM,
+    /* Exponential with a mean of jitter. */
+    IFD_IMPAIR_DIST_EXP,
+    /* Pareto (shape 1.5) with a mean of jitter, i.e., a heavy tail. */
+    IFD_IMPAIR_DIST_PARETO,
+} ifd_impair_dist_et;
+
+typedef struct ifd_impair_cfg_s
+{
+    /* Fixed delay added to every message sent to an ICC. */
+    uint32_t delay_us;
+    /* Scale of the random delay added on top of the fixed one. */
+    uint32_t jitter_us;
+    ifd_impair_dist_et dist;
+    /* Chance of splitting a read or write into short pieces. */
+    uint32_t partial_ppm;
+    /* Chance of resetting the connection before sending a message. */
+    uint32_t reset_ppm;
+    /* Seed of the random numbers. 0 seeds from the clock. */
+    uint32_t seed;
+} ifd_impair_cfg_st;
+
+/**
+ * Impairment of one connection.
+ */
+typedef struct ifd_impair_s
+{
+    ifd_impair_cfg_st const *cfg;
+    uint64_t rng;
+    /* How much impairment was done. */
+    uint64_t delay_count;
+    uint64_t delay_us_sum;
+    uint64_t partial_count;
+    uint64_t reset_count;
+} ifd_impair_st;
+
+/**
+ * @brief Check if a configuration impairs anything.
+ * @param[in] cfg
+ * @return true if it does, false if not.
+ */
+bool ifd_impair_enabled(ifd_impair_cfg_st const *const cfg);
+
+/**
+ * @brief Start impairing a connection.
+ * @param[out] impair
+ * @param[in] cfg Must stay valid while impairing.
+ * @param[in] stream Mixed into the seed so connections differ.
+ */
+void ifd_impair_init(ifd_impair_st *const impair,
+                     ifd_impair_cfg_st const *const cfg, uint32_t const stream);
+
+/**
+ * @brief Impair a message before it is sent, i.e., delay it or reset the
+ * connection.
+ * @param[in, out] impair
+ * @param[in] sock
+ * @return 0 on success, -1 if the connection was reset.
+ */
+int32_t ifd_impair_msg(ifd_impair_st *const impair, int32_t const sock);
+
+/**
+ * @brief Get how much of a buffer to pass to the next read or write.
+ * @param[in, out] impair
+ * @param[in] len Length of what is left of the buffer.
+ * @return Between 1 and len.
+ */
+uint32_t ifd_impair_chunk(ifd_impair_st *const impair, uint32_t const len);
@@ -0,0 +1,41 @@
+#pragma once
+/**
+ * I/O of the IFD handler with the ICCs. By default, ICCs are accepted from the
+ * listening socket and messages are framed as in wire.h. Other I/O can be
+ * installed in its place, e.g., the simulated ICCs of the benchmarks (see
+ * ./bench/sim.h), along with something that stands in for the listening
+ * socket.
+ */
+
+#include <msg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <swicc/swicc.h>
+#include <wire.h>
+
+typedef struct ifd_io_s
+{
+    /* Same as ifd_wire_send and ifd_wire_recv. */
+    int32_t (*send)(int32_t const sock, ifd_wire_st *const wire,
+                    swicc_net_msg_st const *const msg);
+    int32_t (*recv)(int32_t const sock, ifd_wire_st *const wire,
+                    ifd_msg_st *const msg);
+    /* Check if an ICC waits to be accepted, without waiting for one. */
+    bool (*pending)(int32_t const sock_server);
+    /* Accept an ICC. Returns its socket on success, -1 on failure. */
+    int32_t (*accept)(int32_t const sock_server);
+    /* Close the socket of an ICC. */
+    void (*close)(int32_t const sock);
+} ifd_io_st;
+
+/**
+ * @brief Install the I/O with the ICCs. It must only be changed while no ICC is
+ * connected, i.e., when the reader does not exist and was not kept (see
+ * 'persist' in cfg.h).
+ * @param[in] io Kept until another one is installed. NULL goes back to the
+ * default.
+ * @param[in] sock_server Used in place of the listening socket when the reader
+ * is created, which then does not listen on anything. It is not closed by the
+ * IFD handler. Ignored when io is NULL.
+ */
+void ifd_io_set(ifd_io_st const *const io, int32_t const sock_server);
@@ -0,0 +1,36 @@
+#pragma once
+/**
+ * Latency histogram which is cheap enough to be updated on every APDU. Each
+ * power of 2 (in nanoseconds) is split into 4 buckets, so a quantile is off by
+ * at most 25%.
+ */
+
+#include <stdint.h>
+
+/* Latencies from 2^40ns (~18min) on all go in the last bucket. */
+#define IFD_LAT_HIST_LEN 160U
+
+typedef struct ifd_lat_hist_s
+{
+    uint64_t count;
+    /* Largest latency that was added. */
+    uint64_t max_ns;
+    uint32_t bucket[IFD_LAT_HIST_LEN];
+} ifd_lat_hist_st;
+
+/**
+ * @brief Add a latency to a histogram.
+ * @param[in, out] hist
+ * @param[in] lat_ns
+ */
+void ifd_lat_hist_add(ifd_lat_hist_st *const hist, uint64_t const lat_ns);
+
+/**
+ * @brief Get a quantile of the latencies in a histogram.
+ * @param[in] hist
+ * @param[in] q_ppm Quantile in parts per million, e.g., 990000 for p99.
+ * @return Upper bound of the bucket the quantile falls in, or the largest
+ * latency if it is lower, in nanoseconds. 0 if the histogram is empty.
+ */
+uint64_t ifd_lat_hist_quantile(ifd_lat_hist_st const *const hist,
+                               uint32_t const q_ppm);
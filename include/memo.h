@@ -0,0 +1,150 @@
+#pragma once
+/**
+ * Cache of the responses of an ICC to commands which only read, i.e., SELECT,
+ * READ BINARY, READ RECORD, and GET RESPONSE. A response is kept for the exact
+ * command and for what was selected on the logical channel when the command
+ * was sent, so the same command in the same state gets the same response
+ * without asking the ICC.
+ *
+ * What is selected is tracked as a hash of the commands which changed it since
+ * the last absolute SELECT (e.g., by path from the MF or by DF name). A command
+ * which changes what is selected, and is answered from the cache, has to reach
+ * the ICC before any command that is not, so it is kept on the channel until
+ * then (the lag of the channel).
+ *
+ * Any other command may change files or what can be read (e.g., UPDATE BINARY
+ * or VERIFY), so it clears the cache, and nothing gets cached again until the
+ * ICC is reset.
+ */
+
+#include <ifd_vendor.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Longest command that is cached: a header and up to 16 bytes of data. */
+#define IFD_MEMO_CMD_LEN_MAX (5U + IFD_VENDOR_CHAN_SEL_LEN_MAX)
+/* Longest response that is cached: 256 bytes of data and a status. */
+#define IFD_MEMO_RSP_LEN_MAX (256U + 2U)
+#define IFD_MEMO_ENT_COUNT 32U
+/* How many commands a channel can lag behind the ICC. */
+#define IFD_MEMO_LAG_LEN_MAX 4U
+
+typedef struct ifd_memo_ent_s
+{
+    /* Selection when the command was sent. */
+    uint64_t key;
+    /* 0 if the entry is free. */
+    uint8_t cmd_len;
+    uint8_t cmd[IFD_MEMO_CMD_LEN_MAX];
+    uint16_t rsp_len;
+    uint8_t rsp[IFD_MEMO_RSP_LEN_MAX];
+    /* How long the ICC took to answer. */
+    uint64_t io_ns;
+    /* When the entry was last used, for evicting the least recently used. */
+    uint64_t used;
+} ifd_memo_ent_st;
+
+typedef struct ifd_memo_chan_s
+{
+    /* What is selected on the channel, as seen by the application. */
+    uint64_t sel;
+    /* Hash of the last command on the channel, which GET RESPONSE answers. */
+    uint64_t prev;
+    /* Commands which were answered from the cache but not sent to the ICC. */
+    uint8_t lag_count;
+    uint8_t lag_next;
+    uint8_t lag_len[IFD_MEMO_LAG_LEN_MAX];
+    uint8_t lag[IFD_MEMO_LAG_LEN_MAX][IFD_MEMO_CMD_LEN_MAX];
+} ifd_memo_chan_st;
+
+typedef struct ifd_memo_s
+{
+    /* Cleared by a command that is not read-only, until the ICC is reset. */
+    bool learn;
+    /* Last generation of the file system that the ICC told about. */
+    bool gen_known;
+    uint32_t gen;
+    uint64_t tick;
+    ifd_memo_chan_st chan[IFD_VENDOR_CHAN_COUNT_MAX];
+    ifd_memo_ent_st ent[IFD_MEMO_ENT_COUNT];
+} ifd_memo_st;
+
+/**
+ * @brief Start over after the ICC was reset. All entries are dropped.
+ * @param[out] memo
+ */
+void ifd_memo_reset(ifd_memo_st *const memo);
+
+/**
+ * @brief Drop all entries and stop caching until the ICC is reset, e.g., when
+ * the ICC no longer does what the cache expects. Lagging commands are dropped
+ * too.
+ * @param[in, out] memo
+ */
+void ifd_memo_invalidate(ifd_memo_st *const memo);
+
+/**
+ * @brief Note the generation of the file system that the ICC told about. All
+ * entries are dropped if it changed.
+ * @param[in, out] memo
+ * @param[in] gen
+ * @return true if entries were dropped, false otherwise.
+ */
+bool ifd_memo_gen_set(ifd_memo_st *const memo, uint32_t const gen);
+
+/**
+ * @brief Look up the response to a command. On a hit, the command is taken as
+ * if the ICC answered it.
+ * @param[in, out] memo
+ * @param[in] chan Logical channel of the command.
+ * @param[in] cmd Command with a header and without Le if it has data.
+ * @param[in] cmd_len
+ * @param[out] rsp
+ * @param[in, out] rsp_len Gives the size of the response buffer. On a hit,
+ * receives the length of the response.
+ * @param[out] io_ns On a hit, how long the ICC took to answer.
+ * @return true on a hit, false on a miss.
+ */
+bool ifd_memo_get(ifd_memo_st *const memo, uint8_t const chan,
+                  uint8_t const *const cmd, uint32_t const cmd_len,
+                  uint8_t *const rsp, uint32_t *const rsp_len,
+                  uint64_t *const io_ns);
+
+/**
+ * @brief Take the next command which has to be sent to the ICC before another
+ * command on a channel can be.
+ * @param[in, out] memo
+ * @param[in] chan
+ * @param[out] cmd Valid until the next call.
+ * @param[out] cmd_len
+ * @return true if there was one, false if the channel is caught up.
+ */
+bool ifd_memo_lag_pop(ifd_memo_st *const memo, uint8_t const chan,
+                      uint8_t const **const cmd, uint32_t *const cmd_len);
+
+/**
+ * @brief Note the response of the ICC to a command, and cache it if possible.
+ * The channel must be caught up.
+ * @param[in, out] memo
+ * @param[in] chan Logical channel of the command.
+ * @param[in] cmd Same as for ifd_memo_get.
+ * @param[in] cmd_len
+ * @param[in] rsp Response (at least a status word).
+ * @param[in] rsp_len
+ * @param[in] io_ns How long the ICC took to answer.
+ * @return true if the command can be answered from the cache, i.e., if it was
+ * a miss, false otherwise.
+ */
+bool ifd_memo_put(ifd_memo_st *const memo, uint8_t const chan,
+                  uint8_t const *const cmd, uint32_t const cmd_len,
+                  uint8_t const *const rsp, uint32_t const rsp_len,
+                  uint64_t const io_ns);
+
+/**
+ * @brief Check if a response is one that the cache would keep, i.e., if the
+ * command succeeded.
+ * @param[in] rsp Response (at least a status word).
+ * @param[in] rsp_len
+ * @return true if it succeeded, false otherwise.
+ */
+bool ifd_memo_rsp_ok(uint8_t const *const rsp, uint32_t const rsp_len);
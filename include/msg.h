@@ -0,0 +1,60 @@
+#pragma once
+/**
+ * Storage of swICC network messages. The data buffer of a swICC message is
+ * sized for the longest message there can be, while nearly all messages carry
+ * a short APDU, a procedure byte, a status, or nothing at all. So a message
+ * starts out with a short data buffer inline, and moves to a full message on
+ * the heap the first time something longer has to fit in it, e.g., a batch.
+ * It stays full from then on.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <swicc/swicc.h>
+
+/**
+ * Fits the longest short command APDU (header and 255 bytes of data), which is
+ * also longer than the longest short response (256 bytes of data and status).
+ */
+#define IFD_MSG_BUF_LEN_INLINE (5U + 255U)
+/* Length of the data buffer of a full message. */
+#define IFD_MSG_BUF_LEN_MAX sizeof(((swicc_net_msg_data_st *)NULL)->buf)
+
+typedef struct ifd_msg_s
+{
+    /**
+     * The message, which has only buf_size bytes of data buffer. Points at the
+     * inline message, or at a full message once it grew. NULL until the
+     * message is initialized.
+     */
+    swicc_net_msg_st *msg;
+    uint32_t buf_size;
+    /* Laid out as a swicc_net_msg_st with a short data buffer. */
+    uint8_t msg_inline[sizeof(swicc_net_msg_hdr_st) +
+                       offsetof(swicc_net_msg_data_st, buf) +
+                       IFD_MSG_BUF_LEN_INLINE];
+} ifd_msg_st;
+
+/**
+ * @brief Initialize a message to use its inline data buffer. A message which
+ * was already initialized is left as it is.
+ * @param[in, out] msg
+ */
+void ifd_msg_init(ifd_msg_st *const msg);
+
+/**
+ * @brief Make sure the data buffer of a message fits a given length, by moving
+ * the message to a full one if needed. What the message holds is kept.
+ * @param[in, out] msg Must be initialized.
+ * @param[in] buf_len
+ * @return 0 on success, -1 on failure (longer than a full data buffer, or out
+ * of memory).
+ */
+int32_t ifd_msg_reserve(ifd_msg_st *const msg, uint32_t const buf_len);
+
+/**
+ * @brief Free the full message that a message grew into, if any, which puts it
+ * back to its inline data buffer.
+ * @param[in, out] msg Must be initialized.
+ */
+void ifd_msg_free(ifd_msg_st *const msg);
@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * Extensions of the swICC network protocol.
+ */
+
+/**
+ * Control values which extend the swICC network protocol. They are placed well
+ * above the swICC control values so they never clash with them. An ICC which
+ * does not know an extension answers it with a non-success control.
+ */
+typedef enum ifd_net_msg_ctrl_e
+{
+    /* Let the ICC free or suspend its state until the next reset. */
+    IFD_NET_MSG_CTRL_POWER_DOWN = 0x80,
+    /* Tell a client that it was not admitted because the reader is busy. */
+    IFD_NET_MSG_CTRL_BUSY = 0x81,
+    /* Give the ICC a token with which it can resume its session. */
+    IFD_NET_MSG_CTRL_RESUME_TOKEN_SET = 0x82,
+    /* Ask a newly connected ICC for the token of the session it resumes. */
+    IFD_NET_MSG_CTRL_RESUME_TOKEN_GET = 0x83,
+    /**
+     * Offer the newest supported wire format version and the optional features
+     * (IFD_NET_FEATURE_*) to a newly connected ICC. The ICC answers with the
+     * version it picked and the features it supports.
+     */
+    IFD_NET_MSG_CTRL_WIRE_VERSION = 0x84,
+    /**
+     * An ICC answers data which was sent to it speculatively with this if it
+     * did not consume the data.
+     */
+    IFD_NET_MSG_CTRL_DISCARD = 0x85,
+    /**
+     * Run several independent commands which have no data phase, i.e., only a
+     * 5-byte header each, one after the other. The buffer holds the headers
+     * back to back. The ICC answers with one message whose buffer holds the
+     * response (data and status) of each command in order, each preceded by
+     * its length (2 bytes, big endian). The ICC stops at the first command it
+     * can't answer with a response, so there may be fewer responses than
+     * commands.
+     */
+    IFD_NET_MSG_CTRL_BATCH = 0x86,
+    /**
+     * Sent by the ICC at any time, without being asked, to tell about an event
+     * (IFD_NET_EVENT_*). The first byte of the buffer is the event, followed by
+     * its parameters. It never gets an answer.
+     */
+    IFD_NET_MSG_CTRL_EVENT = 0x87,
+} ifd_net_msg_ctrl_et;
+
+/**
+ * Optional features which are agreed on at connect (flags).
+ */
+typedef enum ifd_net_feature_e
+{
+    /**
+     * The ICC accepts the data of a command right after its header and answers
+     * it with IFD_NET_MSG_CTRL_DISCARD if it doesn't want the data.
+     */
+    IFD_NET_FEATURE_PIPELINE = 0x01,
+    /* The ICC accepts IFD_NET_MSG_CTRL_BATCH. */
+    IFD_NET_FEATURE_BATCH = 0x02,
+    /**
+     * The ICC sends IFD_NET_MSG_CTRL_EVENT when something happens, at least
+     * IFD_NET_EVENT_EXIT before it goes away.
+     */
+    IFD_NET_FEATURE_EVENT = 0x04,
+} ifd_net_feature_et;
+
+/**
+ * Events which an ICC tells about with IFD_NET_MSG_CTRL_EVENT.
+ */
+typedef enum ifd_net_event_e
+{
+    /* The ICC is about to go away (removal). */
+    IFD_NET_EVENT_EXIT = 0x01,
+    /* The file system of the ICC was reloaded, so its state is lost. */
+    IFD_NET_EVENT_RELOAD = 0x02,
+    /**
+     * The ICC is busy and won't answer for a while. Parameter is how long in
+     * milliseconds (4 bytes, big endian).
+     */
+    IFD_NET_EVENT_BUSY = 0x03,
+    /**
+     * The content of the files of the ICC changed by other means than the
+     * commands it got, e.g., by an update over the air. Parameter is the
+     * generation of the file system, which changes every time (4 bytes, big
+     * endian). Responses which were cached before are no longer valid.
+     */
+    IFD_NET_EVENT_GEN = 0x04,
+} ifd_net_event_et;
@@ -0,0 +1,103 @@
+#pragma once
+/**
+ * Scheduler of the exchanges with the ICCs of all slots. It limits how many
+ * slots can exchange messages with their ICCs at once, and when more are
+ * waiting, it lets them go first by class (lowest first), and within a class,
+ * in proportion to their weights (stride scheduling).
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IFD_PRIO_CLASS_COUNT 3U
+/* Weights are between 1 and this. */
+#define IFD_PRIO_WEIGHT_MAX 1000U
+
+#define IFD_PRIO_INIT                                                          \
+    {                                                                          \
+        .lock = PTHREAD_MUTEX_INITIALIZER,                                     \
+    }
+
+/**
+ * What the scheduler knows about a slot.
+ */
+typedef struct ifd_prio_ent_s
+{
+    uint8_t cls;
+    uint16_t weight;
+    /* Virtual time of the next exchange, advances by the inverse weight. */
+    uint64_t pass;
+    /* Set by the scheduler when the slot may go ahead. */
+    bool granted;
+    pthread_cond_t cond;
+    /* Next slot that is waiting. */
+    struct ifd_prio_ent_s *next;
+} ifd_prio_ent_st;
+
+typedef struct ifd_prio_s
+{
+    pthread_mutex_t lock;
+    /* How many slots can exchange messages at once, or 0 for no limit. */
+    uint32_t concurrency;
+    uint32_t running;
+    ifd_prio_ent_st *wait;
+    /* Virtual time of each class, i.e., the pass of the last granted slot. */
+    uint64_t vtime[IFD_PRIO_CLASS_COUNT];
+} ifd_prio_st;
+
+/**
+ * @brief Initialize what the scheduler knows about a slot.
+ * @param[out] ent
+ * @param[in] cls Less than IFD_PRIO_CLASS_COUNT.
+ * @param[in] weight Between 1 and IFD_PRIO_WEIGHT_MAX.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_prio_ent_init(ifd_prio_ent_st *const ent, uint8_t const cls,
+                          uint16_t const weight);
+
+/**
+ * @brief Change the class and weight of a slot. Takes effect the next time the
+ * slot waits.
+ * @param[in, out] sched
+ * @param[in, out] ent
+ * @param[in] cls Less than IFD_PRIO_CLASS_COUNT.
+ * @param[in] weight Between 1 and IFD_PRIO_WEIGHT_MAX.
+ */
+void ifd_prio_set(ifd_prio_st *const sched, ifd_prio_ent_st *const ent,
+                  uint8_t const cls, uint16_t const weight);
+
+/**
+ * @brief Get the class and weight of a slot.
+ * @param[in, out] sched
+ * @param[in] ent
+ * @param[out] cls
+ * @param[out] weight
+ */
+void ifd_prio_get(ifd_prio_st *const sched, ifd_prio_ent_st const *const ent,
+                  uint8_t *const cls, uint16_t *const weight);
+
+/**
+ * @brief Change how many slots can exchange messages at once. Slots which are
+ * waiting are let go if the limit went up.
+ * @param[in, out] sched
+ * @param[in] concurrency 0 for no limit.
+ */
+void ifd_prio_concurrency_set(ifd_prio_st *const sched,
+                              uint32_t const concurrency);
+
+/**
+ * @brief Wait until a slot may exchange messages with its ICC.
+ * @param[in, out] sched
+ * @param[in, out] ent
+ * @param[out] cls Class of the slot when it entered.
+ * @return true if the slot had to wait for its turn, false otherwise.
+ */
+bool ifd_prio_enter(ifd_prio_st *const sched, ifd_prio_ent_st *const ent,
+                    uint8_t *const cls);
+
+/**
+ * @brief Let the next slot go after a slot is done exchanging messages.
+ * @param[in, out] sched
+ */
+void ifd_prio_leave(ifd_prio_st *const sched);
@@ -0,0 +1,57 @@
+#pragma once
+/**
+ * USDT probes (provider "swicc_pcsc") for tracing the IFD handler in
+ * production, e.g., with bpftrace (see ./bench/bpftrace). A probe which is not
+ * attached is a single nop, so they are in all builds. Without <sys/sdt.h>
+ * (systemtap-sdt-dev(el)), they compile to nothing.
+ *
+ * Probes and their arguments:
+ * - ifdh_entry(char const *fn, DWORD Lun, uint64_t arg1, uint64_t arg2): An
+ *   IFDH* function was called. The arguments depend on the function, e.g., the
+ *   length of the command for IFDHTransmitToICC.
+ * - ifdh_return(char const *fn, DWORD Lun, RESPONSECODE ret, uint64_t len): An
+ *   IFDH* function returned. len is the length of what it returned (e.g., the
+ *   response or ATR), if anything.
+ * - msg_send(uint16_t slot, uint8_t ctrl, uint32_t size): A message is sent to
+ *   the ICC.
+ * - msg_send_return(uint16_t slot, int32_t ret)
+ * - msg_recv(uint16_t slot): A message is waited for.
+ * - msg_recv_return(uint16_t slot, uint8_t ctrl, uint32_t size, int32_t ret)
+ * - tpdu_proc(uint32_t id, uint8_t proc, uint32_t buf_len, uint32_t len_rem):
+ *   A decision was made on what the ICC sent while a command is transmitted.
+ *   id is the slot, proc is IFD_PROBE_PROC_*, buf_len is how much the ICC sent,
+ *   and len_rem is how much of the command is left to send.
+ */
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define IFD_PROBE_SDT
+#endif
+#endif
+
+/* Decisions of the T=0 state machine (tpdu_proc). */
+#define IFD_PROBE_PROC_ACK 1U
+/* The ICC sent a NULL procedure byte (0x60), i.e., it needs more time. */
+#define IFD_PROBE_PROC_NULL_BYTE 2U
+#define IFD_PROBE_PROC_STATUS 3U
+/* The ICC sent nothing, i.e., it changed state. */
+#define IFD_PROBE_PROC_NULL 4U
+#define IFD_PROBE_PROC_RSP 5U
+#define IFD_PROBE_PROC_INVALID 6U
+/* Pipelined data was consumed by the ICC or discarded. */
+#define IFD_PROBE_PROC_PIPELINE 7U
+#define IFD_PROBE_PROC_DISCARD 8U
+
+#ifdef IFD_PROBE_SDT
+#define IFD_PROBE1(name, a1) DTRACE_PROBE1(swicc_pcsc, name, a1)
+#define IFD_PROBE2(name, a1, a2) DTRACE_PROBE2(swicc_pcsc, name, a1, a2)
+#define IFD_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(swicc_pcsc, name, a1, a2, a3)
+#define IFD_PROBE4(name, a1, a2, a3, a4)                                       \
+    DTRACE_PROBE4(swicc_pcsc, name, a1, a2, a3, a4)
+#else
+#define IFD_PROBE1(name, a1)
+#define IFD_PROBE2(name, a1, a2)
+#define IFD_PROBE3(name, a1, a2, a3)
+#define IFD_PROBE4(name, a1, a2, a3, a4)
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+/**
+ * Allocator of objects which all have the same size, e.g., the state of a
+ * slot which is only needed while an ICC is connected. Objects are carved out
+ * of chunks which are allocated when first needed, and freed objects are kept
+ * for reuse, so the memory used follows the most objects in use at once
+ * instead of the most there could ever be.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Initializer of a slab.
+ * @param obj_size_ Size of an object.
+ * @param chunk_obj_count_ How many objects are allocated at once.
+ */
+#define IFD_SLAB_INIT(obj_size_, chunk_obj_count_)                             \
+    {                                                                          \
+        .lock = PTHREAD_MUTEX_INITIALIZER, .obj_size = (obj_size_),            \
+        .chunk_obj_count = (chunk_obj_count_),                                 \
+    }
+
+/* A freed object, linked into the free list. */
+typedef struct ifd_slab_obj_s
+{
+    struct ifd_slab_obj_s *next;
+} ifd_slab_obj_st;
+
+/**
+ * Slab of objects. Safe to use from any thread.
+ */
+typedef struct ifd_slab_s
+{
+    pthread_mutex_t lock;
+    size_t obj_size;
+    uint32_t chunk_obj_count;
+    ifd_slab_obj_st *free;
+    /* How much memory is used. */
+    uint32_t chunk_count;
+    uint32_t obj_used;
+} ifd_slab_st;
+
+/**
+ * @brief Allocate an object.
+ * @param[in, out] slab
+ * @return Zeroed object, or NULL if out of memory.
+ */
+void *ifd_slab_alloc(ifd_slab_st *const slab);
+
+/**
+ * @brief Free an object so it can be allocated again.
+ * @param[in, out] slab
+ * @param[in] obj Allocated from the slab. Can be NULL.
+ */
+void ifd_slab_free(ifd_slab_st *const slab, void *const obj);
@@ -0,0 +1,100 @@
+#pragma once
+/**
+ * Transmission of a command APDU to an ICC as T=0 TPDUs, i.e., the handling of
+ * procedure bytes and status words (ISO 7816-3:2006 sec.10.3).
+ *
+ * The state machine does not do any I/O itself, instead it goes through the
+ * callbacks of ifd_tpdu_io_st. This way it can be driven by an in-memory ICC
+ * just as well as by a real one over the network.
+ */
+
+#include <msg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <swicc/swicc.h>
+
+/**
+ * Message I/O with the ICC.
+ */
+typedef struct ifd_tpdu_io_s
+{
+    /**
+     * Send the TX message to the ICC, and receive the next message from the ICC
+     * into the RX message. Both return 0 on success, -1 on failure.
+     */
+    int32_t (*send)(void *const ctx);
+    int32_t (*recv)(void *const ctx);
+    /* Passed to the callbacks as-is. */
+    void *ctx;
+    /**
+     * The RX message can grow when a message is received into it, so it is
+     * looked up again after every receive.
+     */
+    ifd_msg_st *msg_tx;
+    ifd_msg_st *msg_rx;
+    /* Holds the first reply while pipelining. */
+    ifd_msg_st *msg_rx_spec;
+    /* Identifies the ICC in probes, e.g., its slot. */
+    uint32_t id;
+} ifd_tpdu_io_st;
+
+/**
+ * State of the ICC which is carried from one command to the next.
+ */
+typedef struct ifd_tpdu_icc_s
+{
+    /* Sent along with every message. */
+    uint32_t cont_iface;
+    /* Taken from the last message that was received. */
+    uint32_t cont_icc;
+    uint32_t buf_len_exp;
+    /**
+     * If the data of a command can be sent right after its header (the ICC
+     * supports IFD_NET_FEATURE_PIPELINE).
+     */
+    bool pipeline;
+} ifd_tpdu_icc_st;
+
+/**
+ * @brief Transmit a command APDU and receive the response.
+ * @param[in] io
+ * @param[in, out] icc
+ * @param[in] apdu Command APDU.
+ * @param[in] apdu_len Length of the command APDU (header and data).
+ * @param[out] rsp Where to write the response (data and status).
+ * @param[in, out] rsp_len Gives the size of the response buffer. On success,
+ * receives the length of the response.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_tpdu_transceive(ifd_tpdu_io_st const *const io,
+                            ifd_tpdu_icc_st *const icc,
+                            uint8_t const *const apdu, uint32_t const apdu_len,
+                            uint8_t *const rsp, uint32_t *const rsp_len);
+
+/**
+ * @brief Get the longest response a command without a data phase can get in a
+ * batch, including its length prefix.
+ * @param[in] hdr Header of the command (5 bytes).
+ * @return Length of the response.
+ */
+uint32_t ifd_tpdu_batch_rsp_len_max(uint8_t const *const hdr);
+
+/**
+ * @brief Transmit several commands which have no data phase (5-byte headers)
+ * in one message, see IFD_NET_MSG_CTRL_BATCH. The ICC must support
+ * IFD_NET_FEATURE_BATCH and expect a header.
+ * @param[in] io
+ * @param[in, out] icc
+ * @param[in] hdr Headers of the commands back to back.
+ * @param[in] hdr_count How many commands there are.
+ * @param[out] rsp Where to write the responses (data and status), each
+ * preceded by its length (2 bytes, big endian).
+ * @param[in, out] rsp_len Gives the size of the response buffer. On success,
+ * receives the length of the responses.
+ * @param[out] rsp_count On success, receives how many commands were answered.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_tpdu_batch(ifd_tpdu_io_st const *const io,
+                       ifd_tpdu_icc_st *const icc, uint8_t const *const hdr,
+                       uint32_t const hdr_count, uint8_t *const rsp,
+                       uint32_t *const rsp_len, uint32_t *const rsp_count);
@@ -0,0 +1,91 @@
+#pragma once
+/**
+ * Framing of swICC network messages on the wire.
+ *
+ * Version 1 is the swICC framing: the whole swicc_net_msg_st header followed by
+ * the data buffer. Version 2 is a compact framing, used only when both ends
+ * agree on it at connect:
+ *   varint frame_len | flags | [cont_state varint] | [ctrl] |
+ *   [buf_len_exp varint] | buf
+ * where varints are unsigned LEB128, and a header field is only present when
+ * its flag is set. An absent field has the same value as in the previous
+ * message sent in the same direction (all fields start out as 0).
+ */
+
+#include <impair.h>
+#include <msg.h>
+#include <stdint.h>
+#include <swicc/swicc.h>
+
+#define IFD_WIRE_VERSION_1 1U
+#define IFD_WIRE_VERSION_2 2U
+
+#define IFD_WIRE_FLAG_CONT_STATE 0x01
+#define IFD_WIRE_FLAG_CTRL 0x02
+#define IFD_WIRE_FLAG_BUF_LEN_EXP 0x04
+
+/**
+ * Header fields of the last message that was sent or received in version 2.
+ */
+typedef struct ifd_wire_hdr_s
+{
+    uint32_t cont_state;
+    uint8_t ctrl;
+    uint32_t buf_len_exp;
+} ifd_wire_hdr_st;
+
+/**
+ * Wire state of one connection.
+ */
+typedef struct ifd_wire_s
+{
+    uint8_t version;
+    ifd_wire_hdr_st hdr_tx;
+    ifd_wire_hdr_st hdr_rx;
+    /* Bytes and messages that went over the wire. */
+    uint64_t tx_len;
+    uint64_t rx_len;
+    uint64_t tx_count;
+    uint64_t rx_count;
+    /**
+     * Impairment of the connection, or NULL for none. Reads and writes are
+     * only split in version 2 since version 1 is sent by swICC.
+     */
+    ifd_impair_st *impair;
+} ifd_wire_st;
+
+/**
+ * @brief Reset the wire state of a connection to version 1. The impairment is
+ * kept.
+ * @param[in, out] wire
+ */
+void ifd_wire_reset(ifd_wire_st *const wire);
+
+/**
+ * @brief Switch a connection to a given version. The header fields of both
+ * directions start out as 0.
+ * @param[in, out] wire
+ * @param[in] version
+ */
+void ifd_wire_version_set(ifd_wire_st *const wire, uint8_t const version);
+
+/**
+ * @brief Send a message.
+ * @param[in] sock
+ * @param[in, out] wire
+ * @param[in] msg
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_wire_send(int32_t const sock, ifd_wire_st *const wire,
+                      swicc_net_msg_st const *const msg);
+
+/**
+ * @brief Receive a message.
+ * @param[in] sock
+ * @param[in, out] wire
+ * @param[in, out] msg Grows to fit the message if it has to. Must be
+ * initialized.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_wire_recv(int32_t const sock, ifd_wire_st *const wire,
+                      ifd_msg_st *const msg);
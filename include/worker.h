@@ -0,0 +1,77 @@
+#pragma once
+/**
+ * A thread which does all the work for one slot. Requests are handed to it
+ * through a lock-free single-producer single-consumer ring, and the caller
+ * waits for them to complete. When no request comes in for a while, the worker
+ * runs its idle function (e.g., a keep-alive).
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Must be a power of 2. */
+#define IFD_WORKER_RING_LEN 8U
+
+typedef int32_t ifd_worker_fn(void *const arg);
+
+/**
+ * A request to run a function on the worker.
+ */
+typedef struct ifd_worker_req_s
+{
+    ifd_worker_fn *fn;
+    void *arg;
+    int32_t ret;
+    /* Posted by the worker when the request is done. */
+    sem_t done;
+} ifd_worker_req_st;
+
+typedef struct ifd_worker_s
+{
+    pthread_t thread;
+    bool running;
+    ifd_worker_req_st *ring[IFD_WORKER_RING_LEN];
+    /* Only written by the producer (head) or by the worker (tail). */
+    _Atomic uint32_t ring_head;
+    _Atomic uint32_t ring_tail;
+    /* Posted for every request put in the ring, and to stop the worker. */
+    sem_t wake;
+    atomic_bool stop;
+    ifd_worker_fn *idle_fn;
+    void *idle_arg;
+    uint32_t idle_ms;
+} ifd_worker_st;
+
+/**
+ * @brief Start a worker.
+ * @param[out] worker
+ * @param[in] idle_fn Run when no request came in for idle_ms. Can be NULL.
+ * @param[in] idle_arg
+ * @param[in] idle_ms
+ * @return 0 on success, -1 on failure.
+ */
+int32_t ifd_worker_start(ifd_worker_st *const worker,
+                         ifd_worker_fn *const idle_fn, void *const idle_arg,
+                         uint32_t const idle_ms);
+
+/**
+ * @brief Stop a worker after it finishes the requests it already got, and wait
+ * for it to exit. Must not be called by the worker itself.
+ * @param[in, out] worker
+ */
+void ifd_worker_stop(ifd_worker_st *const worker);
+
+/**
+ * @brief Run a function on a worker and wait for it to return. There must be
+ * only one caller at a time for a given worker.
+ * @param[in, out] worker
+ * @param[in] fn
+ * @param[in] arg
+ * @param[out] ret Where to write what the function returned.
+ * @return 0 on success, -1 on failure (request could not be queued).
+ */
+int32_t ifd_worker_call(ifd_worker_st *const worker, ifd_worker_fn *const fn,
+                        void *const arg, int32_t *const ret);
@@ -0,0 +1,104 @@
+/**
+ * Parsing of the answer-to-reset.
+ */
+
+#include <atr.h>
+#include <pcsclite.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* ISO 7816-3:2006 sec.8.3 table.7. RFU values are 0. */
+static uint16_t const fi_table[16U] = {372U, 372U, 558U, 744U, 1116U, 1488U,
+                                       1860U, 0U, 0U, 512U, 768U, 1024U,
+                                       1536U, 2048U, 0U, 0U};
+/* ISO 7816-3:2006 sec.8.3 table.8. RFU values are 0. */
+static uint8_t const di_table[16U] = {0U, 1U, 2U, 4U, 8U, 16U, 32U, 64U,
+                                      12U, 20U, 0U, 0U, 0U, 0U, 0U, 0U};
+
+int32_t ifd_atr_parse(uint8_t const *const atr, uint32_t const atr_len,
+                      ifd_atr_st *const atr_parsed)
+{
+    memset(atr_parsed, 0U, sizeof(*atr_parsed));
+    atr_parsed->ta1 = 0x11;
+    atr_parsed->ifsc = 32U;
+
+    /* Need at least TS and T0. */
+    if (atr_len < 2U)
+    {
+        return -1;
+    }
+
+    uint8_t const hist_len = atr[1U] & 0x0F;
+    uint8_t y = atr[1U] >> 4U;
+    uint32_t atr_idx = 2U;
+    /* Protocol indicated by the previous TD. */
+    uint8_t t_prev = 0U;
+    bool ifsc_found = false;
+    bool tck_present = false;
+    for (uint8_t i = 1U; y != 0U; ++i)
+    {
+        uint8_t const interface_len = (uint8_t)__builtin_popcount(y);
+        if (atr_idx + interface_len > atr_len)
+        {
+            return -1;
+        }
+        uint8_t const *const ta = (y & 0x1) ? &atr[atr_idx++] : NULL;
+        if (y & 0x2)
+        {
+            /* TB is not used. */
+            ++atr_idx;
+        }
+        uint8_t const *const tc = (y & 0x4) ? &atr[atr_idx++] : NULL;
+        uint8_t const *const td = (y & 0x8) ? &atr[atr_idx++] : NULL;
+
+        if (i == 1U)
+        {
+            atr_parsed->ta1 = ta != NULL ? *ta : atr_parsed->ta1;
+            atr_parsed->tc1 = tc != NULL ? *tc : atr_parsed->tc1;
+        }
+        else if (i > 2U && t_prev == 1U && ta != NULL && !ifsc_found)
+        {
+            /* The first TA for T=1 (i > 2) encodes IFSC. */
+            atr_parsed->ifsc = *ta;
+            ifsc_found = true;
+        }
+
+        if (td == NULL)
+        {
+            break;
+        }
+        uint8_t const t = *td & 0x0F;
+        if (t <= 1U)
+        {
+            atr_parsed->proto |=
+                t == 0U ? SCARD_PROTOCOL_T0 : SCARD_PROTOCOL_T1;
+        }
+        /* Any protocol other than T=0 means that TCK is present. */
+        tck_present = tck_present || t != 0U;
+        t_prev = t;
+        y = *td >> 4U;
+    }
+
+    if (atr_parsed->proto == 0U)
+    {
+        atr_parsed->proto = SCARD_PROTOCOL_T0;
+    }
+
+    if (atr_idx + hist_len + (tck_present ? 1U : 0U) > atr_len)
+    {
+        return -1;
+    }
+    memcpy(atr_parsed->hist, &atr[atr_idx], hist_len);
+    atr_parsed->hist_len = hist_len;
+    return 0;
+}
+
+uint32_t ifd_atr_fi(uint8_t const ta1)
+{
+    return fi_table[ta1 >> 4U];
+}
+
+uint32_t ifd_atr_di(uint8_t const ta1)
+{
+    return di_table[ta1 & 0x0F];
+}
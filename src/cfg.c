@@ -0,0 +1,506 @@
+/**
+ * Runtime configuration of the IFD handler.
+ */
+
+#include <cfg.h>
+#include <ctype.h>
+#include <debuglog.h>
+#include <ifd_vendor.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define CFG_ENV_PREFIX "SWICC_PCSC_"
+/* Longest DEVICENAME, line of a config file, or environment variable name. */
+#define CFG_LINE_LEN_MAX 512U
+
+#define CFG_URL_SCHEME_TCP "tcp://"
+#define CFG_URL_SCHEME_UNIX "unix://"
+
+typedef enum cfg_type_e
+{
+    CFG_TYPE_U8,
+    CFG_TYPE_U16,
+    CFG_TYPE_U32,
+    CFG_TYPE_BOOL,
+    CFG_TYPE_LIVENESS,
+    CFG_TYPE_IMPAIR_DIST,
+} cfg_type_et;
+
+/**
+ * A configuration key. Integer values outside of [min, max] are invalid.
+ */
+typedef struct cfg_key_s
+{
+    char const *name;
+    cfg_type_et type;
+    size_t offset;
+    uint32_t min;
+    uint32_t max;
+} cfg_key_st;
+
+static cfg_key_st const cfg_key[] = {
+    {"slots", CFG_TYPE_U16, offsetof(ifd_cfg_st, slot_count), 1U,
+     IFD_CFG_SLOT_COUNT_MAX},
+    {"backlog", CFG_TYPE_U32, offsetof(ifd_cfg_st, backlog), 1U, INT32_MAX},
+    {"reuseport", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, reuseport), 0U, 1U},
+    {"listen_fd", CFG_TYPE_U32, offsetof(ifd_cfg_st, listen_fd), 0U,
+     INT32_MAX},
+    {"persist", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, persist), 0U, 1U},
+    {"nodelay", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, nodelay), 0U, 1U},
+    {"rcvbuf", CFG_TYPE_U32, offsetof(ifd_cfg_st, rcvbuf), 0U, INT32_MAX},
+    {"sndbuf", CFG_TYPE_U32, offsetof(ifd_cfg_st, sndbuf), 0U, INT32_MAX},
+    {"busy_poll", CFG_TYPE_U32, offsetof(ifd_cfg_st, busy_poll), 0U,
+     INT32_MAX},
+    {"liveness", CFG_TYPE_LIVENESS, offsetof(ifd_cfg_st, liveness), 0U, 0U},
+    {"workers", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, workers), 0U, 1U},
+    {"keepalive_ms", CFG_TYPE_U32, offsetof(ifd_cfg_st, keepalive_ms), 10U,
+     3600000U},
+    {"presence_window_ms", CFG_TYPE_U32,
+     offsetof(ifd_cfg_st, presence_window_ms), 0U, 3600000U},
+    {"slot_active_max", CFG_TYPE_U16, offsetof(ifd_cfg_st, slot_active_max),
+     0U, IFD_CFG_SLOT_COUNT_MAX},
+    {"accept_rate", CFG_TYPE_U32, offsetof(ifd_cfg_st, accept_rate), 0U,
+     UINT32_MAX},
+    {"apdu_rate", CFG_TYPE_U32, offsetof(ifd_cfg_st, apdu_rate), 0U,
+     UINT32_MAX},
+    {"resume_grace_ms", CFG_TYPE_U32, offsetof(ifd_cfg_st, resume_grace_ms),
+     0U, UINT32_MAX},
+    {"wire_version_max", CFG_TYPE_U8, offsetof(ifd_cfg_st, wire_version_max),
+     1U, 2U},
+    {"pipeline", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, pipeline), 0U, 1U},
+    {"batch", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, batch), 0U, 1U},
+    {"events", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, events), 0U, 1U},
+    {"memo", CFG_TYPE_BOOL, offsetof(ifd_cfg_st, memo), 0U, 1U},
+    {"trace", CFG_TYPE_U8, offsetof(ifd_cfg_st, trace), IFD_VENDOR_TRACE_OFF,
+     IFD_VENDOR_TRACE_MSG},
+    {"sched_concurrency", CFG_TYPE_U16, offsetof(ifd_cfg_st, sched_concurrency),
+     0U, IFD_CFG_SLOT_COUNT_MAX},
+    {"prio_class", CFG_TYPE_U8, offsetof(ifd_cfg_st, prio_class),
+     IFD_VENDOR_PRIO_CLASS_INTERACTIVE, IFD_VENDOR_PRIO_CLASS_BULK},
+    {"prio_weight", CFG_TYPE_U16, offsetof(ifd_cfg_st, prio_weight), 1U,
+     IFD_VENDOR_PRIO_WEIGHT_MAX},
+    {"impair_delay_us", CFG_TYPE_U32, offsetof(ifd_cfg_st, impair.delay_us),
+     0U, 10000000U},
+    {"impair_jitter_us", CFG_TYPE_U32, offsetof(ifd_cfg_st, impair.jitter_us),
+     0U, 10000000U},
+    {"impair_dist", CFG_TYPE_IMPAIR_DIST, offsetof(ifd_cfg_st, impair.dist),
+     0U, 0U},
+    {"impair_partial_ppm", CFG_TYPE_U32,
+     offsetof(ifd_cfg_st, impair.partial_ppm), 0U, 1000000U},
+    {"impair_reset_ppm", CFG_TYPE_U32, offsetof(ifd_cfg_st, impair.reset_ppm),
+     0U, 1000000U},
+    {"impair_seed", CFG_TYPE_U32, offsetof(ifd_cfg_st, impair.seed), 0U,
+     UINT32_MAX},
+};
+
+/**
+ * @brief Set the defaults.
+ * @param[out] cfg
+ * @param[in] port_def
+ */
+static void cfg_default(ifd_cfg_st *const cfg, char const *const port_def)
+{
+    memset(cfg, 0U, sizeof(*cfg));
+    cfg->transport = IFD_TRANSPORT_TCP;
+    snprintf(cfg->port, sizeof(cfg->port), "%s", port_def);
+    cfg->slot_count = IFD_CFG_SLOT_COUNT_MAX;
+    cfg->backlog = SOMAXCONN;
+    cfg->nodelay = true;
+    cfg->liveness = IFD_LIVENESS_KEEPALIVE;
+    cfg->keepalive_ms = 1000U;
+    cfg->slot_active_max = IFD_CFG_SLOT_COUNT_MAX;
+    cfg->wire_version_max = 1U;
+#ifdef DEBUG
+    cfg->trace = IFD_VENDOR_TRACE_MSG;
+#else
+    cfg->trace = IFD_VENDOR_TRACE_OFF;
+#endif
+    cfg->prio_class = IFD_VENDOR_PRIO_CLASS_DEFAULT;
+    cfg->prio_weight = 1U;
+}
+
+/**
+ * @brief Remove whitespace from the start and the end of a string.
+ * @param[in, out] str
+ * @return The trimmed string (inside the given one).
+ */
+static char *str_trim(char *str)
+{
+    while (isspace((unsigned char)*str))
+    {
+        ++str;
+    }
+    size_t len = strlen(str);
+    while (len > 0U && isspace((unsigned char)str[len - 1U]))
+    {
+        str[--len] = '\0';
+    }
+    return str;
+}
+
+/**
+ * @brief Copy a string into a fixed size buffer.
+ * @param[out] dst
+ * @param[in] dst_size
+ * @param[in] src
+ * @param[in] src_len
+ * @return 0 on success, -1 on failure (string is too long).
+ */
+static int32_t str_copy(char *const dst, size_t const dst_size,
+                        char const *const src, size_t const src_len)
+{
+    if (src_len >= dst_size)
+    {
+        return -1;
+    }
+    memcpy(dst, src, src_len);
+    dst[src_len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Load a config file.
+ * @param[in, out] cfg
+ * @param[in] path
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t cfg_file_load(ifd_cfg_st *const cfg, char const *const path)
+{
+    FILE *const file = fopen(path, "r");
+    if (file == NULL)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to open config file '%s'.", path);
+        return -1;
+    }
+
+    char line[CFG_LINE_LEN_MAX];
+    uint32_t line_num = 0U;
+    int32_t ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        ++line_num;
+        char *const line_trim = str_trim(line);
+        if (line_trim[0U] == '\0' || line_trim[0U] == '#')
+        {
+            continue;
+        }
+        char *const sep = strchr(line_trim, '=');
+        if (sep == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        *sep = '\0';
+        ret = ifd_cfg_set(cfg, str_trim(line_trim), str_trim(sep + 1U));
+    }
+    fclose(file);
+
+    if (ret != 0)
+    {
+        Log3(PCSC_LOG_ERROR, "Invalid line %u in config file '%s'.", line_num,
+             path);
+    }
+    return ret;
+}
+
+/**
+ * @brief Parse the query of a URL, i.e., 'key=val&...'.
+ * @param[in, out] cfg
+ * @param[in, out] query Gets modified while parsing.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t cfg_query_parse(ifd_cfg_st *const cfg, char *const query)
+{
+    char *save;
+    for (char *param = strtok_r(query, "&", &save); param != NULL;
+         param = strtok_r(NULL, "&", &save))
+    {
+        char *const sep = strchr(param, '=');
+        if (sep == NULL)
+        {
+            Log2(PCSC_LOG_ERROR, "Query parameter '%s' has no value.", param);
+            return -1;
+        }
+        *sep = '\0';
+        char const *const val = sep + 1U;
+        if (strcmp(param, "config") == 0)
+        {
+            if (cfg_file_load(cfg, val) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (ifd_cfg_set(cfg, param, val) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse the host and port of a TCP URL, i.e., 'host', 'host:port',
+ * '[ipv6]', or '[ipv6]:port'.
+ * @param[in, out] cfg
+ * @param[in] authority
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t cfg_authority_parse(ifd_cfg_st *const cfg,
+                                   char const *const authority)
+{
+    char const *host = authority;
+    size_t host_len;
+    char const *port;
+    if (host[0U] == '[')
+    {
+        char const *const host_end = strchr(host, ']');
+        if (host_end == NULL ||
+            (host_end[1U] != '\0' && host_end[1U] != ':'))
+        {
+            return -1;
+        }
+        ++host;
+        host_len = (size_t)(host_end - host);
+        port = host_end[1U] == ':' ? &host_end[2U] : NULL;
+    }
+    else
+    {
+        char const *const sep = strrchr(host, ':');
+        host_len = sep == NULL ? strlen(host) : (size_t)(sep - host);
+        port = sep == NULL ? NULL : sep + 1U;
+    }
+
+    if (str_copy(cfg->host, sizeof(cfg->host), host, host_len) != 0)
+    {
+        return -1;
+    }
+    if (port != NULL)
+    {
+        char *port_end;
+        unsigned long const port_num = strtoul(port, &port_end, 10);
+        if (*port == '\0' || *port_end != '\0' || port_num > UINT16_MAX ||
+            str_copy(cfg->port, sizeof(cfg->port), port, strlen(port)) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse a DEVICENAME URL.
+ * @param[in, out] cfg
+ * @param[in] url
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t cfg_url_parse(ifd_cfg_st *const cfg, char const *const url)
+{
+    char buf[CFG_LINE_LEN_MAX];
+    if (str_copy(buf, sizeof(buf), url, strlen(url)) != 0)
+    {
+        return -1;
+    }
+    char *const query = strchr(buf, '?');
+    if (query != NULL)
+    {
+        *query = '\0';
+    }
+
+    int32_t ret;
+    if (strncmp(buf, CFG_URL_SCHEME_TCP, strlen(CFG_URL_SCHEME_TCP)) == 0)
+    {
+        cfg->transport = IFD_TRANSPORT_TCP;
+        ret = cfg_authority_parse(cfg, &buf[strlen(CFG_URL_SCHEME_TCP)]);
+    }
+    else if (strncmp(buf, CFG_URL_SCHEME_UNIX, strlen(CFG_URL_SCHEME_UNIX)) ==
+             0)
+    {
+        /* The authority is empty so the path follows the scheme. */
+        char const *const path = &buf[strlen(CFG_URL_SCHEME_UNIX)];
+        cfg->transport = IFD_TRANSPORT_UNIX;
+        ret = path[0U] == '/'
+                  ? str_copy(cfg->path, sizeof(cfg->path), path, strlen(path))
+                  : -1;
+    }
+    else
+    {
+        ret = -1;
+    }
+
+    if (ret == 0 && query != NULL)
+    {
+        ret = cfg_query_parse(cfg, query + 1U);
+    }
+    return ret;
+}
+
+/**
+ * @brief Apply the configuration from the environment.
+ * @param[in, out] cfg
+ * @return 0 on success, -1 on failure (a value is invalid).
+ */
+static int32_t cfg_env_load(ifd_cfg_st *const cfg)
+{
+    for (uint32_t key_i = 0U; key_i < sizeof(cfg_key) / sizeof(cfg_key[0U]);
+         ++key_i)
+    {
+        char name[CFG_LINE_LEN_MAX];
+        int const name_len = snprintf(name, sizeof(name), "%s%s",
+                                      CFG_ENV_PREFIX, cfg_key[key_i].name);
+        if (name_len < 0 || (size_t)name_len >= sizeof(name))
+        {
+            continue;
+        }
+        for (char *c = &name[strlen(CFG_ENV_PREFIX)]; *c != '\0'; ++c)
+        {
+            *c = (char)toupper((unsigned char)*c);
+        }
+
+        char const *const val = getenv(name);
+        if (val != NULL && ifd_cfg_set(cfg, cfg_key[key_i].name, val) != 0)
+        {
+            Log3(PCSC_LOG_ERROR, "Invalid environment variable %s='%s'.",
+                 name, val);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int32_t ifd_cfg_load(ifd_cfg_st *const cfg, char const *const port_def,
+                     char const *const device_name,
+                     char const *const device_def)
+{
+    cfg_default(cfg, port_def);
+
+    char const *const path = getenv(CFG_ENV_PREFIX "CONFIG");
+    if (path != NULL && cfg_file_load(cfg, path) != 0)
+    {
+        return -1;
+    }
+
+    if (device_name != NULL &&
+        strncmp(device_name, device_def, strlen(device_def)) != 0 &&
+        cfg_url_parse(cfg, device_name) != 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Invalid DEVICENAME '%s'.", device_name);
+        return -1;
+    }
+
+    if (cfg_env_load(cfg) != 0)
+    {
+        return -1;
+    }
+    /* There can't be more occupied slots than slots. */
+    if (cfg->slot_active_max > cfg->slot_count)
+    {
+        cfg->slot_active_max = cfg->slot_count;
+    }
+    return 0;
+}
+
+int32_t ifd_cfg_set(ifd_cfg_st *const cfg, char const *const key,
+                    char const *const val)
+{
+    cfg_key_st const *key_info = NULL;
+    for (uint32_t key_i = 0U; key_i < sizeof(cfg_key) / sizeof(cfg_key[0U]);
+         ++key_i)
+    {
+        if (strcmp(cfg_key[key_i].name, key) == 0)
+        {
+            key_info = &cfg_key[key_i];
+            break;
+        }
+    }
+    if (key_info == NULL)
+    {
+        Log2(PCSC_LOG_ERROR, "Unknown configuration key '%s'.", key);
+        return -1;
+    }
+
+    uint8_t *const field = (uint8_t *)cfg + key_info->offset;
+    if (key_info->type == CFG_TYPE_LIVENESS)
+    {
+        ifd_liveness_et liveness;
+        if (strcmp(val, "keepalive") == 0)
+        {
+            liveness = IFD_LIVENESS_KEEPALIVE;
+        }
+        else if (strcmp(val, "sock") == 0)
+        {
+            liveness = IFD_LIVENESS_SOCK;
+        }
+        else
+        {
+            Log3(PCSC_LOG_ERROR, "Invalid value '%s' of '%s'.", val, key);
+            return -1;
+        }
+        memcpy(field, &liveness, sizeof(liveness));
+        return 0;
+    }
+    if (key_info->type == CFG_TYPE_IMPAIR_DIST)
+    {
+        ifd_impair_dist_et dist;
+        if (strcmp(val, "uniform") == 0)
+        {
+            dist = IFD_IMPAIR_DIST_UNIFORM;
+        }
+        else if (strcmp(val, "exp") == 0)
+        {
+            dist = IFD_IMPAIR_DIST_EXP;
+        }
+        else if (strcmp(val, "pareto") == 0)
+        {
+            dist = IFD_IMPAIR_DIST_PARETO;
+        }
+        else
+        {
+            Log3(PCSC_LOG_ERROR, "Invalid value '%s' of '%s'.", val, key);
+            return -1;
+        }
+        memcpy(field, &dist, sizeof(dist));
+        return 0;
+    }
+
+    /* Only plain decimal numbers, strtoull alone would take e.g. ' +1'. */
+    char *val_end;
+    unsigned long long const val_num = strtoull(val, &val_end, 10);
+    if (!isdigit((unsigned char)*val) || *val_end != '\0')
+    {
+        Log3(PCSC_LOG_ERROR, "Invalid value '%s' of '%s'.", val, key);
+        return -1;
+    }
+    if (val_num < key_info->min || val_num > key_info->max)
+    {
+        Log5(PCSC_LOG_ERROR, "Value '%s' of '%s' is out of range [%u, %u].",
+             val, key, key_info->min, key_info->max);
+        return -1;
+    }
+
+    /* Safe casts since the value is in the range of the field. */
+    uint8_t const val_u8 = (uint8_t)val_num;
+    uint16_t const val_u16 = (uint16_t)val_num;
+    uint32_t const val_u32 = (uint32_t)val_num;
+    bool const val_bool = val_num != 0U;
+    switch (key_info->type)
+    {
+    case CFG_TYPE_U8:
+        memcpy(field, &val_u8, sizeof(val_u8));
+        break;
+    case CFG_TYPE_U16:
+        memcpy(field, &val_u16, sizeof(val_u16));
+        break;
+    case CFG_TYPE_U32:
+        memcpy(field, &val_u32, sizeof(val_u32));
+        break;
+    case CFG_TYPE_BOOL:
+        memcpy(field, &val_bool, sizeof(val_bool));
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
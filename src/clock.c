@@ -0,0 +1,64 @@
+/**
+ * Clock of the IFD handler, either of the system or virtual.
+ */
+
+#include <clock.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+
+static atomic_bool clock_virtual = false;
+static _Atomic uint64_t clock_virtual_ns = IFD_CLOCK_VIRTUAL_START_NS;
+
+uint64_t ifd_clock_ns(void)
+{
+    if (atomic_load_explicit(&clock_virtual, memory_order_relaxed))
+    {
+        return atomic_load_explicit(&clock_virtual_ns, memory_order_relaxed);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+void ifd_clock_sleep_ns(uint64_t const dur_ns)
+{
+    if (atomic_load_explicit(&clock_virtual, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&clock_virtual_ns, dur_ns,
+                                  memory_order_relaxed);
+        return;
+    }
+    struct timespec ts = {.tv_sec = (time_t)(dur_ns / 1000000000U),
+                          .tv_nsec = (long)(dur_ns % 1000000000U)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+void ifd_clock_virtual_set(bool const enable)
+{
+    atomic_store_explicit(&clock_virtual_ns, IFD_CLOCK_VIRTUAL_START_NS,
+                          memory_order_relaxed);
+    atomic_store_explicit(&clock_virtual, enable, memory_order_relaxed);
+}
+
+bool ifd_clock_virtual(void)
+{
+    return atomic_load_explicit(&clock_virtual, memory_order_relaxed);
+}
+
+void ifd_clock_advance_to(uint64_t const time_ns)
+{
+    if (!atomic_load_explicit(&clock_virtual, memory_order_relaxed))
+    {
+        return;
+    }
+    uint64_t now =
+        atomic_load_explicit(&clock_virtual_ns, memory_order_relaxed);
+    while (now < time_ns && !atomic_compare_exchange_weak_explicit(
+                                &clock_virtual_ns, &now, time_ns,
+                                memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
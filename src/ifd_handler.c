@@ -2,41 +2,280 @@
  * IFD handler for PCSC-lite.
  */
 
+#include <atr.h>
+#include <cfg.h>
+#include <clock.h>
 #include <debuglog.h>
+#include <errno.h>
+#include <ifd_vendor.h>
 #include <ifdhandler.h>
+#include <impair.h>
+#include <io.h>
+#include <lat.h>
+#include <memo.h>
+#include <msg.h>
+#include <net.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <prio.h>
+#include <probe.h>
+#include <pthread.h>
+#include <reader.h>
+#include <slab.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <swicc/swicc.h>
+#include <sys/random.h>
 #include <sys/socket.h>
-
-#define IFD_SLOT_COUNT_MAX SWICC_NET_CLIENT_COUNT_MAX
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <tpdu.h>
+#include <unistd.h>
+#include <wire.h>
+#include <worker.h>
+
+#define IFD_SLOT_COUNT_MAX IFD_CFG_SLOT_COUNT_MAX
 #define IFD_SERVER_PORT_STR "37324"
 
+/* Only short APDUs are supported (5 bytes of header and up to 255 of data). */
+#define IFD_APDU_LEN_MAX (5U + 255U)
+
+/* TCP keepalive parameters used for socket-level liveness checks. */
+#define IFD_SOCK_KEEPIDLE_S 5
+#define IFD_SOCK_KEEPINTVL_S 1
+#define IFD_SOCK_KEEPCNT 3
+#define IFD_SOCK_USER_TIMEOUT_MS 5000U
+
+/**
+ * For how many times 'keepalive_ms' presence sweeps wait for the reply to a
+ * keep-alive before the ICC is taken to be gone (5s by default).
+ */
+#define IFD_SWEEP_REPLY_KEEPALIVE_MAX 5U
+
+/**
+ * Traces up to the inline length are formatted in a buffer of the thread, and
+ * longer ones (at most the maximum length) in a buffer that is allocated when
+ * first needed.
+ */
+#define IFD_DBG_STR_INLINE_LEN 256U
+#define IFD_DBG_STR_LEN_MAX 4096U
+
+/* How many client statistics are allocated at once. */
+#define IFD_CLIENT_STATS_CHUNK_LEN 4U
+/* Response caches are large, so they are allocated one at a time. */
+#define IFD_MEMO_CHUNK_LEN 1U
+
+/* Length of the token which lets a reconnecting ICC resume its session. */
+#define IFD_RESUME_TOKEN_LEN 16U
+
+/* What can be set on a slot at runtime instead of by the configuration. */
+#define IFD_SLOT_SET_TRACE (1U << 0U)
+#define IFD_SLOT_SET_MEMO (1U << 1U)
+#define IFD_SLOT_SET_PRIO (1U << 2U)
+
+/**
+ * Name of the listening socket among the sockets passed with socket activation
+ * (FileDescriptorName= of a systemd socket unit), and the first passed fd.
+ */
+#define IFD_LISTEN_FD_NAME "swicc-pcsc"
+#define IFD_LISTEN_FDS_START 3
+
+/**
+ * Token bucket rate limiter. Credit is time that accumulates at the wall-clock
+ * rate, up to 1s worth of events, and each event costs 1s divided by the rate.
+ */
+typedef struct rate_limit_s
+{
+    uint64_t credit_ns;
+    uint64_t ts_ns;
+} rate_limit_st;
+
+/**
+ * State of a client which is only needed once it exchanged APDUs. Most of the
+ * memory of a client is in here, so it's allocated from a slab when first
+ * needed and given back when the client goes away.
+ */
+typedef struct client_stats_s
+{
+    ifd_vendor_chan_stats_st chan[IFD_VENDOR_CHAN_COUNT_MAX];
+    /* Latency of successful IFDHTransmitToICC calls. */
+    ifd_lat_hist_st apdu_lat_hist;
+} client_stats_st;
+
 typedef struct client_icc_s
 {
     char atr[MAX_ATR_SIZE];
     uint32_t atr_len;
+    /* Capabilities which are cached when the ICC gets powered up. */
+    ifd_atr_st atr_info;
+    uint32_t apdu_len_max;
+    uint32_t proto;
+    bool pwr_down;
     uint32_t cont_iface;
     uint32_t cont_icc;
     uint32_t buf_len_exp;
+    /* Bit N is set when logical channel N is open. */
+    uint32_t chan_open;
+    /* NULL until first needed. */
+    client_stats_st *stats;
+    rate_limit_st apdu_rate_limit;
+    uint64_t apdu_throttle_count;
+    /* Set when the ICC accepted the resumption token. */
+    bool resume_token_set;
+    uint8_t resume_token[IFD_RESUME_TOKEN_LEN];
+    /**
+     * When the ICC is disconnected but its slot is held for it, this is the
+     * time at which the slot gets released. 0 if the slot is not held.
+     */
+    uint64_t resume_deadline_ns;
+    ifd_wire_st wire;
+    /* Optional features (IFD_NET_FEATURE_*) supported by the ICC. */
+    uint8_t features;
+    /* Latency of successful IFDHTransmitToICC calls. */
+    uint64_t apdu_count;
+    uint64_t apdu_lat_ns_sum;
+    uint64_t apdu_lat_ns_max;
+    /* Used by the wire only when the network impairment is enabled. */
+    ifd_impair_st impair;
+    /* What the ICC told with events (IFD_NET_FEATURE_EVENT). */
+    bool exiting;
+    uint64_t busy_until_ns;
+    /* When the last message was received from the ICC, if it sends events. */
+    uint64_t rx_last_ns;
+    uint64_t event_count;
+    uint64_t keepalive_skip_count;
+    /* Cache of responses, NULL unless enabled when the ICC was reset. */
+    ifd_memo_st *memo;
+    uint64_t memo_hit_count;
+    uint64_t memo_miss_count;
+    uint64_t memo_saved_ns;
+    /**
+     * Result of the last presence sweep, and when it was done. Presence checks
+     * answer from it for 'presence_window_ms'.
+     */
+    bool presence_alive;
+    uint64_t presence_ns;
+    /**
+     * When a keep-alive was sent in a presence sweep which the ICC did not
+     * reply to yet, 0 if none.
+     */
+    uint64_t keepalive_sent_ns;
 } client_icc_st;
 
 static swicc_net_server_st server_ctx = {.sock_server = -1};
-static swicc_net_msg_st msg_tx = {0U};
-static swicc_net_msg_st msg_rx = {0U};
+/**
+ * Message buffers are per thread since slots can be served by workers running
+ * at the same time. They are set up when a thread first exchanges messages
+ * (see msg_thread_init), and what they grew into is freed when it exits.
+ */
+static _Thread_local ifd_msg_st msg_tx = {0U};
+static _Thread_local ifd_msg_st msg_rx = {0U};
+/* Reply to a command header while the speculatively sent data is in flight. */
+static _Thread_local ifd_msg_st msg_rx_spec = {0U};
+static pthread_key_t msg_key;
+static pthread_once_t msg_key_once = PTHREAD_ONCE_INIT;
 
 /* Keep track of client ICCs. */
 static client_icc_st client_icc[IFD_SLOT_COUNT_MAX] = {0U};
+static ifd_slab_st client_stats_slab =
+    IFD_SLAB_INIT(sizeof(client_stats_st), IFD_CLIENT_STATS_CHUNK_LEN);
+static ifd_slab_st memo_slab =
+    IFD_SLAB_INIT(sizeof(ifd_memo_st), IFD_MEMO_CHUNK_LEN);
+
+/* Loaded when the reader is created. */
+static ifd_cfg_st cfg = {
+    .transport = IFD_TRANSPORT_TCP,
+    .slot_count = IFD_SLOT_COUNT_MAX,
+    .liveness = IFD_LIVENESS_KEEPALIVE,
+    .slot_active_max = IFD_SLOT_COUNT_MAX,
+    .wire_version_max = IFD_WIRE_VERSION_1,
+};
+
+/* Slots for which the PC/SC daemon has an open channel. */
+static bool slot_chan_open[IFD_SLOT_COUNT_MAX] = {false};
+/* Set when the listening socket was inherited instead of created. */
+static bool sock_server_inherited = false;
+/**
+ * Set when the listening socket is the stand-in of I/O that was installed (see
+ * io.h), which is not closed.
+ */
+static bool sock_server_io = false;
 
-#ifdef DEBUG
-static char dbg_str[4096U];
-#else
-static char dbg_str[0U];
-#endif
-static uint16_t dbg_str_len;
+/* Admission control of new clients. */
+static rate_limit_st accept_rate_limit = {0U};
+static ifd_vendor_reader_stats_st reader_stats = {0U};
+
+/**
+ * Trace level (IFD_VENDOR_TRACE_*) of each slot. It's kept apart from the
+ * client so it survives reconnects, and is atomic since it can be changed from
+ * any thread of the PC/SC daemon.
+ */
+static atomic_uchar trace_level[IFD_SLOT_COUNT_MAX];
+/* Same for whether responses get cached. Takes effect on the next reset. */
+static atomic_bool memo_enable[IFD_SLOT_COUNT_MAX];
+
+/**
+ * Used for traces, so needed in all builds. The long buffer of a thread is
+ * freed when the thread exits.
+ */
+static _Thread_local char dbg_str[IFD_DBG_STR_INLINE_LEN];
+static _Thread_local char *dbg_str_long = NULL;
+static pthread_key_t dbg_str_long_key;
+static pthread_once_t dbg_str_long_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Workers of the slots, when enabled. Like the trace level, these are kept
+ * apart from the clients. A worker keeps track of whether its ICC is alive.
+ */
+static ifd_worker_st slot_worker[IFD_SLOT_COUNT_MAX];
+static atomic_bool slot_alive[IFD_SLOT_COUNT_MAX];
+/**
+ * Set when the ICC reloaded its file system, until the PC/SC daemon is told
+ * that the ICC was removed. Can be set by a worker.
+ */
+static atomic_bool slot_reload[IFD_SLOT_COUNT_MAX];
+/* Slot numbers which are passed to the workers. */
+static uint16_t slot_id[IFD_SLOT_COUNT_MAX];
+
+/**
+ * Slots take turns exchanging messages with their ICCs by priority. Like the
+ * trace level, the priorities are kept apart from the clients.
+ */
+static ifd_prio_st prio_sched = IFD_PRIO_INIT;
+static ifd_prio_ent_st slot_prio[IFD_SLOT_COUNT_MAX];
+static bool slot_prio_init = false;
+
+/**
+ * What was set on each slot at runtime (IFD_SLOT_SET_*). It is kept when the
+ * reader is created again with its ICCs attached, and the configuration only
+ * applies to what was not set. Only used under the reader lock.
+ */
+static uint8_t slot_set[IFD_SLOT_COUNT_MAX];
+/* Statistics of the priority classes, which are updated from all slots. */
+static pthread_mutex_t class_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static ifd_vendor_class_stats_st class_stats[IFD_VENDOR_PRIO_CLASS_COUNT];
+static ifd_lat_hist_st class_lat_hist[IFD_VENDOR_PRIO_CLASS_COUNT];
+
+/**
+ * Taken by the IFDH* functions which may touch more than their own slot, so
+ * the PC/SC daemon can call into different slots at the same time (with
+ * workers).
+ */
+static pthread_mutex_t reader_lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Taken around everything that runs for a slot (see slot_run), and by whatever
+ * else changes the client of the slot, e.g., an ICC resuming its session in it
+ * from another slot. Taken after the reader lock.
+ */
+static pthread_mutex_t slot_lock[IFD_SLOT_COUNT_MAX];
 
 /**
  * @brief Parse the Lun into a reader number and slot number and check that
@@ -70,294 +309,2416 @@ static int32_t lun_parse(DWORD const Lun, uint16_t *const reader_num,
 }
 
 /**
- * @brief Send the TX message, and receive the response into the RX message.
- * @param[in] slot_num Communicate with the card in a given slot.
- * @param[in] log_msg_enable If the exchange should be logged.
- * @return 0 on success, -1 on failure.
+ * @brief Take a token from a rate limiter.
+ * @param[in, out] rate_limit
+ * @param[in] rate Events per second, 0 means no limit.
+ * @return true if the event is within the rate limit, false if not.
  */
-static int32_t client_msg_io(uint16_t const slot_num, bool const log_msg_enable)
+static bool rate_limit_take(rate_limit_st *const rate_limit,
+                            uint32_t const rate)
 {
-    if (log_msg_enable)
+    if (rate == 0U)
     {
-        dbg_str_len = sizeof(dbg_str);
-        if (swicc_dbg_net_msg_str(dbg_str, &dbg_str_len, "TX:\n", &msg_tx) ==
-            SWICC_RET_SUCCESS)
-        {
-            Log3(PCSC_LOG_DEBUG, "%.*s", dbg_str_len, dbg_str);
-        }
-        else
-        {
-            Log1(PCSC_LOG_ERROR, "Failed to print TX message.");
-        }
+        return true;
     }
-
-    if (swicc_net_send(server_ctx.sock_client[slot_num], &msg_tx) !=
-        SWICC_RET_SUCCESS)
+    uint64_t const now = ifd_clock_ns();
+    uint64_t const cost = 1000000000U / rate;
+    rate_limit->credit_ns += now - rate_limit->ts_ns;
+    rate_limit->ts_ns = now;
+    if (rate_limit->credit_ns > 1000000000U)
     {
-        Log1(PCSC_LOG_ERROR, "Failed to transmit data to ICC.");
-        return -1;
+        rate_limit->credit_ns = 1000000000U;
+    }
+    if (rate_limit->credit_ns < cost)
+    {
+        return false;
     }
+    rate_limit->credit_ns -= cost;
+    return true;
+}
 
-    if (swicc_net_recv(server_ctx.sock_client[slot_num], &msg_rx) !=
-        SWICC_RET_SUCCESS)
+/**
+ * @brief Get the logical channel number encoded in a class byte
+ * (ISO 7816-4:2020 sec.5.4.1).
+ * @param[in] cla
+ * @return Logical channel number.
+ */
+static uint8_t apdu_chan(uint8_t const cla)
+{
+    if ((cla & 0x40) == 0U)
     {
-        Log1(PCSC_LOG_ERROR, "Failed to receive data from ICC.");
-        return -1;
+        /* First interindustry values of CLA encode channels 0 to 3. */
+        return cla & 0x03;
     }
+    /* Further interindustry values of CLA encode channels 4 to 19. */
+    return (uint8_t)(4U + (cla & 0x0F));
+}
 
-    if (log_msg_enable)
+/**
+ * @brief Get the statistics of the client in a slot, allocating them when
+ * first needed.
+ * @param[in] slot_num
+ * @return Statistics, or NULL if they could not be allocated.
+ */
+static client_stats_st *client_stats(uint16_t const slot_num)
+{
+    if (client_icc[slot_num].stats == NULL)
     {
-        dbg_str_len = sizeof(dbg_str);
-        if (swicc_dbg_net_msg_str(dbg_str, &dbg_str_len, "RX:\n", &msg_rx) ==
-            SWICC_RET_SUCCESS)
+        client_stats_st *const stats = ifd_slab_alloc(&client_stats_slab);
+        if (stats == NULL)
         {
-            Log3(PCSC_LOG_DEBUG, "%.*s", dbg_str_len, dbg_str);
+            return NULL;
         }
-        else
+        for (uint8_t chan = 0U; chan < IFD_VENDOR_CHAN_COUNT_MAX; ++chan)
         {
-            Log1(PCSC_LOG_ERROR, "Failed to print RX message.");
+            stats->chan[chan].chan = chan;
         }
+        client_icc[slot_num].stats = stats;
     }
-
-    client_icc[slot_num].cont_icc = msg_rx.data.cont_state;
-    client_icc[slot_num].buf_len_exp = msg_rx.data.buf_len_exp;
-    return 0;
+    return client_icc[slot_num].stats;
 }
 
 /**
- * @brief Disconnect a client making sure to cleanup any state realted to it.
+ * @brief Close all logical channels except the basic channel and forget which
+ * files were selected. This is what happens to the ICC on reset.
  * @param[in] slot_num
+ * @param[in] stats_clear If the statistics shall be cleared too.
  */
-static void client_disconnect(uint16_t const slot_num)
+static void chan_reset(uint16_t const slot_num, bool const stats_clear)
 {
-    swicc_net_server_client_disconnect(&server_ctx, (uint16_t)slot_num);
-    client_icc[slot_num].atr_len = 0U;
-    client_icc[slot_num].cont_iface = 0U;
-    client_icc[slot_num].cont_icc = 0U;
+    client_icc[slot_num].chan_open = 1U;
+    client_stats_st *const stats = client_icc[slot_num].stats;
+    if (stats == NULL)
+    {
+        return;
+    }
+    if (stats_clear)
+    {
+        ifd_slab_free(&client_stats_slab, stats);
+        client_icc[slot_num].stats = NULL;
+        return;
+    }
+    for (uint8_t chan = 0U; chan < IFD_VENDOR_CHAN_COUNT_MAX; ++chan)
+    {
+        stats->chan[chan].sel_p1 = 0U;
+        stats->chan[chan].sel_len = 0U;
+    }
 }
 
 /**
- * @brief Perform an ICC powerup (cold reset with PPS exchange).
+ * @brief Start the response cache of a slot over after the ICC was reset, or
+ * drop it if caching was disabled.
  * @param[in] slot_num
- * @return 0 on success, -1 on failure.
  */
-static int32_t icc_powerup(uint16_t const slot_num)
+static void memo_reset(uint16_t const slot_num)
 {
-    /* All contact states are set to valid. */
-    msg_tx.data.cont_state = 0U;
-    msg_tx.data.ctrl = SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_Y;
-    msg_tx.data.buf_len_exp = 0U;
-    msg_tx.hdr.size = offsetof(swicc_net_msg_data_st, buf);
-
-    if (client_msg_io(slot_num, true) != 0 ||
-        msg_rx.data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    ifd_memo_st *memo = client_icc[slot_num].memo;
+    if (!atomic_load_explicit(&memo_enable[slot_num], memory_order_relaxed))
     {
-        return -1;
+        ifd_slab_free(&memo_slab, memo);
+        client_icc[slot_num].memo = NULL;
+        return;
     }
-
-    /**
-     * At this point the ICC has been mock initialized and the interface
-     * contacts shall be in the 'ready' state.
-     */
-    client_icc[slot_num].cont_iface = FSM_STATE_CONT_READY;
-
-    /**
-     * Make sure that the response contains an ATR (that's non-zero in length).
-     */
-    if (msg_rx.hdr.size <= offsetof(swicc_net_msg_data_st, buf))
+    if (memo == NULL)
     {
-        Log1(PCSC_LOG_ERROR, "ICC ATR is invalid.");
-        return -1;
+        memo = ifd_slab_alloc(&memo_slab);
+        if (memo == NULL)
+        {
+            return;
+        }
+        client_icc[slot_num].memo = memo;
     }
-    client_icc[slot_num].atr_len =
-        (uint32_t)(msg_rx.hdr.size - offsetof(swicc_net_msg_data_st, buf));
-    memcpy(client_icc[slot_num].atr, msg_rx.data.buf,
-           client_icc[slot_num].atr_len);
-    return 0;
+    ifd_memo_reset(memo);
 }
 
 /**
- * @brief The logger that is used with the swICC network module. This is used so
- * that the PC/SC-lite middleware logging utilities can be used.
+ * @brief Update the logical channel state and statistics after an APDU was
+ * exchanged with the ICC. This tracks MANAGE CHANNEL and SELECT commands.
+ * @param[in] slot_num
+ * @param[in] apdu Command APDU (at least a header).
+ * @param[in] apdu_len
+ * @param[in] rsp Response APDU (at least a status word).
+ * @param[in] rsp_len
+ * @param[in] io_ns How long the exchange took.
  */
-static swicc_net_logger_ft net_logger;
-static void net_logger(char const *const fmt, ...)
+static void chan_track(uint16_t const slot_num, uint8_t const *const apdu,
+                       uint32_t const apdu_len, uint8_t const *const rsp,
+                       uint32_t const rsp_len, uint64_t const io_ns)
 {
-#ifdef DEBUG
-    va_list argptr;
-    va_start(argptr, fmt);
-    log_msg(PCSC_LOG_DEBUG, fmt, argptr);
-    va_end(argptr);
-#endif
+    uint8_t const chan = apdu_chan(apdu[0U]);
+    client_stats_st *const stats = client_stats(slot_num);
+    if (chan >= IFD_VENDOR_CHAN_COUNT_MAX || stats == NULL)
+    {
+        return;
+    }
+    ifd_vendor_chan_stats_st *const chan_stats = &stats->chan[chan];
+    chan_stats->apdu_count += 1U;
+    chan_stats->tx_len += apdu_len;
+    chan_stats->rx_len += rsp_len;
+    chan_stats->io_ns += io_ns;
+
+    uint8_t const sw1 = rsp[rsp_len - 2U];
+    uint8_t const sw2 = rsp[rsp_len - 1U];
+    if (!((sw1 == 0x90 && sw2 == 0x00) || sw1 == 0x61))
+    {
+        return;
+    }
+    /* A command was accepted on this channel so it must be open. */
+    client_icc[slot_num].chan_open |= 1U << chan;
+
+    uint8_t const ins = apdu[1U];
+    uint8_t const p1 = apdu[2U];
+    uint8_t const p2 = apdu[3U];
+    if (ins == 0x70) /* MANAGE CHANNEL */
+    {
+        if (p1 == 0x00)
+        {
+            /* Opened channel is in P2, or in the response if P2 is 0. */
+            uint8_t const chan_new =
+                p2 != 0U ? p2 : (rsp_len == 3U ? rsp[0U] : 0U);
+            if (chan_new != 0U && chan_new < IFD_VENDOR_CHAN_COUNT_MAX)
+            {
+                client_icc[slot_num].chan_open |= 1U << chan_new;
+                stats->chan[chan_new].sel_p1 = 0U;
+                stats->chan[chan_new].sel_len = 0U;
+            }
+        }
+        else if (p1 == 0x80)
+        {
+            /* Closed channel is in P2, or in CLA if P2 is 0. */
+            uint8_t const chan_old = p2 != 0U ? p2 : chan;
+            if (chan_old != 0U && chan_old < IFD_VENDOR_CHAN_COUNT_MAX)
+            {
+                client_icc[slot_num].chan_open &= ~(1U << chan_old);
+            }
+        }
+    }
+    else if (ins == 0xA4) /* SELECT */
+    {
+        uint8_t const data_len = apdu_len > 5U ? apdu[4U] : 0U;
+        chan_stats->sel_p1 = p1;
+        chan_stats->sel_len = data_len < IFD_VENDOR_CHAN_SEL_LEN_MAX
+                                  ? data_len
+                                  : IFD_VENDOR_CHAN_SEL_LEN_MAX;
+        memcpy(chan_stats->sel, &apdu[5U], chan_stats->sel_len);
+    }
 }
 
 /**
- * @brief Check if ann ICC is present. This does not actually send any data to
- * the card, just relies on the most recent information (last keep-alive
- * message).
+ * @brief Get the trace level of a slot. This is cheap enough to be checked on
+ * every message.
  * @param[in] slot_num
- * @return true if present, false if not.
+ * @return Trace level (IFD_VENDOR_TRACE_*).
  */
-static bool icc_present(uint16_t const slot_num)
+static uint8_t slot_trace(uint16_t const slot_num)
 {
-    return server_ctx.sock_client[slot_num] >= 0;
+    return atomic_load_explicit(&trace_level[slot_num], memory_order_relaxed);
 }
 
 /**
- * @brief Check if the reader is present, i.e., if it has been initialized.
- * @return true if present, false if not.
+ * @brief Free what the message buffers of the exiting thread grew into.
+ * @param[in] arg Unused.
  */
-static bool reader_present()
+static void msg_thread_free(void *const arg)
 {
-    return server_ctx.sock_server >= 0;
+    ifd_msg_free(&msg_tx);
+    ifd_msg_free(&msg_rx);
+    ifd_msg_free(&msg_rx_spec);
 }
 
-RESPONSECODE IFDHCreateChannelByName(DWORD const Lun, LPSTR const DeviceName)
+/**
+ * @brief Create the key which frees the message buffers of a thread.
+ */
+static void msg_key_create(void)
 {
-    Log3(PCSC_LOG_DEBUG, "Lun=0x%04lX, DeviceName='%s'.", Lun, DeviceName);
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
-    {
-        return IFD_COMMUNICATION_ERROR;
-    }
-
-    if (strncmp(DeviceName, DIR_PCSC_DEV, strlen(DIR_PCSC_DEV)) != 0)
-    {
-        Log3(PCSC_LOG_ERROR, "Expected device '%s' but got DeviceName='%s'.",
-             DIR_PCSC_DEV, DeviceName);
-        return IFD_COMMUNICATION_ERROR;
-    }
-
-    /* Channel is ignored. */
-    return IFDHCreateChannel(Lun, 0U);
+    pthread_key_create(&msg_key, msg_thread_free);
 }
 
-RESPONSECODE IFDHControl(DWORD Lun, DWORD dwControlCode, PUCHAR TxBuffer,
-                         DWORD TxLength, PUCHAR RxBuffer, DWORD RxLength,
-                         LPDWORD pdwBytesReturned)
+/**
+ * @brief Set up the message buffers of the thread if it did not exchange
+ * messages before. Must be called by everything that runs on a thread of the
+ * PC/SC daemon or on a worker before it exchanges messages.
+ */
+static void msg_thread_init(void)
 {
-    Log9(PCSC_LOG_DEBUG,
-         "Lun=0x%04lX, dwControlCode=%lu, TxBuffer=%p, TxLength=%lu, "
-         "RxBuffer=%p, RxLength=%lu, pdwBytesReturned=%p.%c",
-         Lun, dwControlCode, TxBuffer, TxLength, RxBuffer, RxLength,
-         pdwBytesReturned, '\0');
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    if (msg_tx.msg != NULL)
     {
-        return IFD_COMMUNICATION_ERROR;
+        return;
     }
-
-    return IFD_ERROR_NOT_SUPPORTED;
+    ifd_msg_init(&msg_tx);
+    ifd_msg_init(&msg_rx);
+    ifd_msg_init(&msg_rx_spec);
+    pthread_once(&msg_key_once, msg_key_create);
+    pthread_setspecific(msg_key, &msg_tx);
 }
 
-RESPONSECODE IFDHCreateChannel(DWORD Lun, DWORD Channel)
+/**
+ * @brief Create the key which frees the long trace buffer of a thread.
+ */
+static void dbg_str_long_key_create(void)
 {
-    /* Channel is ignored. */
-    Log3(PCSC_LOG_DEBUG, "Lun=0x%04lX, Channel=%lu.", Lun, Channel);
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
-    {
-        return IFD_COMMUNICATION_ERROR;
-    }
+    pthread_key_create(&dbg_str_long_key, free);
+}
 
-    if (!reader_present())
+/**
+ * @brief Get a trace buffer of the thread.
+ * @param[in] len How long the buffer must be, at most IFD_DBG_STR_LEN_MAX.
+ * @return Buffer, or NULL if it could not be allocated.
+ */
+static char *dbg_str_get(uint32_t const len)
+{
+    if (len <= sizeof(dbg_str))
     {
-        /* Initialize the server context. */
-        server_ctx.sock_server = -1;
-        for (uint16_t client_sock_idx = 0U;
-             client_sock_idx < IFD_SLOT_COUNT_MAX; ++client_sock_idx)
-        {
-            server_ctx.sock_client[client_sock_idx] = -1;
-        }
-
-        /* Use the PC/SC-lite logging functions. */
-        swicc_net_logger_register(net_logger);
-
-        if (swicc_net_server_create(&server_ctx, IFD_SERVER_PORT_STR) !=
-            SWICC_RET_SUCCESS)
-        {
-            return IFD_COMMUNICATION_ERROR;
-        }
+        return dbg_str;
     }
-    else
+    if (dbg_str_long == NULL)
     {
-        if (icc_present(slot_num))
+        pthread_once(&dbg_str_long_key_once, dbg_str_long_key_create);
+        dbg_str_long = malloc(IFD_DBG_STR_LEN_MAX);
+        if (dbg_str_long != NULL)
         {
-            /* Already present. */
-            return IFD_COMMUNICATION_ERROR;
+            pthread_setspecific(dbg_str_long_key, dbg_str_long);
         }
     }
-
-    return IFD_SUCCESS;
+    return dbg_str_long;
 }
 
-RESPONSECODE IFDHCloseChannel(DWORD Lun)
+/**
+ * @brief Log data in hex when tracing.
+ * @param[in] slot_num
+ * @param[in] prefix
+ * @param[in] data
+ * @param[in] data_len
+ * @param[in] io_ns How long the exchange took, or 0 if not known.
+ */
+static void slot_trace_data(uint16_t const slot_num, char const *const prefix,
+                            uint8_t const *const data, uint32_t const data_len,
+                            uint64_t const io_ns)
 {
-    Log2(PCSC_LOG_DEBUG, "Lun=0x%04lX.", Lun);
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    static char const hex[] = "0123456789ABCDEF";
+    uint32_t const hex_len_max = (IFD_DBG_STR_LEN_MAX - 1U) / 2U;
+    uint32_t const hex_len = data_len < hex_len_max ? data_len : hex_len_max;
+    char *const str = dbg_str_get(hex_len * 2U + 1U);
+    if (str == NULL)
     {
-        return IFD_COMMUNICATION_ERROR;
+        return;
     }
-
-    /* Destroying channel 0 leads to destruction of the whole reader. */
-    if (reader_present())
+    for (uint32_t data_i = 0U; data_i < hex_len; ++data_i)
     {
-        /**
-         * @warning This assumes that slot 0 will be destroyed first.
-         */
-        if (slot_num == 0)
-        {
-            swicc_net_server_destroy(&server_ctx);
-        }
-        else
-        {
-            swicc_net_server_client_disconnect(&server_ctx, slot_num);
-        }
+        str[data_i * 2U] = hex[data[data_i] >> 4U];
+        str[data_i * 2U + 1U] = hex[data[data_i] & 0x0FU];
     }
-    return IFD_SUCCESS;
+    str[hex_len * 2U] = '\0';
+    Log5(PCSC_LOG_INFO, "Slot %u %s %s (%luns).", slot_num, prefix, str,
+         io_ns);
 }
 
-RESPONSECODE IFDHGetCapabilities(DWORD Lun, DWORD Tag, PDWORD Length,
-                                 PUCHAR Value)
+/**
+ * @brief Log a message when tracing.
+ * @param[in] prefix
+ * @param[in] msg
+ */
+static void client_msg_log(char const *const prefix,
+                           swicc_net_msg_st const *const msg)
 {
-    Log5(PCSC_LOG_DEBUG, "Lun=0x%04lX, Tag=0x%04lX, Length=%p, Value=%p.", Lun,
-         Tag, Length, Value);
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    /* Short messages fit the inline buffer, the rest is tried again. */
+    uint16_t str_len = sizeof(dbg_str);
+    if (swicc_dbg_net_msg_str(dbg_str, &str_len, prefix, msg) ==
+        SWICC_RET_SUCCESS)
     {
-        return IFD_COMMUNICATION_ERROR;
+        Log3(PCSC_LOG_INFO, "%.*s", str_len, dbg_str);
+        return;
     }
-
-    if (!reader_present())
+    char *const str = dbg_str_get(IFD_DBG_STR_LEN_MAX);
+    str_len = IFD_DBG_STR_LEN_MAX;
+    if (str != NULL && swicc_dbg_net_msg_str(str, &str_len, prefix, msg) ==
+                           SWICC_RET_SUCCESS)
     {
-        return IFD_NO_SUCH_DEVICE;
+        Log3(PCSC_LOG_INFO, "%.*s", str_len, str);
     }
-
-    switch (Tag)
+    else
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to print %.2s message.", prefix);
+    }
+}
+
+/**
+ * @brief Check if an ICC waits in the listen queue.
+ * @param[in] sock_server
+ * @return true if an ICC is waiting, false if not.
+ */
+static bool sock_io_pending(int32_t const sock_server)
+{
+    struct pollfd pfd = {.fd = sock_server, .events = POLLIN};
+    return poll(&pfd, 1U, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+/**
+ * @brief Accept an ICC from the listen queue.
+ * @param[in] sock_server
+ * @return Socket of the ICC on success, -1 on failure.
+ */
+static int32_t sock_io_accept(int32_t const sock_server)
+{
+    return accept(sock_server, NULL, NULL);
+}
+
+/**
+ * @brief Close the socket of an ICC.
+ * @param[in] sock
+ */
+static void sock_io_close(int32_t const sock)
+{
+    close(sock);
+}
+
+/* I/O with the ICCs over sockets, which is the default. */
+static ifd_io_st const sock_io = {.send = ifd_wire_send,
+                                  .recv = ifd_wire_recv,
+                                  .pending = sock_io_pending,
+                                  .accept = sock_io_accept,
+                                  .close = sock_io_close};
+
+/**
+ * I/O with the ICCs which is used from when the reader is created, and what
+ * stands in for the listening socket if it is not the default.
+ */
+static ifd_io_st const *icc_io = &sock_io;
+static int32_t icc_io_sock_server = -1;
+
+void ifd_io_set(ifd_io_st const *const io, int32_t const sock_server)
+{
+    pthread_mutex_lock(&reader_lock);
+    icc_io = io != NULL ? io : &sock_io;
+    icc_io_sock_server = io != NULL ? sock_server : -1;
+    pthread_mutex_unlock(&reader_lock);
+}
+
+/**
+ * @brief Receive a message from the ICC in a slot into the RX message.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_wire_recv(uint16_t const slot_num)
+{
+    return icc_io->recv(server_ctx.sock_client[slot_num],
+                        &client_icc[slot_num].wire, &msg_rx);
+}
+
+/**
+ * @brief Act on an event that the ICC told about, which is in the RX message.
+ * @param[in] slot_num
+ */
+static void client_event(uint16_t const slot_num)
+{
+    /* Safe cast since the swICC net functions validated the message. */
+    uint32_t const buf_len =
+        (uint32_t)(msg_rx.msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    ++client_icc[slot_num].event_count;
+    if (buf_len < 1U)
+    {
+        return;
+    }
+
+    uint32_t busy_ms = 0U;
+    switch (msg_rx.msg->data.buf[0U])
+    {
+    case IFD_NET_EVENT_EXIT:
+        Log2(PCSC_LOG_INFO, "ICC in slot %u is exiting.", slot_num);
+        client_icc[slot_num].exiting = true;
+        break;
+    case IFD_NET_EVENT_RELOAD:
+        Log2(PCSC_LOG_INFO, "ICC in slot %u reloaded its file system.",
+             slot_num);
+        atomic_store_explicit(&slot_reload[slot_num], true,
+                              memory_order_relaxed);
+        break;
+    case IFD_NET_EVENT_BUSY:
+        if (buf_len >= 5U)
+        {
+            busy_ms = (uint32_t)msg_rx.msg->data.buf[1U] << 24U |
+                      (uint32_t)msg_rx.msg->data.buf[2U] << 16U |
+                      (uint32_t)msg_rx.msg->data.buf[3U] << 8U |
+                      msg_rx.msg->data.buf[4U];
+            client_icc[slot_num].busy_until_ns =
+                ifd_clock_ns() + (uint64_t)busy_ms * 1000000U;
+            Log3(PCSC_LOG_DEBUG, "ICC in slot %u is busy for %ums.", slot_num,
+                 busy_ms);
+        }
+        break;
+    case IFD_NET_EVENT_GEN:
+        if (buf_len >= 5U && client_icc[slot_num].memo != NULL)
+        {
+            uint32_t const gen = (uint32_t)msg_rx.msg->data.buf[1U] << 24U |
+                                 (uint32_t)msg_rx.msg->data.buf[2U] << 16U |
+                                 (uint32_t)msg_rx.msg->data.buf[3U] << 8U |
+                                 msg_rx.msg->data.buf[4U];
+            if (ifd_memo_gen_set(client_icc[slot_num].memo, gen))
+            {
+                Log3(PCSC_LOG_DEBUG,
+                     "ICC in slot %u changed its files (generation %u).",
+                     slot_num, gen);
+            }
+        }
+        break;
+    default:
+        Log3(PCSC_LOG_DEBUG, "ICC in slot %u sent an unknown event 0x%02X.",
+             slot_num, msg_rx.msg->data.buf[0U]);
+        break;
+    }
+}
+
+/**
+ * @brief Note that a message was received, and act on it if it is an event.
+ * @param[in] slot_num
+ * @return true if the message was an event, false if not.
+ */
+static bool client_msg_event(uint16_t const slot_num)
+{
+    if ((client_icc[slot_num].features & IFD_NET_FEATURE_EVENT) == 0U)
+    {
+        return false;
+    }
+    client_icc[slot_num].rx_last_ns = ifd_clock_ns();
+    if (msg_rx.msg->data.ctrl != IFD_NET_MSG_CTRL_EVENT)
+    {
+        return false;
+    }
+    client_event(slot_num);
+    return true;
+}
+
+/**
+ * @brief Wait for the reply to a keep-alive of a presence sweep which the ICC
+ * in a slot did not give in time, so it is not taken for the reply to what is
+ * sent next.
+ * @param[in] slot_num
+ * @return 0 on success or if no reply is outstanding, -1 on failure.
+ */
+static int32_t client_keepalive_collect(uint16_t const slot_num)
+{
+    if (client_icc[slot_num].keepalive_sent_ns == 0U)
+    {
+        return 0;
+    }
+    client_icc[slot_num].keepalive_sent_ns = 0U;
+    do
+    {
+        if (client_wire_recv(slot_num) != 0)
+        {
+            return -1;
+        }
+        if (slot_trace(slot_num) >= IFD_VENDOR_TRACE_MSG)
+        {
+            client_msg_log("RX:\n", msg_rx.msg);
+        }
+    } while (client_msg_event(slot_num));
+    client_icc[slot_num].cont_icc = msg_rx.msg->data.cont_state;
+    client_icc[slot_num].buf_len_exp = msg_rx.msg->data.buf_len_exp;
+    return msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS ? 0 : -1;
+}
+
+/**
+ * @brief Send the TX message.
+ * @param[in] slot_num Communicate with the card in a given slot.
+ * @param[in] log_msg_enable If the message should be logged.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_msg_send(uint16_t const slot_num,
+                               bool const log_msg_enable)
+{
+    if (log_msg_enable && slot_trace(slot_num) >= IFD_VENDOR_TRACE_MSG)
+    {
+        client_msg_log("TX:\n", msg_tx.msg);
+    }
+
+    if (client_keepalive_collect(slot_num) != 0)
+    {
+        Log1(PCSC_LOG_ERROR, "ICC failed a keep-alive it replied to late.");
+        return -1;
+    }
+
+    IFD_PROBE3(msg_send, slot_num, msg_tx.msg->data.ctrl, msg_tx.msg->hdr.size);
+    int32_t const ret = icc_io->send(server_ctx.sock_client[slot_num],
+                                     &client_icc[slot_num].wire, msg_tx.msg);
+    IFD_PROBE2(msg_send_return, slot_num, ret);
+    if (ret != 0)
+    {
+        Log1(PCSC_LOG_ERROR, "Failed to transmit data to ICC.");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receive a message into the RX message.
+ * @param[in] slot_num Communicate with the card in a given slot.
+ * @param[in] log_msg_enable If the message should be logged.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_msg_recv(uint16_t const slot_num,
+                               bool const log_msg_enable)
+{
+    /* Events can come in at any time so they are skipped over. */
+    do
+    {
+        IFD_PROBE1(msg_recv, slot_num);
+        int32_t const ret = client_wire_recv(slot_num);
+        IFD_PROBE4(msg_recv_return, slot_num, msg_rx.msg->data.ctrl,
+                   msg_rx.msg->hdr.size, ret);
+        if (ret != 0)
+        {
+            Log1(PCSC_LOG_ERROR, "Failed to receive data from ICC.");
+            return -1;
+        }
+
+        if (log_msg_enable && slot_trace(slot_num) >= IFD_VENDOR_TRACE_MSG)
+        {
+            client_msg_log("RX:\n", msg_rx.msg);
+        }
+    } while (client_msg_event(slot_num));
+
+    client_icc[slot_num].cont_icc = msg_rx.msg->data.cont_state;
+    client_icc[slot_num].buf_len_exp = msg_rx.msg->data.buf_len_exp;
+    return 0;
+}
+
+/**
+ * @brief Send the TX message, and receive the response into the RX message.
+ * @param[in] slot_num Communicate with the card in a given slot.
+ * @param[in] log_msg_enable If the exchange should be logged.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_msg_io(uint16_t const slot_num, bool const log_msg_enable)
+{
+    if (client_msg_send(slot_num, log_msg_enable) != 0 ||
+        client_msg_recv(slot_num, log_msg_enable) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Forget everything about the ICC in a slot, making sure to cleanup any
+ * state related to it.
+ * @param[in] slot_num
+ */
+static void client_clear(uint16_t const slot_num)
+{
+    client_icc[slot_num].atr_len = 0U;
+    memset(&client_icc[slot_num].atr_info, 0U,
+           sizeof(client_icc[slot_num].atr_info));
+    client_icc[slot_num].apdu_len_max = 0U;
+    client_icc[slot_num].proto = 0U;
+    client_icc[slot_num].pwr_down = false;
+    client_icc[slot_num].cont_iface = 0U;
+    client_icc[slot_num].cont_icc = 0U;
+    chan_reset(slot_num, true);
+    memset(&client_icc[slot_num].apdu_rate_limit, 0U,
+           sizeof(client_icc[slot_num].apdu_rate_limit));
+    client_icc[slot_num].apdu_throttle_count = 0U;
+    client_icc[slot_num].resume_token_set = false;
+    client_icc[slot_num].resume_deadline_ns = 0U;
+    ifd_wire_reset(&client_icc[slot_num].wire);
+    client_icc[slot_num].features = 0U;
+    client_icc[slot_num].apdu_count = 0U;
+    client_icc[slot_num].apdu_lat_ns_sum = 0U;
+    client_icc[slot_num].apdu_lat_ns_max = 0U;
+    client_icc[slot_num].exiting = false;
+    client_icc[slot_num].busy_until_ns = 0U;
+    client_icc[slot_num].rx_last_ns = 0U;
+    client_icc[slot_num].event_count = 0U;
+    client_icc[slot_num].keepalive_skip_count = 0U;
+    ifd_slab_free(&memo_slab, client_icc[slot_num].memo);
+    client_icc[slot_num].memo = NULL;
+    client_icc[slot_num].memo_hit_count = 0U;
+    client_icc[slot_num].memo_miss_count = 0U;
+    client_icc[slot_num].memo_saved_ns = 0U;
+    client_icc[slot_num].presence_alive = false;
+    client_icc[slot_num].presence_ns = 0U;
+    atomic_store_explicit(&slot_reload[slot_num], false, memory_order_relaxed);
+}
+
+/**
+ * @brief Close the connection of the ICC in a slot.
+ * @param[in] slot_num
+ */
+static void server_client_disconnect(uint16_t const slot_num)
+{
+    icc_io->close(server_ctx.sock_client[slot_num]);
+    server_ctx.sock_client[slot_num] = -1;
+    /* A reply that was not collected went away with the connection. */
+    client_icc[slot_num].keepalive_sent_ns = 0U;
+}
+
+/**
+ * @brief Disconnect a client. If the ICC can resume its session and did not say
+ * that it is going away, the slot and the state of the ICC are held for it
+ * until the grace period ends, otherwise all state related to it is cleaned
+ * up.
+ * @param[in] slot_num
+ */
+static void client_disconnect(uint16_t const slot_num)
+{
+    ifd_worker_stop(&slot_worker[slot_num]);
+    server_client_disconnect(slot_num);
+    if (cfg.resume_grace_ms > 0U && client_icc[slot_num].resume_token_set &&
+        !client_icc[slot_num].exiting)
+    {
+        Log2(PCSC_LOG_INFO, "Holding slot %u for the ICC to reconnect.",
+             slot_num);
+        client_icc[slot_num].resume_deadline_ns =
+            ifd_clock_ns() + (uint64_t)cfg.resume_grace_ms * 1000000U;
+        return;
+    }
+    client_clear(slot_num);
+}
+
+/**
+ * @brief Check if a slot is held for a disconnected ICC.
+ * @param[in] slot_num
+ * @return true if held, false if not.
+ */
+static bool slot_held(uint16_t const slot_num)
+{
+    return server_ctx.sock_client[slot_num] < 0 &&
+           client_icc[slot_num].resume_deadline_ns != 0U;
+}
+
+/**
+ * @brief Check if a slot is free, i.e., if a new ICC can be connected to it.
+ * @param[in] slot_num
+ * @return true if free, false if not.
+ */
+static bool slot_free(uint16_t const slot_num)
+{
+    return server_ctx.sock_client[slot_num] < 0 && !slot_held(slot_num);
+}
+
+/**
+ * @brief Start impairing the connection of a slot if the network impairment is
+ * enabled.
+ * @param[in] slot_num
+ */
+static void client_impair_attach(uint16_t const slot_num)
+{
+    if (!ifd_impair_enabled(&cfg.impair))
+    {
+        client_icc[slot_num].wire.impair = NULL;
+        return;
+    }
+    ifd_impair_init(&client_icc[slot_num].impair, &cfg.impair, slot_num);
+    client_icc[slot_num].wire.impair = &client_icc[slot_num].impair;
+}
+
+/**
+ * @brief Give the ICC a new token with which it can later resume its session.
+ * ICCs which don't support session resumption just don't get one.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_resume_token_set(uint16_t const slot_num)
+{
+    client_icc[slot_num].resume_token_set = false;
+    if (getrandom(client_icc[slot_num].resume_token, IFD_RESUME_TOKEN_LEN,
+                  0U) != IFD_RESUME_TOKEN_LEN)
+    {
+        Log1(PCSC_LOG_ERROR, "Failed to generate a resumption token.");
+        return 0;
+    }
+
+    msg_tx.msg->data.cont_state = client_icc[slot_num].cont_iface;
+    msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_RESUME_TOKEN_SET;
+    msg_tx.msg->data.buf_len_exp = 0U;
+    memcpy(msg_tx.msg->data.buf, client_icc[slot_num].resume_token,
+           IFD_RESUME_TOKEN_LEN);
+    msg_tx.msg->hdr.size =
+        offsetof(swicc_net_msg_data_st, buf) + IFD_RESUME_TOKEN_LEN;
+    if (client_msg_io(slot_num, true) != 0)
+    {
+        return -1;
+    }
+    client_icc[slot_num].resume_token_set =
+        msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS;
+    return 0;
+}
+
+/**
+ * @brief Agree on a wire format and optional features with a newly connected
+ * ICC. ICCs which don't support the negotiation keep using version 1 without
+ * any optional features.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_wire_negotiate(uint16_t const slot_num)
+{
+    ifd_wire_reset(&client_icc[slot_num].wire);
+    client_icc[slot_num].features = 0U;
+    uint8_t const features =
+        (uint8_t)((cfg.pipeline ? IFD_NET_FEATURE_PIPELINE : 0U) |
+                  (cfg.batch ? IFD_NET_FEATURE_BATCH : 0U) |
+                  (cfg.events ? IFD_NET_FEATURE_EVENT : 0U));
+    if (cfg.wire_version_max <= IFD_WIRE_VERSION_1 && features == 0U)
+    {
+        return 0;
+    }
+
+    memset(&msg_tx.msg->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_WIRE_VERSION;
+    msg_tx.msg->data.buf[0U] = cfg.wire_version_max;
+    msg_tx.msg->data.buf[1U] = features;
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 2U;
+    if (client_msg_io(slot_num, true) != 0)
+    {
+        return -1;
+    }
+    uint32_t const msg_rx_buf_len =
+        (uint32_t)(msg_rx.msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    if (msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS &&
+        msg_rx_buf_len >= 1U &&
+        msg_rx.msg->data.buf[0U] >= IFD_WIRE_VERSION_1 &&
+        msg_rx.msg->data.buf[0U] <= cfg.wire_version_max)
+    {
+        /* Features are optional in the answer. */
+        if (msg_rx_buf_len >= 2U)
+        {
+            client_icc[slot_num].features =
+                msg_rx.msg->data.buf[1U] & features;
+        }
+        ifd_wire_version_set(&client_icc[slot_num].wire,
+                             msg_rx.msg->data.buf[0U]);
+    }
+    Log4(PCSC_LOG_DEBUG,
+         "Slot %u uses wire format version %u and features 0x%02X.",
+         slot_num, client_icc[slot_num].wire.version,
+         client_icc[slot_num].features);
+    return 0;
+}
+
+/**
+ * @brief Check if any slot is held for a disconnected ICC.
+ * @return true if one is, false if none.
+ */
+static bool slot_held_any(void)
+{
+    for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    {
+        if (slot_held(slot_i))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Find the held slot of the session which the reply of an ICC to
+ * IFD_NET_MSG_CTRL_RESUME_TOKEN_GET (in the RX message) resumes.
+ * @return The held slot, or IFD_SLOT_COUNT_MAX if the ICC starts a new session.
+ */
+static uint16_t client_resume_find(void)
+{
+    if (msg_rx.msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS ||
+        msg_rx.msg->hdr.size !=
+            offsetof(swicc_net_msg_data_st, buf) + IFD_RESUME_TOKEN_LEN)
+    {
+        return IFD_SLOT_COUNT_MAX;
+    }
+    for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    {
+        if (slot_held(slot_i) &&
+            memcmp(msg_rx.msg->data.buf, client_icc[slot_i].resume_token,
+                   IFD_RESUME_TOKEN_LEN) == 0)
+        {
+            return slot_i;
+        }
+    }
+    return IFD_SLOT_COUNT_MAX;
+}
+
+/**
+ * @brief Ask a newly connected ICC if it resumes the session of an ICC whose
+ * slot is held. If so, its connection is moved to the held slot which then
+ * carries on with the cached ATR and interface state.
+ * @param[in] slot_num Slot of the newly connected ICC.
+ * @return true if the ICC stays in the given slot, false if it was moved or
+ * disconnected.
+ */
+static bool client_resume(uint16_t const slot_num)
+{
+    if (!slot_held_any())
+    {
+        return true;
+    }
+
+    memset(&msg_tx.msg->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_RESUME_TOKEN_GET;
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+    if (client_msg_io(slot_num, true) != 0)
+    {
+        client_disconnect(slot_num);
+        return false;
+    }
+    uint16_t const slot_i = client_resume_find();
+    if (slot_i == IFD_SLOT_COUNT_MAX)
+    {
+        /* A new session. */
+        return true;
+    }
+
+    /* The PC/SC daemon may be calling into the held slot right now. */
+    pthread_mutex_lock(&slot_lock[slot_i]);
+    Log3(PCSC_LOG_INFO, "ICC resumed its session in slot %u from %u.", slot_i,
+         slot_num);
+    server_ctx.sock_client[slot_i] = server_ctx.sock_client[slot_num];
+    server_ctx.sock_client[slot_num] = -1;
+    client_icc[slot_i].resume_deadline_ns = 0U;
+    /* The wire format was negotiated on the new connection. */
+    client_icc[slot_i].wire = client_icc[slot_num].wire;
+    client_icc[slot_i].features = client_icc[slot_num].features;
+    client_icc[slot_i].exiting = false;
+    client_icc[slot_i].busy_until_ns = 0U;
+    client_impair_attach(slot_i);
+    pthread_mutex_unlock(&slot_lock[slot_i]);
+    ifd_wire_reset(&client_icc[slot_num].wire);
+    client_icc[slot_num].features = 0U;
+    return false;
+}
+
+/**
+ * @brief Send a mock reset to the ICC and receive its ATR.
+ * @param[in] slot_num
+ * @param[in] ctrl Which kind of mock reset to perform.
+ * @return 0 on success, -1 on failure.
+ * @note On success, the ATR is in the RX message.
+ */
+static int32_t icc_reset(uint16_t const slot_num,
+                         swicc_net_msg_ctrl_et const ctrl)
+{
+    /* All contact states are set to valid. */
+    msg_tx.msg->data.cont_state = 0U;
+    msg_tx.msg->data.ctrl = ctrl;
+    msg_tx.msg->data.buf_len_exp = 0U;
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+
+    /* Nothing is known about the ICC in case the reset fails half way. */
+    if (client_icc[slot_num].memo != NULL)
+    {
+        ifd_memo_invalidate(client_icc[slot_num].memo);
+    }
+    if (client_msg_io(slot_num, true) != 0 ||
+        msg_rx.msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return -1;
+    }
+
+    /**
+     * At this point the ICC has been mock reset and the interface contacts
+     * shall be in the 'ready' state.
+     */
+    client_icc[slot_num].cont_iface = FSM_STATE_CONT_READY;
+    chan_reset(slot_num, false);
+    memo_reset(slot_num);
+
+    /**
+     * Make sure that the response contains an ATR (that's non-zero in length).
+     */
+    if (msg_rx.msg->hdr.size <= offsetof(swicc_net_msg_data_st, buf) ||
+        msg_rx.msg->hdr.size - offsetof(swicc_net_msg_data_st, buf) >
+            MAX_ATR_SIZE)
+    {
+        Log1(PCSC_LOG_ERROR, "ICC ATR is invalid.");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Enable TCP keepalive on a client socket so that the kernel detects
+ * dead peers without any traffic from the handler.
+ * @param[in] slot_num
+ */
+static void client_sock_keepalive(uint16_t const slot_num)
+{
+    int32_t const sock = server_ctx.sock_client[slot_num];
+    int const enable = 1;
+    int const keepidle = IFD_SOCK_KEEPIDLE_S;
+    int const keepintvl = IFD_SOCK_KEEPINTVL_S;
+    int const keepcnt = IFD_SOCK_KEEPCNT;
+    unsigned int const user_timeout = IFD_SOCK_USER_TIMEOUT_MS;
+    if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) !=
+            0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle,
+                   sizeof(keepidle)) != 0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl,
+                   sizeof(keepintvl)) != 0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt,
+                   sizeof(keepcnt)) != 0 ||
+        setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout,
+                   sizeof(user_timeout)) != 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to enable TCP keepalive: %s.",
+             strerror(errno));
+    }
+}
+
+/**
+ * @brief Check if the ICCs connect over TCP sockets, which can be tuned.
+ * @return true if they do, false if not.
+ */
+static bool client_sock_tcp(void)
+{
+    return cfg.transport == IFD_TRANSPORT_TCP && !sock_server_io;
+}
+
+/**
+ * @brief Apply the configured socket options to a newly connected client.
+ * Socket buffer sizes are inherited from the listening socket.
+ * @param[in] slot_num
+ */
+static void client_sock_tune(uint16_t const slot_num)
+{
+    if (!client_sock_tcp())
+    {
+        return;
+    }
+    int32_t const sock = server_ctx.sock_client[slot_num];
+    int const nodelay = cfg.nodelay ? 1 : 0;
+    /* Safe cast since the busy poll time is limited to INT32_MAX. */
+    int const busy_poll = (int)cfg.busy_poll;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                   sizeof(nodelay)) != 0 ||
+        (busy_poll > 0 && setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL,
+                                     &busy_poll, sizeof(busy_poll)) != 0))
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to tune client socket: %s.",
+             strerror(errno));
+    }
+}
+
+/**
+ * @brief Find a listening socket which was passed to the PC/SC daemon, either
+ * with 'listen_fd' or through socket activation (see sd_listen_fds(3)) under
+ * the name IFD_LISTEN_FD_NAME. The transport is set to match the socket.
+ * @return The socket, or -1 if there is none.
+ */
+static int32_t server_sock_inherited(void)
+{
+    int sock = -1;
+    if (cfg.listen_fd > 0U)
+    {
+        /* Safe cast since the fd is limited to INT32_MAX. */
+        sock = (int)cfg.listen_fd;
+    }
+    else
+    {
+        char const *const pid_str = getenv("LISTEN_PID");
+        char const *const fds_str = getenv("LISTEN_FDS");
+        char const *name = getenv("LISTEN_FDNAMES");
+        if (pid_str == NULL || fds_str == NULL || name == NULL ||
+            strtol(pid_str, NULL, 10) != getpid())
+        {
+            return -1;
+        }
+        /* Names are separated by colons, in the same order as the fds. */
+        long const fd_count = strtol(fds_str, NULL, 10);
+        for (long fd_i = 0; fd_i < fd_count && name != NULL; ++fd_i)
+        {
+            size_t const name_len = strcspn(name, ":");
+            if (name_len == strlen(IFD_LISTEN_FD_NAME) &&
+                strncmp(name, IFD_LISTEN_FD_NAME, name_len) == 0)
+            {
+                /* Safe cast since the fd number is small. */
+                sock = IFD_LISTEN_FDS_START + (int)fd_i;
+                break;
+            }
+            name = name[name_len] == ':' ? &name[name_len + 1U] : NULL;
+        }
+        if (sock < 0)
+        {
+            return -1;
+        }
+    }
+
+    int accepting = 0;
+    socklen_t accepting_len = sizeof(accepting);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockopt(sock, SOL_SOCKET, SO_ACCEPTCONN, &accepting,
+                   &accepting_len) != 0 ||
+        accepting == 0 ||
+        getsockname(sock, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Inherited fd %d is not a listening socket.",
+             sock);
+        return -1;
+    }
+    cfg.transport =
+        addr.ss_family == AF_UNIX ? IFD_TRANSPORT_UNIX : IFD_TRANSPORT_TCP;
+    return sock;
+}
+
+/**
+ * @brief Create the socket on which ICCs connect, as configured.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t server_listen(void)
+{
+    if (icc_io_sock_server >= 0)
+    {
+        Log1(PCSC_LOG_INFO, "Using the listening socket of installed I/O.");
+        server_ctx.sock_server = icc_io_sock_server;
+        sock_server_inherited = false;
+        sock_server_io = true;
+        return 0;
+    }
+
+    int32_t const sock_inherited = server_sock_inherited();
+    if (sock_inherited >= 0)
+    {
+        Log2(PCSC_LOG_INFO, "Using inherited listening socket %d.",
+             sock_inherited);
+        server_ctx.sock_server = sock_inherited;
+        sock_server_inherited = true;
+        sock_server_io = false;
+        return 0;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int family;
+    memset(&addr, 0U, sizeof(addr));
+    if (cfg.transport == IFD_TRANSPORT_UNIX)
+    {
+        struct sockaddr_un *const addr_un = (struct sockaddr_un *)&addr;
+        addr_un->sun_family = AF_UNIX;
+        memcpy(addr_un->sun_path, cfg.path, sizeof(cfg.path));
+        addr_len = sizeof(*addr_un);
+        family = AF_UNIX;
+        /* A socket file left behind by a previous run blocks the bind. */
+        unlink(cfg.path);
+    }
+    else
+    {
+        struct addrinfo const hints = {.ai_family = AF_UNSPEC,
+                                       .ai_socktype = SOCK_STREAM,
+                                       .ai_flags = AI_PASSIVE};
+        struct addrinfo *info;
+        int const ret = getaddrinfo(cfg.host[0U] == '\0' ? NULL : cfg.host,
+                                    cfg.port, &hints, &info);
+        if (ret != 0)
+        {
+            Log3(PCSC_LOG_ERROR, "Failed to resolve '%s': %s.", cfg.host,
+                 gai_strerror(ret));
+            return -1;
+        }
+        memcpy(&addr, info->ai_addr, info->ai_addrlen);
+        addr_len = info->ai_addrlen;
+        family = info->ai_family;
+        freeaddrinfo(info);
+    }
+
+    int const sock = socket(family, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to create server socket: %s.",
+             strerror(errno));
+        return -1;
+    }
+    int const reuseaddr = 1;
+    int const reuseport = cfg.reuseport ? 1 : 0;
+    /* Safe casts since the buffer sizes are limited to INT32_MAX. */
+    int const rcvbuf = (int)cfg.rcvbuf;
+    int const sndbuf = (int)cfg.sndbuf;
+    int const backlog = (int)cfg.backlog;
+    if ((family != AF_UNIX &&
+         setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr,
+                    sizeof(reuseaddr)) != 0) ||
+        (reuseport > 0 && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                                     &reuseport, sizeof(reuseport)) != 0) ||
+        (rcvbuf > 0 &&
+         setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) !=
+             0) ||
+        (sndbuf > 0 &&
+         setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) !=
+             0) ||
+        bind(sock, (struct sockaddr *)&addr, addr_len) != 0 ||
+        listen(sock, backlog) != 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to set up server socket: %s.",
+             strerror(errno));
+        close(sock);
+        return -1;
+    }
+    server_ctx.sock_server = sock;
+    sock_server_inherited = false;
+    sock_server_io = false;
+    return 0;
+}
+
+/**
+ * @brief Close the listening socket, unless it was inherited or came with the
+ * I/O.
+ */
+static void server_listen_close(void)
+{
+    if (sock_server_inherited)
+    {
+        /* It's kept for when the reader gets created again. */
+        return;
+    }
+    if (sock_server_io)
+    {
+        /* Whoever installed the I/O owns the socket. */
+        server_ctx.sock_server = -1;
+        sock_server_io = false;
+        return;
+    }
+    close(server_ctx.sock_server);
+    server_ctx.sock_server = -1;
+    if (cfg.transport == IFD_TRANSPORT_UNIX)
+    {
+        unlink(cfg.path);
+    }
+}
+
+/**
+ * @brief Disconnect all clients and close the listening socket.
+ */
+static void server_close(void)
+{
+    for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    {
+        ifd_worker_stop(&slot_worker[slot_i]);
+        if (server_ctx.sock_client[slot_i] >= 0)
+        {
+            server_client_disconnect(slot_i);
+        }
+        client_clear(slot_i);
+    }
+    server_listen_close();
+}
+
+/**
+ * @brief Check if the listening socket has to be created again for a new
+ * configuration.
+ * @param[in] cfg_prev Configuration the listening socket was created with.
+ * @return true if the listening socket is configured the same, false if not.
+ */
+static bool server_listen_cfg_eq(ifd_cfg_st const *const cfg_prev)
+{
+    return cfg.transport == cfg_prev->transport &&
+           strcmp(cfg.host, cfg_prev->host) == 0 &&
+           strcmp(cfg.port, cfg_prev->port) == 0 &&
+           strcmp(cfg.path, cfg_prev->path) == 0 &&
+           cfg.backlog == cfg_prev->backlog &&
+           cfg.reuseport == cfg_prev->reuseport &&
+           cfg.listen_fd == cfg_prev->listen_fd &&
+           cfg.rcvbuf == cfg_prev->rcvbuf && cfg.sndbuf == cfg_prev->sndbuf;
+}
+
+/**
+ * @brief Check if the PC/SC daemon has any channel open, i.e., if the reader
+ * exists.
+ * @return true if any channel is open, false if none.
+ */
+static bool slot_chan_open_any(void)
+{
+    for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    {
+        if (slot_chan_open[slot_i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check if a client socket is still alive without sending anything on
+ * it. Only pending errors, a hang-up, or an orderly shutdown by the peer are
+ * treated as a dead socket.
+ * @param[in] slot_num
+ * @return true if alive, false if not.
+ */
+static bool client_sock_alive(uint16_t const slot_num)
+{
+    int32_t const sock = server_ctx.sock_client[slot_num];
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    if (poll(&pfd, 1U, 0) < 0)
+    {
+        return errno == EINTR;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+        return false;
+    }
+
+    int sock_err = 0;
+    socklen_t sock_err_len = sizeof(sock_err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &sock_err, &sock_err_len) !=
+            0 ||
+        sock_err != 0)
+    {
+        return false;
+    }
+
+    if (pfd.revents & POLLIN)
+    {
+        /* Reading 0 bytes means the peer has shut down the connection. */
+        uint8_t byte;
+        if (recv(sock, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Act on the events which the ICC sent since it was last heard from,
+ * without waiting for more.
+ * @param[in] slot_num
+ * @return 0 on success, -1 if the connection was lost or the ICC sent
+ * something other than an event.
+ */
+static int32_t client_events_drain(uint16_t const slot_num)
+{
+    struct pollfd pfd = {.fd = server_ctx.sock_client[slot_num],
+                         .events = POLLIN};
+    while (poll(&pfd, 1U, 0) > 0)
+    {
+        if (pfd.revents & (POLLERR | POLLNVAL) ||
+            client_wire_recv(slot_num) != 0)
+        {
+            return -1;
+        }
+        if (slot_trace(slot_num) >= IFD_VENDOR_TRACE_MSG)
+        {
+            client_msg_log("RX:\n", msg_rx.msg);
+        }
+        if (!client_msg_event(slot_num))
+        {
+            Log1(PCSC_LOG_ERROR, "ICC sent a message without being asked.");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check if it can be told whether the ICC in a slot is alive without
+ * exchanging a keep-alive with it, the way the configuration says. An ICC which
+ * sends events is only asked when it was quiet for a while.
+ * @param[in] slot_num
+ * @param[out] alive Whether the ICC is alive, if it could be told.
+ * @return true if it could be told, false if a keep-alive has to be exchanged.
+ */
+static bool client_alive_known(uint16_t const slot_num, bool *const alive)
+{
+    if (client_keepalive_collect(slot_num) != 0)
+    {
+        Log1(PCSC_LOG_INFO, "Client keep-alive failed.");
+        *alive = false;
+        return true;
+    }
+    if ((client_icc[slot_num].features & IFD_NET_FEATURE_EVENT) != 0U)
+    {
+        if (client_events_drain(slot_num) != 0 || client_icc[slot_num].exiting)
+        {
+            Log1(PCSC_LOG_INFO, "Client went away.");
+            *alive = false;
+            return true;
+        }
+        uint64_t const now = ifd_clock_ns();
+        if (now < client_icc[slot_num].busy_until_ns ||
+            now - client_icc[slot_num].rx_last_ns <
+                (uint64_t)cfg.keepalive_ms * 1000000U)
+        {
+            ++client_icc[slot_num].keepalive_skip_count;
+            *alive = true;
+            return true;
+        }
+    }
+
+    if (cfg.liveness == IFD_LIVENESS_SOCK)
+    {
+        *alive = client_sock_alive(slot_num);
+        if (!*alive)
+        {
+            Log1(PCSC_LOG_INFO, "Client socket is dead.");
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Create a keep-alive message for the ICC in a slot in the TX message.
+ * @param[in] slot_num
+ */
+static void client_keepalive_msg(uint16_t const slot_num)
+{
+    memset(&msg_tx.msg->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx.msg->data.cont_state = client_icc[slot_num].cont_iface;
+    msg_tx.msg->data.ctrl = SWICC_NET_MSG_CTRL_KEEPALIVE;
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+}
+
+/**
+ * @brief Check if the ICC in a slot is alive, the way the configuration says.
+ * @param[in] slot_num
+ * @return true if alive, false if not.
+ */
+static bool client_alive(uint16_t const slot_num)
+{
+    bool alive;
+    if (client_alive_known(slot_num, &alive))
+    {
+        return alive;
+    }
+
+    /* Send a keep-alive message to ICC to see if it's still connected. */
+    client_keepalive_msg(slot_num);
+    if (client_msg_io(slot_num, false) == 0 &&
+        msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return true;
+    }
+
+    /* Sending or receiving errors are treated as a missing ICC. */
+    Log1(PCSC_LOG_INFO, "Client keep-alive failed.");
+    return false;
+}
+
+/**
+ * @brief Check all occupied slots at once and keep the results for presence
+ * checks. Keep-alives are first sent to every ICC which needs one, then the
+ * replies are collected as they come in with one poll over all of them, so a
+ * sweep takes about one round trip however many ICCs there are. A sweep waits
+ * for at most 'keepalive_ms'. ICCs which did not reply by then are taken to be
+ * alive until their reply comes in, which later sweeps wait for without sending
+ * another keep-alive, or until they have not replied for
+ * 'IFD_SWEEP_REPLY_KEEPALIVE_MAX' times 'keepalive_ms'. Slots with a worker are
+ * checked by it, and slots busy with an exchange keep their last result, so
+ * the sweep only does I/O on sockets whose slot lock it holds.
+ */
+static void presence_sweep(void)
+{
+    struct pollfd pfd[IFD_SLOT_COUNT_MAX];
+    uint16_t pfd_slot[IFD_SLOT_COUNT_MAX];
+    nfds_t pfd_count = 0U;
+
+    uint64_t const start = ifd_clock_ns();
+    uint64_t const reply_wait_max_ns = (uint64_t)cfg.keepalive_ms *
+                                       IFD_SWEEP_REPLY_KEEPALIVE_MAX * 1000000U;
+    for (uint16_t slot_i = 0U; slot_i < cfg.slot_count; ++slot_i)
+    {
+        /**
+         * Empty and held slots have no ICC to ask. The worker of a slot does
+         * its I/O without taking the slot lock, and a slot whose lock is taken
+         * is in the middle of an exchange, so both are left alone.
+         */
+        if (server_ctx.sock_client[slot_i] < 0 || slot_worker[slot_i].running ||
+            pthread_mutex_trylock(&slot_lock[slot_i]) != 0)
+        {
+            continue;
+        }
+        client_icc[slot_i].presence_ns = start;
+        uint64_t const sent_ns = client_icc[slot_i].keepalive_sent_ns;
+        if (sent_ns != 0U)
+        {
+            if (start - sent_ns >= reply_wait_max_ns)
+            {
+                Log1(PCSC_LOG_INFO, "Client keep-alive timed out.");
+                client_icc[slot_i].presence_alive = false;
+                pthread_mutex_unlock(&slot_lock[slot_i]);
+                continue;
+            }
+        }
+        else if (client_alive_known(slot_i,
+                                    &client_icc[slot_i].presence_alive))
+        {
+            pthread_mutex_unlock(&slot_lock[slot_i]);
+            continue;
+        }
+        else
+        {
+            client_keepalive_msg(slot_i);
+            if (client_msg_send(slot_i, false) != 0)
+            {
+                Log1(PCSC_LOG_INFO, "Client keep-alive failed.");
+                client_icc[slot_i].presence_alive = false;
+                pthread_mutex_unlock(&slot_lock[slot_i]);
+                continue;
+            }
+            client_icc[slot_i].keepalive_sent_ns = start;
+            ++reader_stats.sweep_keepalive_count;
+        }
+        client_icc[slot_i].presence_alive = true;
+        pfd[pfd_count].fd = server_ctx.sock_client[slot_i];
+        pfd[pfd_count].events = POLLIN;
+        pfd[pfd_count].revents = 0;
+        pfd_slot[pfd_count] = slot_i;
+        ++pfd_count;
+    }
+    ++reader_stats.sweep_count;
+
+    /* Done slots get a negative descriptor so the poll skips them. */
+    uint64_t const deadline = start + (uint64_t)cfg.keepalive_ms * 1000000U;
+    nfds_t pending = pfd_count;
+    while (pending > 0U)
+    {
+        uint64_t const now = ifd_clock_ns();
+        if (now >= deadline)
+        {
+            break;
+        }
+        /* Safe cast since the timeout is at most 'keepalive_ms'. */
+        int const timeout_ms = (int)((deadline - now + 999999U) / 1000000U);
+        int const ready = poll(pfd, pfd_count, timeout_ms);
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= 0)
+        {
+            break;
+        }
+        for (nfds_t pfd_i = 0U; pfd_i < pfd_count; ++pfd_i)
+        {
+            if (pfd[pfd_i].fd < 0 || pfd[pfd_i].revents == 0)
+            {
+                continue;
+            }
+            uint16_t const slot_num = pfd_slot[pfd_i];
+            if (pfd[pfd_i].revents & (POLLERR | POLLNVAL) ||
+                client_wire_recv(slot_num) != 0)
+            {
+                Log1(PCSC_LOG_ERROR, "Failed to receive data from ICC.");
+                client_icc[slot_num].keepalive_sent_ns = 0U;
+                client_icc[slot_num].presence_alive = false;
+            }
+            else
+            {
+                if (slot_trace(slot_num) >= IFD_VENDOR_TRACE_MSG)
+                {
+                    client_msg_log("RX:\n", msg_rx.msg);
+                }
+                /* Events can come in before the reply so they are skipped. */
+                if (client_msg_event(slot_num))
+                {
+                    continue;
+                }
+                client_icc[slot_num].keepalive_sent_ns = 0U;
+                client_icc[slot_num].cont_icc = msg_rx.msg->data.cont_state;
+                client_icc[slot_num].buf_len_exp = msg_rx.msg->data.buf_len_exp;
+                client_icc[slot_num].presence_alive =
+                    msg_rx.msg->data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS;
+            }
+            if (!client_icc[slot_num].presence_alive)
+            {
+                Log1(PCSC_LOG_INFO, "Client keep-alive failed.");
+            }
+            pfd[pfd_i].fd = -1;
+            --pending;
+            pthread_mutex_unlock(&slot_lock[slot_num]);
+        }
+    }
+    if (pending > 0U)
+    {
+        Log2(PCSC_LOG_INFO, "Sweep got no reply in time from %lu ICCs.",
+             (unsigned long)pending);
+        for (nfds_t pfd_i = 0U; pfd_i < pfd_count; ++pfd_i)
+        {
+            if (pfd[pfd_i].fd >= 0)
+            {
+                pthread_mutex_unlock(&slot_lock[pfd_slot[pfd_i]]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check if the ICC in a slot is alive using the results of the last
+ * presence sweep, and sweep again if they are too old.
+ * @param[in] slot_num
+ * @return true if alive, false if not.
+ */
+static bool presence_swept_alive(uint16_t const slot_num)
+{
+    if (ifd_clock_ns() - client_icc[slot_num].presence_ns >=
+        (uint64_t)cfg.presence_window_ms * 1000000U)
+    {
+        presence_sweep();
+    }
+    return client_icc[slot_num].presence_alive;
+}
+
+/**
+ * @brief Idle function of a slot worker which checks that its ICC is alive.
+ * Once the ICC is found dead, it is not checked again.
+ * @param[in] arg Slot number (uint16_t).
+ * @return 0.
+ */
+static int32_t slot_keepalive(void *const arg)
+{
+    msg_thread_init();
+    uint16_t const slot_num = *(uint16_t const *)arg;
+    if (atomic_load_explicit(&slot_alive[slot_num], memory_order_relaxed) &&
+        !client_alive(slot_num))
+    {
+        atomic_store_explicit(&slot_alive[slot_num], false,
+                              memory_order_relaxed);
+    }
+    return 0;
+}
+
+/**
+ * @brief Start the worker of a slot if it does not have one yet.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t slot_worker_start(uint16_t const slot_num)
+{
+    if (slot_worker[slot_num].running)
+    {
+        return 0;
+    }
+    slot_id[slot_num] = slot_num;
+    atomic_store_explicit(&slot_alive[slot_num], true, memory_order_relaxed);
+    if (ifd_worker_start(&slot_worker[slot_num], slot_keepalive,
+                         &slot_id[slot_num], cfg.keepalive_ms) != 0)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to start the worker of slot %u.",
+             slot_num);
+        return -1;
+    }
+    Log2(PCSC_LOG_DEBUG, "Started the worker of slot %u.", slot_num);
+    return 0;
+}
+
+/**
+ * @brief Get the number of occupied slots, which includes held slots.
+ * @return Number of slots of the reader with a connected client.
+ */
+static uint16_t slot_active_count(void)
+{
+    uint16_t count = 0U;
+    for (uint16_t slot_i = 0U; slot_i < cfg.slot_count; ++slot_i)
+    {
+        if (!slot_free(slot_i))
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Check if a client is waiting in the listen queue.
+ * @return true if a client is waiting, false if not.
+ */
+static bool client_pending(void)
+{
+    return icc_io->pending(server_ctx.sock_server);
+}
+
+/**
+ * @brief Set up the connection of a client that was just connected to a slot:
+ * socket options, network impairment, and the wire format.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t client_setup(uint16_t const slot_num)
+{
+    ++reader_stats.accept_count;
+    client_sock_tune(slot_num);
+    client_impair_attach(slot_num);
+    if (cfg.liveness == IFD_LIVENESS_SOCK && client_sock_tcp())
+    {
+        client_sock_keepalive(slot_num);
+    }
+    return client_wire_negotiate(slot_num);
+}
+
+/**
+ * @brief Limit for how long a receive on a socket waits for data.
+ * @param[in] sock
+ * @param[in] timeout_ms 0 means it waits for as long as it takes.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t sock_rcvtimeo_set(int32_t const sock, uint32_t const timeout_ms)
+{
+    struct timeval const timeout = {
+        .tv_sec = (time_t)(timeout_ms / 1000U),
+        .tv_usec = (suseconds_t)((timeout_ms % 1000U) * 1000U)};
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) !=
+        0)
+    {
+        Log2(PCSC_LOG_ERROR, "Failed to set receive timeout: %s.",
+             strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Accept a client from the listen queue for which there is no free
+ * slot, or which is over the active slot limit. An ICC which resumes its
+ * session gets its held slot back, since that slot was counted as occupied all
+ * along. Any other client is told that the reader is busy, and then the
+ * connection is closed.
+ */
+static void client_overflow(void)
+{
+    int32_t const sock = icc_io->accept(server_ctx.sock_server);
+    if (sock < 0)
+    {
+        return;
+    }
+    /* Nothing was negotiated on the connection yet. */
+    ifd_wire_st wire = {0U};
+    ifd_wire_reset(&wire);
+    memset(&msg_tx.msg->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+    if (slot_held_any())
+    {
+        /**
+         * This runs in presence checks with the reader locked, so a client
+         * which does not answer in time is dropped instead of waited for.
+         */
+        msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_RESUME_TOKEN_GET;
+        if (sock_rcvtimeo_set(sock, cfg.keepalive_ms) != 0 ||
+            icc_io->send(sock, &wire, msg_tx.msg) != 0 ||
+            icc_io->recv(sock, &wire, &msg_rx) != 0)
+        {
+            Log1(PCSC_LOG_INFO, "Client did not send its resume token.");
+            icc_io->close(sock);
+            return;
+        }
+        uint16_t const slot_num = client_resume_find();
+        if (slot_num != IFD_SLOT_COUNT_MAX)
+        {
+            /* Slots wait for their ICCs for as long as it takes. */
+            if (sock_rcvtimeo_set(sock, 0U) != 0)
+            {
+                icc_io->close(sock);
+                return;
+            }
+            Log2(PCSC_LOG_INFO, "ICC resumed its session in slot %u.",
+                 slot_num);
+            /* The PC/SC daemon may be calling into the held slot right now. */
+            pthread_mutex_lock(&slot_lock[slot_num]);
+            server_ctx.sock_client[slot_num] = sock;
+            client_icc[slot_num].resume_deadline_ns = 0U;
+            client_icc[slot_num].exiting = false;
+            client_icc[slot_num].busy_until_ns = 0U;
+            if (client_setup(slot_num) != 0)
+            {
+                client_disconnect(slot_num);
+            }
+            pthread_mutex_unlock(&slot_lock[slot_num]);
+            return;
+        }
+    }
+
+    msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_BUSY;
+    if (icc_io->send(sock, &wire, msg_tx.msg) != 0)
+    {
+        Log1(PCSC_LOG_ERROR, "Failed to tell client that reader is busy.");
+    }
+    icc_io->close(sock);
+    ++reader_stats.reject_busy_count;
+}
+
+/**
+ * @brief Connect a client waiting in the listen queue to a slot.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t server_client_connect(uint16_t const slot_num)
+{
+    int32_t const sock = icc_io->accept(server_ctx.sock_server);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    server_ctx.sock_client[slot_num] = sock;
+    return 0;
+}
+
+/**
+ * @brief Decide if a client waiting in the listen queue may be connected to a
+ * slot. Clients over the active slot limit are handled by client_overflow.
+ * Clients over the accept rate limit stay in the listen queue.
+ * @return true if a client may be connected, false if not.
+ */
+static bool client_admit(void)
+{
+    if (slot_active_count() >= cfg.slot_active_max)
+    {
+        if (client_pending())
+        {
+            client_overflow();
+        }
+        return false;
+    }
+    if (!client_pending())
+    {
+        return false;
+    }
+    if (!rate_limit_take(&accept_rate_limit, cfg.accept_rate))
+    {
+        ++reader_stats.accept_defer_count;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Update the reader statistics which are sampled on request.
+ */
+static void reader_stats_update(void)
+{
+    reader_stats.slot_active = slot_active_count();
+    reader_stats.slot_active_max = cfg.slot_active_max;
+
+    /**
+     * For a listening socket, the kernel reports the accept queue length and
+     * the backlog in these fields of TCP info.
+     */
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    if (getsockopt(server_ctx.sock_server, IPPROTO_TCP, TCP_INFO, &info,
+                   &info_len) == 0)
+    {
+        reader_stats.accept_queue_len = info.tcpi_unacked;
+        reader_stats.accept_queue_max = info.tcpi_sacked;
+    }
+
+    reader_stats.apdu_throttle_count = 0U;
+    for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    {
+        reader_stats.apdu_throttle_count +=
+            client_icc[slot_i].apdu_throttle_count;
+    }
+}
+
+/**
+ * @brief Perform an ICC powerup (cold reset with PPS exchange).
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t icc_powerup(uint16_t const slot_num)
+{
+    /* A cold reset discards the protocol that was negotiated before. */
+    client_icc[slot_num].atr_len = 0U;
+    client_icc[slot_num].proto = 0U;
+    client_icc[slot_num].pwr_down = false;
+    if (icc_reset(slot_num, SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_Y) != 0)
+    {
+        return -1;
+    }
+
+    uint32_t const atr_len =
+        (uint32_t)(msg_rx.msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    if (ifd_atr_parse(msg_rx.msg->data.buf, atr_len,
+                      &client_icc[slot_num].atr_info) != 0)
+    {
+        Log1(PCSC_LOG_ERROR, "ICC ATR is malformed.");
+        return -1;
+    }
+    client_icc[slot_num].apdu_len_max =
+        IFD_MSG_BUF_LEN_MAX < IFD_APDU_LEN_MAX ? IFD_MSG_BUF_LEN_MAX
+                                                   : IFD_APDU_LEN_MAX;
+    client_icc[slot_num].atr_len = atr_len;
+    memcpy(client_icc[slot_num].atr, msg_rx.msg->data.buf, atr_len);
+
+    if (cfg.resume_grace_ms > 0U)
+    {
+        return client_resume_token_set(slot_num);
+    }
+    return 0;
+}
+
+/**
+ * @brief Perform a reset which skips the PPS exchange. The cached ATR and the
+ * negotiated protocol are kept when the ICC answers with the same ATR as
+ * before. If the ICC was never powered up, the ATR changed, or the reset
+ * failed, this falls back to a cold reset with PPS exchange.
+ * @param[in] slot_num
+ * @param[in] ctrl Either a warm reset or a cold reset without PPS exchange.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t icc_reset_fast(uint16_t const slot_num,
+                              swicc_net_msg_ctrl_et const ctrl)
+{
+    if (client_icc[slot_num].atr_len > 0U && icc_reset(slot_num, ctrl) == 0)
+    {
+        uint32_t const atr_len = (uint32_t)(msg_rx.msg->hdr.size -
+                                            offsetof(swicc_net_msg_data_st,
+                                                     buf));
+        if (atr_len == client_icc[slot_num].atr_len &&
+            memcmp(msg_rx.msg->data.buf, client_icc[slot_num].atr,
+                   atr_len) == 0)
+        {
+            client_icc[slot_num].pwr_down = false;
+            return 0;
+        }
+        Log1(PCSC_LOG_INFO, "ICC ATR changed on reset, doing cold reset.");
+    }
+    return icc_powerup(slot_num);
+}
+
+/**
+ * @brief Power down the ICC. The ICC is told that it may free or suspend its
+ * state. The ATR stays cached so that the next power-up can be checked against
+ * it instead of doing a full cold reset with PPS exchange.
+ * @param[in] slot_num
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t icc_powerdown(uint16_t const slot_num)
+{
+    msg_tx.msg->data.cont_state = client_icc[slot_num].cont_iface;
+    msg_tx.msg->data.ctrl = IFD_NET_MSG_CTRL_POWER_DOWN;
+    msg_tx.msg->data.buf_len_exp = 0U;
+    msg_tx.msg->hdr.size = offsetof(swicc_net_msg_data_st, buf);
+
+    if (client_msg_io(slot_num, true) != 0)
+    {
+        return -1;
+    }
+    if (msg_rx.msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        /* The ICC keeps its state but is still treated as powered down. */
+        Log1(PCSC_LOG_DEBUG, "ICC does not support power-down.");
+    }
+
+    client_icc[slot_num].pwr_down = true;
+    client_icc[slot_num].cont_iface = 0U;
+    return 0;
+}
+
+/**
+ * @brief The logger that is used with the swICC network module. This is used so
+ * that the PC/SC-lite middleware logging utilities can be used.
+ */
+static swicc_net_logger_ft net_logger;
+static void net_logger(char const *const fmt, ...)
+{
+#ifdef DEBUG
+    va_list argptr;
+    va_start(argptr, fmt);
+    log_msg(PCSC_LOG_DEBUG, fmt, argptr);
+    va_end(argptr);
+#endif
+}
+
+/**
+ * @brief Check if ann ICC is present. This does not actually send any data to
+ * the card, just relies on the most recent information (last keep-alive
+ * message).
+ * @param[in] slot_num
+ * @return true if present, false if not.
+ */
+static bool icc_present(uint16_t const slot_num)
+{
+    return server_ctx.sock_client[slot_num] >= 0;
+}
+
+/**
+ * @brief Check if the reader is present, i.e., if it has been initialized.
+ * @return true if present, false if not.
+ */
+static bool reader_present()
+{
+    return server_ctx.sock_server >= 0;
+}
+
+/**
+ * @brief Send the TX message to an ICC. Used by the TPDU state machine.
+ * @param[in] ctx Pointer to the slot number.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t tpdu_msg_send(void *const ctx)
+{
+    return client_msg_send(*(uint16_t const *)ctx, true);
+}
+
+/**
+ * @brief Receive the RX message from an ICC. Used by the TPDU state machine.
+ * @param[in] ctx Pointer to the slot number.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t tpdu_msg_recv(void *const ctx)
+{
+    return client_msg_recv(*(uint16_t const *)ctx, true);
+}
+
+/**
+ * @brief Check if the ICC is powered up, i.e., if the capabilities cached on
+ * power-up are valid.
+ * @param[in] slot_num
+ * @return true if powered up, false if not.
+ */
+static bool icc_powered(uint16_t const slot_num)
+{
+    return icc_present(slot_num) && client_icc[slot_num].atr_len > 0U &&
+           !client_icc[slot_num].pwr_down;
+}
+
+/**
+ * @brief Give back a capability value.
+ * @param[in, out] Length Size of the value buffer, gets set to the length of
+ * the capability value.
+ * @param[out] Value
+ * @param[in] cap Capability value.
+ * @param[in] cap_len Length of the capability value.
+ * @return IFD_SUCCESS on success, IFD_ERROR_INSUFFICIENT_BUFFER if the value
+ * does not fit.
+ */
+static RESPONSECODE cap_get(PDWORD const Length, PUCHAR const Value,
+                            void const *const cap, uint32_t const cap_len)
+{
+    if (*Length < cap_len)
+    {
+        return IFD_ERROR_INSUFFICIENT_BUFFER;
+    }
+    memcpy(Value, cap, cap_len);
+    *Length = cap_len;
+    return IFD_SUCCESS;
+}
+
+/**
+ * @brief Give back a DWORD capability value (encoded as a 32-bit integer in
+ * host byte order).
+ * @param[in, out] Length
+ * @param[out] Value
+ * @param[in] cap
+ * @return Same as cap_get.
+ */
+static RESPONSECODE cap_get_dword(PDWORD const Length, PUCHAR const Value,
+                                  uint32_t const cap)
+{
+    return cap_get(Length, Value, &cap, sizeof(cap));
+}
+
+/**
+ * @brief Give back a BYTE capability value.
+ * @param[in, out] Length
+ * @param[out] Value
+ * @param[in] cap
+ * @return Same as cap_get.
+ */
+static RESPONSECODE cap_get_byte(PDWORD const Length, PUCHAR const Value,
+                                 uint8_t const cap)
+{
+    return cap_get(Length, Value, &cap, sizeof(cap));
+}
+
+/**
+ * @brief Create a channel, and the reader along with the first channel.
+ * @param[in] slot_num
+ * @param[in] device_name DEVICENAME of the reader, or NULL if not known.
+ * @return Same as IFDHCreateChannel.
+ */
+static RESPONSECODE channel_create(uint16_t const slot_num,
+                                   char const *const device_name)
+{
+    if (slot_chan_open[slot_num])
+    {
+        /* Already open. */
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    if (!slot_chan_open_any())
+    {
+        /**
+         * The reader is being created. If it existed before, the listening
+         * socket and the connected ICCs may have been kept, and then they only
+         * get attached to the new reader.
+         */
+        bool const attach = reader_present();
+        ifd_cfg_st const cfg_prev = cfg;
+        if (!attach)
+        {
+            /* Initialize the server context. */
+            server_ctx.sock_server = -1;
+            for (uint16_t client_sock_idx = 0U;
+                 client_sock_idx < IFD_SLOT_COUNT_MAX; ++client_sock_idx)
+            {
+                server_ctx.sock_client[client_sock_idx] = -1;
+            }
+
+            /* Use the PC/SC-lite logging functions. */
+            swicc_net_logger_register(net_logger);
+        }
+
+        if (ifd_cfg_load(&cfg, IFD_SERVER_PORT_STR, device_name,
+                         DIR_PCSC_DEV) != 0)
+        {
+            cfg = cfg_prev;
+            return IFD_COMMUNICATION_ERROR;
+        }
+        if (ifd_clock_virtual() && cfg.workers)
+        {
+            /* Workers wait in real time so they would break determinism. */
+            Log1(PCSC_LOG_INFO, "Workers are not used in virtual time.");
+            cfg.workers = false;
+        }
+        if (attach)
+        {
+            if (sock_server_inherited)
+            {
+                /* The transport comes from the socket, not the config. */
+                cfg.transport = cfg_prev.transport;
+            }
+            else if (!server_listen_cfg_eq(&cfg_prev))
+            {
+                Log1(PCSC_LOG_INFO, "Listening socket was reconfigured.");
+                ifd_cfg_st const cfg_new = cfg;
+                cfg = cfg_prev;
+                server_listen_close();
+                cfg = cfg_new;
+            }
+            Log2(PCSC_LOG_INFO, "Attaching %u connected ICCs to the reader.",
+                 slot_active_count());
+        }
+        if (!reader_present() && server_listen() != 0)
+        {
+            return IFD_COMMUNICATION_ERROR;
+        }
+        for (uint16_t slot_i = 0U; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+        {
+            if (!slot_prio_init &&
+                (ifd_prio_ent_init(&slot_prio[slot_i], cfg.prio_class,
+                                   cfg.prio_weight) != 0 ||
+                 pthread_mutex_init(&slot_lock[slot_i], NULL) != 0))
+            {
+                return IFD_COMMUNICATION_ERROR;
+            }
+            /* What was set at runtime only lasts as long as the ICCs. */
+            if (!attach)
+            {
+                slot_set[slot_i] = 0U;
+            }
+            if (!(slot_set[slot_i] & IFD_SLOT_SET_TRACE))
+            {
+                atomic_store_explicit(&trace_level[slot_i], cfg.trace,
+                                      memory_order_relaxed);
+            }
+            if (!(slot_set[slot_i] & IFD_SLOT_SET_MEMO))
+            {
+                atomic_store_explicit(&memo_enable[slot_i], cfg.memo,
+                                      memory_order_relaxed);
+            }
+            if (!(slot_set[slot_i] & IFD_SLOT_SET_PRIO))
+            {
+                ifd_prio_set(&prio_sched, &slot_prio[slot_i], cfg.prio_class,
+                             cfg.prio_weight);
+            }
+        }
+        slot_prio_init = true;
+        ifd_prio_concurrency_set(&prio_sched, cfg.sched_concurrency);
+    }
+
+    slot_chan_open[slot_num] = true;
+    return IFD_SUCCESS;
+}
+
+static RESPONSECODE ifdh_create_channel_by_name(DWORD const Lun,
+                                                LPSTR const DeviceName)
+{
+    Log3(PCSC_LOG_DEBUG, "Lun=0x%04lX, DeviceName='%s'.", Lun, DeviceName);
+
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    return channel_create(slot_num, DeviceName);
+}
+
+RESPONSECODE IFDHCreateChannelByName(DWORD const Lun, LPSTR const DeviceName)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHCreateChannelByName", Lun, 0U, 0U);
+    pthread_mutex_lock(&reader_lock);
+    RESPONSECODE const ret = ifdh_create_channel_by_name(Lun, DeviceName);
+    pthread_mutex_unlock(&reader_lock);
+    IFD_PROBE4(ifdh_return, "IFDHCreateChannelByName", Lun, ret, 0U);
+    return ret;
+}
+
+static RESPONSECODE ifdh_create_channel(DWORD Lun, DWORD Channel)
+{
+    /* Channel is ignored. */
+    Log3(PCSC_LOG_DEBUG, "Lun=0x%04lX, Channel=%lu.", Lun, Channel);
+
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    return channel_create(slot_num, NULL);
+}
+
+RESPONSECODE IFDHCreateChannel(DWORD Lun, DWORD Channel)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHCreateChannel", Lun, Channel, 0U);
+    pthread_mutex_lock(&reader_lock);
+    RESPONSECODE const ret = ifdh_create_channel(Lun, Channel);
+    pthread_mutex_unlock(&reader_lock);
+    IFD_PROBE4(ifdh_return, "IFDHCreateChannel", Lun, ret, 0U);
+    return ret;
+}
+
+static RESPONSECODE ifdh_close_channel(DWORD Lun)
+{
+    Log2(PCSC_LOG_DEBUG, "Lun=0x%04lX.", Lun);
+
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    if (!slot_chan_open[slot_num])
+    {
+        return IFD_SUCCESS;
+    }
+    slot_chan_open[slot_num] = false;
+
+    /**
+     * Slots can be closed in any order. The ICCs and the listening socket are
+     * either kept for the next reader, or closed along with the last slot.
+     */
+    if (cfg.persist)
+    {
+        if (!slot_chan_open_any())
+        {
+            Log2(PCSC_LOG_INFO, "Reader closed, keeping %u connected ICCs.",
+                 slot_active_count());
+        }
+    }
+    else if (reader_present())
+    {
+        ifd_worker_stop(&slot_worker[slot_num]);
+        if (icc_present(slot_num))
+        {
+            server_client_disconnect(slot_num);
+        }
+        client_clear(slot_num);
+        if (!slot_chan_open_any())
+        {
+            server_close();
+        }
+    }
+    return IFD_SUCCESS;
+}
+
+RESPONSECODE IFDHCloseChannel(DWORD Lun)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHCloseChannel", Lun, 0U, 0U);
+    pthread_mutex_lock(&reader_lock);
+    RESPONSECODE const ret = ifdh_close_channel(Lun);
+    pthread_mutex_unlock(&reader_lock);
+    IFD_PROBE4(ifdh_return, "IFDHCloseChannel", Lun, ret, 0U);
+    return ret;
+}
+
+static RESPONSECODE ifdh_get_capabilities(DWORD Lun, DWORD Tag, PDWORD Length,
+                                          PUCHAR Value)
+{
+    Log5(PCSC_LOG_DEBUG, "Lun=0x%04lX, Tag=0x%04lX, Length=%p, Value=%p.", Lun,
+         Tag, Length, Value);
+
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    if (!reader_present())
+    {
+        return IFD_NO_SUCH_DEVICE;
+    }
+
+    switch (Tag)
     {
     case TAG_IFD_ATR:
+    case SCARD_ATTR_ATR_STRING:
+        if (icc_powered(slot_num))
+        {
+            return cap_get(Length, Value, client_icc[slot_num].atr,
+                           client_icc[slot_num].atr_len);
+        }
+        return IFD_COMMUNICATION_ERROR;
+    case SCARD_ATTR_ICC_PRESENCE:
+        /* 0 = not present, 2 = present (PCSC3 v2.01.09 table.3-2). */
+        return cap_get_dword(Length, Value,
+                             icc_present(slot_num) || slot_held(slot_num)
+                                 ? 2U
+                                 : 0U);
+    case SCARD_ATTR_ICC_INTERFACE_STATUS:
+        /* 0 = contact inactive, 1 = contact active. */
+        return cap_get_dword(Length, Value, icc_powered(slot_num) ? 1U : 0U);
+    case SCARD_ATTR_ICC_TYPE_PER_ATR:
+        /* 1 = ISO 7816 asynchronous. */
+        return cap_get_dword(Length, Value, icc_powered(slot_num) ? 1U : 0U);
+    case SCARD_ATTR_POWER_MGMT_SUPPORT:
+        return cap_get_dword(Length, Value, 1U);
+    case SCARD_ATTR_PROTOCOL_TYPES:
+    case SCARD_ATTR_CURRENT_PROTOCOL_TYPE:
+    case SCARD_ATTR_CURRENT_F:
+    case SCARD_ATTR_CURRENT_D:
+    case SCARD_ATTR_CURRENT_N:
+    case SCARD_ATTR_CURRENT_IFSC:
+    case SCARD_ATTR_MAXINPUT:
+    case IFD_VENDOR_TAG_ICC_HIST:
+        if (!icc_powered(slot_num))
+        {
+            return IFD_COMMUNICATION_ERROR;
+        }
+        ifd_atr_st const *const atr_info = &client_icc[slot_num].atr_info;
+        switch (Tag)
+        {
+        case SCARD_ATTR_PROTOCOL_TYPES:
+            return cap_get_dword(Length, Value, atr_info->proto);
+        case SCARD_ATTR_CURRENT_PROTOCOL_TYPE:
+            return cap_get_dword(Length, Value, client_icc[slot_num].proto);
+        case SCARD_ATTR_CURRENT_F:
+            return cap_get_dword(Length, Value, ifd_atr_fi(atr_info->ta1));
+        case SCARD_ATTR_CURRENT_D:
+            return cap_get_dword(Length, Value, ifd_atr_di(atr_info->ta1));
+        case SCARD_ATTR_CURRENT_N:
+            return cap_get_dword(Length, Value, atr_info->tc1);
+        case SCARD_ATTR_CURRENT_IFSC:
+            return cap_get_dword(Length, Value, atr_info->ifsc);
+        case SCARD_ATTR_MAXINPUT:
+            return cap_get_dword(Length, Value,
+                                 client_icc[slot_num].apdu_len_max);
+        default: /* IFD_VENDOR_TAG_ICC_HIST */
+            return cap_get(Length, Value, atr_info->hist, atr_info->hist_len);
+        }
+    case IFD_VENDOR_TAG_CHAN_STATS:
         if (icc_present(slot_num))
         {
-            if (*Length < client_icc->atr_len)
+            uint32_t const chan_open = client_icc[slot_num].chan_open;
+            DWORD const stats_len = (DWORD)__builtin_popcount(chan_open) *
+                                    sizeof(ifd_vendor_chan_stats_st);
+            if (*Length < stats_len)
             {
                 return IFD_ERROR_INSUFFICIENT_BUFFER;
             }
-            memcpy(Value, client_icc->atr, client_icc->atr_len);
-            *Length = client_icc->atr_len;
+            client_stats_st const *const client_stats_cur =
+                client_icc[slot_num].stats;
+            uint32_t stats_count = 0U;
+            for (uint8_t chan = 0U; chan < IFD_VENDOR_CHAN_COUNT_MAX; ++chan)
+            {
+                if (!(chan_open & (1U << chan)))
+                {
+                    continue;
+                }
+                /**
+                 * The value can have any alignment, so each entry is built
+                 * here and then copied into it.
+                 */
+                ifd_vendor_chan_stats_st chan_stats;
+                if (client_stats_cur != NULL)
+                {
+                    chan_stats = client_stats_cur->chan[chan];
+                }
+                else
+                {
+                    /* Nothing was exchanged yet. */
+                    memset(&chan_stats, 0U, sizeof(chan_stats));
+                    chan_stats.chan = chan;
+                }
+                memcpy(&Value[stats_count * sizeof(chan_stats)], &chan_stats,
+                       sizeof(chan_stats));
+                ++stats_count;
+            }
+            *Length = stats_len;
             return IFD_SUCCESS;
         }
         return IFD_COMMUNICATION_ERROR;
+    case IFD_VENDOR_TAG_SLOT_STATS:
+        if (icc_present(slot_num))
+        {
+            static ifd_lat_hist_st const lat_hist_empty = {0U};
+            ifd_lat_hist_st const *const lat_hist =
+                client_icc[slot_num].stats != NULL
+                    ? &client_icc[slot_num].stats->apdu_lat_hist
+                    : &lat_hist_empty;
+            ifd_vendor_slot_stats_st slot_stats = {
+                .wire_version = client_icc[slot_num].wire.version,
+                .msg_tx_count = client_icc[slot_num].wire.tx_count,
+                .msg_rx_count = client_icc[slot_num].wire.rx_count,
+                .msg_tx_len = client_icc[slot_num].wire.tx_len,
+                .msg_rx_len = client_icc[slot_num].wire.rx_len,
+                .apdu_throttle_count = client_icc[slot_num].apdu_throttle_count,
+                .apdu_count = client_icc[slot_num].apdu_count,
+                .apdu_lat_ns_sum = client_icc[slot_num].apdu_lat_ns_sum,
+                .apdu_lat_ns_max = client_icc[slot_num].apdu_lat_ns_max,
+                .apdu_lat_ns_p99 = ifd_lat_hist_quantile(lat_hist, 990000U),
+                .apdu_lat_ns_p999 = ifd_lat_hist_quantile(lat_hist, 999000U),
+                .impair_delay_count = client_icc[slot_num].impair.delay_count,
+                .impair_partial_count =
+                    client_icc[slot_num].impair.partial_count,
+                .impair_reset_count = client_icc[slot_num].impair.reset_count,
+                .event_count = client_icc[slot_num].event_count,
+                .keepalive_skip_count =
+                    client_icc[slot_num].keepalive_skip_count,
+                .memo_hit_count = client_icc[slot_num].memo_hit_count,
+                .memo_miss_count = client_icc[slot_num].memo_miss_count,
+                .memo_saved_ns = client_icc[slot_num].memo_saved_ns,
+            };
+            return cap_get(Length, Value, &slot_stats, sizeof(slot_stats));
+        }
+        return IFD_COMMUNICATION_ERROR;
+    case IFD_VENDOR_TAG_TRACE_LEVEL:
+        return cap_get_byte(Length, Value, slot_trace(slot_num));
+    case IFD_VENDOR_TAG_MEMO:
+        return cap_get_byte(Length, Value,
+                            atomic_load_explicit(&memo_enable[slot_num],
+                                                 memory_order_relaxed)
+                                ? 1U
+                                : 0U);
+    case IFD_VENDOR_TAG_SLOT_PRIO: {
+        uint8_t prio_class;
+        uint16_t prio_weight;
+        ifd_prio_get(&prio_sched, &slot_prio[slot_num], &prio_class,
+                     &prio_weight);
+        uint8_t const prio[] = {prio_class, (uint8_t)(prio_weight >> 8U),
+                                (uint8_t)prio_weight};
+        return cap_get(Length, Value, prio, sizeof(prio));
+    }
+    case IFD_VENDOR_TAG_CLASS_STATS: {
+        ifd_vendor_class_stats_st stats[IFD_VENDOR_PRIO_CLASS_COUNT];
+        pthread_mutex_lock(&class_stats_lock);
+        for (uint8_t cls = 0U; cls < IFD_VENDOR_PRIO_CLASS_COUNT; ++cls)
+        {
+            stats[cls] = class_stats[cls];
+            stats[cls].cls = cls;
+            stats[cls].apdu_lat_ns_p99 =
+                ifd_lat_hist_quantile(&class_lat_hist[cls], 990000U);
+            stats[cls].apdu_lat_ns_p999 =
+                ifd_lat_hist_quantile(&class_lat_hist[cls], 999000U);
+        }
+        pthread_mutex_unlock(&class_stats_lock);
+        return cap_get(Length, Value, stats, sizeof(stats));
+    }
+    case IFD_VENDOR_TAG_READER_STATS:
+        reader_stats_update();
+        return cap_get(Length, Value, &reader_stats, sizeof(reader_stats));
     case TAG_IFD_SIMULTANEOUS_ACCESS:
         /* The driver can handle only 1 reader at any time. */
         Value[0U] = 1U;
@@ -370,12 +2731,16 @@ RESPONSECODE IFDHGetCapabilities(DWORD Lun, DWORD Tag, PDWORD Length,
         return IFD_SUCCESS;
     case TAG_IFD_SLOTS_NUMBER:
         /* Number of slots in this reader. */
-        Value[0U] = IFD_SLOT_COUNT_MAX;
+        /* Safe cast since the slot count is limited to what fits a byte. */
+        Value[0U] = (UCHAR)cfg.slot_count;
         Log2(PCSC_LOG_INFO, "Supported slot count per reader: %u.", Value[0U]);
         return IFD_SUCCESS;
     case TAG_IFD_SLOT_THREAD_SAFE:
-        /* Multiple slots can't be accessed simultaneously. */
-        Value[0U] = 0U;
+        /**
+         * Slots can be accessed simultaneously when each has its own worker,
+         * and then the scheduler decides which of them get to do I/O.
+         */
+        Value[0U] = cfg.workers ? 1U : 0U;
         Log2(PCSC_LOG_INFO, "Supporting thread-safe slots: %u.", Value[0U]);
         return IFD_SUCCESS;
     case TAG_IFD_STOP_POLLING_THREAD:
@@ -388,8 +2753,39 @@ RESPONSECODE IFDHGetCapabilities(DWORD Lun, DWORD Tag, PDWORD Length,
     }
 }
 
-RESPONSECODE IFDHSetCapabilities(DWORD Lun, DWORD Tag, DWORD Length,
+/**
+ * @brief Check if getting a capability touches more than its own slot, i.e.,
+ * the other slots or the configuration of the reader.
+ * @param[in] Tag
+ * @return true if it does, false if not.
+ */
+static bool cap_reader_wide(DWORD const Tag)
+{
+    return Tag == IFD_VENDOR_TAG_READER_STATS || Tag == TAG_IFD_SLOTS_NUMBER ||
+           Tag == TAG_IFD_SLOT_THREAD_SAFE;
+}
+
+RESPONSECODE IFDHGetCapabilities(DWORD Lun, DWORD Tag, PDWORD Length,
                                  PUCHAR Value)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHGetCapabilities", Lun, Tag, 0U);
+    /* The capabilities of a slot are only read by the thread of the slot. */
+    bool const lock = cap_reader_wide(Tag);
+    if (lock)
+    {
+        pthread_mutex_lock(&reader_lock);
+    }
+    RESPONSECODE const ret = ifdh_get_capabilities(Lun, Tag, Length, Value);
+    if (lock)
+    {
+        pthread_mutex_unlock(&reader_lock);
+    }
+    IFD_PROBE4(ifdh_return, "IFDHGetCapabilities", Lun, ret, *Length);
+    return ret;
+}
+
+static RESPONSECODE ifdh_set_capabilities(DWORD Lun, DWORD Tag, DWORD Length,
+                                          PUCHAR Value)
 {
     Log5(PCSC_LOG_DEBUG, "Lun=0x%04lX, Tag=0x%04lX, Length=%lu, Value=%p.", Lun,
          Tag, Length, Value);
@@ -403,13 +2799,65 @@ RESPONSECODE IFDHSetCapabilities(DWORD Lun, DWORD Tag, DWORD Length,
 
     switch (Tag)
     {
+    case IFD_VENDOR_TAG_TRACE_LEVEL:
+        if (Length != 1U || Value[0U] > IFD_VENDOR_TRACE_MSG)
+        {
+            return IFD_ERROR_SET_FAILURE;
+        }
+        atomic_store_explicit(&trace_level[slot_num], Value[0U],
+                              memory_order_relaxed);
+        slot_set[slot_num] |= IFD_SLOT_SET_TRACE;
+        Log3(PCSC_LOG_INFO, "Trace level of slot %u set to %u.", slot_num,
+             Value[0U]);
+        return IFD_SUCCESS;
+    case IFD_VENDOR_TAG_MEMO:
+        if (Length != 1U || Value[0U] > 1U)
+        {
+            return IFD_ERROR_SET_FAILURE;
+        }
+        atomic_store_explicit(&memo_enable[slot_num], Value[0U] != 0U,
+                              memory_order_relaxed);
+        slot_set[slot_num] |= IFD_SLOT_SET_MEMO;
+        Log3(PCSC_LOG_INFO, "Response cache of slot %u set to %u.", slot_num,
+             Value[0U]);
+        return IFD_SUCCESS;
+    case IFD_VENDOR_TAG_SLOT_PRIO: {
+        if (Length != 3U || Value[0U] >= IFD_VENDOR_PRIO_CLASS_COUNT)
+        {
+            return IFD_ERROR_SET_FAILURE;
+        }
+        uint16_t const prio_weight =
+            (uint16_t)((uint16_t)(Value[1U] << 8U) | Value[2U]);
+        if (prio_weight < 1U || prio_weight > IFD_VENDOR_PRIO_WEIGHT_MAX)
+        {
+            return IFD_ERROR_SET_FAILURE;
+        }
+        ifd_prio_set(&prio_sched, &slot_prio[slot_num], Value[0U],
+                     prio_weight);
+        slot_set[slot_num] |= IFD_SLOT_SET_PRIO;
+        Log4(PCSC_LOG_INFO, "Priority of slot %u set to class %u weight %u.",
+             slot_num, Value[0U], prio_weight);
+        return IFD_SUCCESS;
+    }
     default:
         return IFD_ERROR_TAG;
     }
 }
 
-RESPONSECODE IFDHSetProtocolParameters(DWORD Lun, DWORD Protocol, UCHAR Flags,
-                                       UCHAR PTS1, UCHAR PTS2, UCHAR PTS3)
+RESPONSECODE IFDHSetCapabilities(DWORD Lun, DWORD Tag, DWORD Length,
+                                 PUCHAR Value)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHSetCapabilities", Lun, Tag, Length);
+    pthread_mutex_lock(&reader_lock);
+    RESPONSECODE const ret = ifdh_set_capabilities(Lun, Tag, Length, Value);
+    pthread_mutex_unlock(&reader_lock);
+    IFD_PROBE4(ifdh_return, "IFDHSetCapabilities", Lun, ret, 0U);
+    return ret;
+}
+
+static RESPONSECODE ifdh_set_protocol_parameters(DWORD Lun, DWORD Protocol,
+                                                 UCHAR Flags, UCHAR PTS1,
+                                                 UCHAR PTS2, UCHAR PTS3)
 {
     Log9(PCSC_LOG_DEBUG,
          "Lun=0x%04lX, Protocol=%lu, Flags=%u, PTS1=%u, PTS2=%u, PTS3=%u.%c%c",
@@ -419,102 +2867,465 @@ RESPONSECODE IFDHSetProtocolParameters(DWORD Lun, DWORD Protocol, UCHAR Flags,
     uint16_t slot_num;
     if (lun_parse(Lun, &reader_num, &slot_num) != 0)
     {
-        return IFD_COMMUNICATION_ERROR;
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    /* Only protocol selection is supported, PTS negotiation is not. */
+    if (Flags != 0 || PTS1 != 0 || PTS2 != 0 || PTS3 != 0)
+    {
+        return IFD_NOT_SUPPORTED;
+    }
+
+    /* Check if ICC is present. */
+    if (icc_present(slot_num))
+    {
+        switch (Protocol)
+        {
+        case SCARD_PROTOCOL_T0:
+            client_icc[slot_num].proto = SCARD_PROTOCOL_T0;
+            return IFD_SUCCESS;
+        case SCARD_PROTOCOL_T1:
+            /* swICC does not support T=1. */
+            return IFD_PROTOCOL_NOT_SUPPORTED;
+        default:
+            /* Unexpected. */
+            return IFD_COMMUNICATION_ERROR;
+        }
+    }
+    else
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+}
+
+RESPONSECODE IFDHSetProtocolParameters(DWORD Lun, DWORD Protocol, UCHAR Flags,
+                                       UCHAR PTS1, UCHAR PTS2, UCHAR PTS3)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHSetProtocolParameters", Lun, Protocol, Flags);
+    RESPONSECODE const ret = ifdh_set_protocol_parameters(
+        Lun, Protocol, Flags, PTS1, PTS2, PTS3);
+    IFD_PROBE4(ifdh_return, "IFDHSetProtocolParameters", Lun, ret, 0U);
+    return ret;
+}
+
+/**
+ * @brief Run a function for a slot, on its worker if it has one, when it is
+ * the turn of the slot.
+ * @param[in] slot_num
+ * @param[in] fn Returns a response code (RESPONSECODE).
+ * @param[in, out] arg
+ * @param[out] prio_class Where to write the priority class the slot ran in.
+ * May be NULL.
+ * @return Response code of the function.
+ */
+static RESPONSECODE slot_run(uint16_t const slot_num, ifd_worker_fn *const fn,
+                             void *const arg, uint8_t *const prio_class)
+{
+    uint8_t cls;
+    uint64_t const wait_start = ifd_clock_ns();
+    if (ifd_prio_enter(&prio_sched, &slot_prio[slot_num], &cls))
+    {
+        uint64_t const wait_ns = ifd_clock_ns() - wait_start;
+        pthread_mutex_lock(&class_stats_lock);
+        ++class_stats[cls].wait_count;
+        class_stats[cls].wait_ns_sum += wait_ns;
+        if (wait_ns > class_stats[cls].wait_ns_max)
+        {
+            class_stats[cls].wait_ns_max = wait_ns;
+        }
+        pthread_mutex_unlock(&class_stats_lock);
+    }
+
+    RESPONSECODE ret;
+    pthread_mutex_lock(&slot_lock[slot_num]);
+    if (!slot_worker[slot_num].running)
+    {
+        ret = (RESPONSECODE)fn(arg);
+    }
+    else
+    {
+        int32_t ret_fn;
+        ret = ifd_worker_call(&slot_worker[slot_num], fn, arg, &ret_fn) == 0
+                  ? (RESPONSECODE)ret_fn
+                  : IFD_COMMUNICATION_ERROR;
+    }
+    pthread_mutex_unlock(&slot_lock[slot_num]);
+    ifd_prio_leave(&prio_sched);
+
+    if (prio_class != NULL)
+    {
+        *prio_class = cls;
+    }
+    return ret;
+}
+
+/**
+ * Arguments of IFDHPowerICC for running it on a worker.
+ */
+typedef struct power_args_s
+{
+    uint16_t slot_num;
+    DWORD action;
+    PUCHAR atr;
+    PDWORD atr_len;
+} power_args_st;
+
+/**
+ * @brief Perform a power action on the ICC.
+ * @param[in, out] arg Arguments (power_args_st).
+ * @return Response code (RESPONSECODE).
+ */
+static int32_t power_work(void *const arg)
+{
+    msg_thread_init();
+    power_args_st *const args = arg;
+    uint16_t const slot_num = args->slot_num;
+    PUCHAR const Atr = args->atr;
+    PDWORD const AtrLength = args->atr_len;
+
+    /* Check if ICC is present. */
+    if (!icc_present(slot_num))
+    {
+        return (int32_t)IFD_COMMUNICATION_ERROR;
+    }
+
+    switch (args->action)
+    {
+    case IFD_RESET:
+        /**
+         * A warm reset skips the PPS exchange so the protocol that was
+         * negotiated after the cold reset stays in effect. A powered-down ICC
+         * can't be warm reset so it gets powered up instead.
+         */
+        if (icc_reset_fast(slot_num,
+                           client_icc[slot_num].pwr_down
+                               ? SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_N
+                               : SWICC_NET_MSG_CTRL_MOCK_RESET_WARM_PPS_N) !=
+            0)
+        {
+            return (int32_t)IFD_ERROR_POWER_ACTION;
+        }
+        __attribute__((fallthrough));
+    case IFD_POWER_UP:
+        /**
+         * If ICC is already powered-up, give back the ATR, otherwise power up
+         * the ICC. An ICC that was powered up before already went through the
+         * PPS exchange so it is skipped.
+         */
+        if (client_icc[slot_num].atr_len <= 0 || client_icc[slot_num].pwr_down)
+        {
+            if (icc_reset_fast(slot_num,
+                               SWICC_NET_MSG_CTRL_MOCK_RESET_COLD_PPS_N) != 0)
+            {
+                return (int32_t)IFD_ERROR_POWER_ACTION;
+            }
+        }
+
+        /* Check if the AtrBuffer can contain the ICC ATR. */
+        if (*AtrLength < client_icc[slot_num].atr_len)
+        {
+            Log1(PCSC_LOG_ERROR,
+                 "Supplied ATR buffer is too small to contain ICC ATR.");
+            return (int32_t)IFD_COMMUNICATION_ERROR;
+        }
+
+        *AtrLength = client_icc[slot_num].atr_len;
+        memcpy(Atr, client_icc[slot_num].atr, client_icc[slot_num].atr_len);
+        return (int32_t)IFD_SUCCESS;
+    case IFD_POWER_DOWN:
+        if (icc_powerdown(slot_num) != 0)
+        {
+            return (int32_t)IFD_ERROR_POWER_ACTION;
+        }
+        return (int32_t)IFD_SUCCESS;
+    default:
+        break;
+    }
+    return (int32_t)IFD_ERROR_NOT_SUPPORTED;
+}
+
+static RESPONSECODE ifdh_power_icc(DWORD Lun, DWORD Action, PUCHAR Atr,
+                                   PDWORD AtrLength)
+{
+    Log5(PCSC_LOG_DEBUG, "Lun=0x%04lX, Action=%lu, Atr=%p, AtrLength=%p.", Lun,
+         Action, Atr, AtrLength);
+
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
+    }
+
+    power_args_st args = {.slot_num = slot_num,
+                          .action = Action,
+                          .atr = Atr,
+                          .atr_len = AtrLength};
+    return slot_run(slot_num, power_work, &args, NULL);
+}
+
+RESPONSECODE IFDHPowerICC(DWORD Lun, DWORD Action, PUCHAR Atr, PDWORD AtrLength)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHPowerICC", Lun, Action, 0U);
+    RESPONSECODE const ret = ifdh_power_icc(Lun, Action, Atr, AtrLength);
+    IFD_PROBE4(ifdh_return, "IFDHPowerICC", Lun, ret, *AtrLength);
+    return ret;
+}
+
+/**
+ * Arguments of IFDHTransmitToICC for running it on a worker.
+ */
+typedef struct transmit_args_s
+{
+    uint16_t slot_num;
+    PUCHAR tx;
+    DWORD tx_len;
+    PUCHAR rx;
+    PDWORD rx_len;
+    uint64_t rx_buf_len;
+} transmit_args_st;
+
+/**
+ * @brief Get the TPDU state of an ICC.
+ * @param[in] slot_num
+ * @return TPDU state.
+ */
+static ifd_tpdu_icc_st tpdu_icc_get(uint16_t const slot_num)
+{
+    return (ifd_tpdu_icc_st){
+        .cont_iface = client_icc[slot_num].cont_iface,
+        .cont_icc = client_icc[slot_num].cont_icc,
+        .buf_len_exp = client_icc[slot_num].buf_len_exp,
+        .pipeline =
+            (client_icc[slot_num].features & IFD_NET_FEATURE_PIPELINE) != 0,
+    };
+}
+
+/**
+ * @brief Keep the TPDU state of an ICC after an exchange.
+ * @param[in] slot_num
+ * @param[in] icc
+ */
+static void tpdu_icc_put(uint16_t const slot_num,
+                         ifd_tpdu_icc_st const *const icc)
+{
+    client_icc[slot_num].cont_icc = icc->cont_icc;
+    client_icc[slot_num].buf_len_exp = icc->buf_len_exp;
+}
+
+/**
+ * @brief Take an APDU from the APDU rate limit of a slot.
+ * @param[in] slot_num
+ * @return true if the APDU can be transmitted, false if it is over the limit.
+ */
+static bool apdu_rate_take(uint16_t const slot_num)
+{
+    if (!rate_limit_take(&client_icc[slot_num].apdu_rate_limit, cfg.apdu_rate))
+    {
+        /* Keep a chatty ICC from holding the reader for other slots. */
+        ++client_icc[slot_num].apdu_throttle_count;
+        Log2(PCSC_LOG_DEBUG, "APDU rate limit reached on slot %u.", slot_num);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Trace an APDU and its response, and track it in the channel stats.
+ * @param[in] slot_num
+ * @param[in] apdu
+ * @param[in] apdu_len
+ * @param[in] rsp NULL if the APDU failed.
+ * @param[in] rsp_len
+ * @param[in] io_ns
+ */
+static void apdu_done(uint16_t const slot_num, uint8_t const *const apdu,
+                      uint32_t const apdu_len, uint8_t const *const rsp,
+                      uint32_t const rsp_len, uint64_t const io_ns)
+{
+    if (slot_trace(slot_num) >= IFD_VENDOR_TRACE_APDU)
+    {
+        slot_trace_data(slot_num, "C-APDU", apdu, apdu_len, 0U);
+        slot_trace_data(slot_num, rsp != NULL ? "R-APDU" : "failed", rsp,
+                        rsp != NULL ? rsp_len : 0U, io_ns);
+    }
+    if (rsp != NULL)
+    {
+        chan_track(slot_num, apdu, apdu_len, rsp, rsp_len, io_ns);
+    }
+}
+
+/**
+ * @brief Exchange an APDU with a present ICC.
+ * @param[in] slot_num
+ * @param[in] apdu Without anything after the data.
+ * @param[in] apdu_len
+ * @param[out] rsp
+ * @param[in, out] rsp_len Gives the size of the response buffer. On success,
+ * receives the length of the response.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t apdu_exchange(uint16_t const slot_num,
+                             uint8_t const *const apdu, uint32_t const apdu_len,
+                             uint8_t *const rsp, uint32_t *const rsp_len)
+{
+    uint16_t slot_ctx = slot_num;
+    ifd_tpdu_io_st const io = {.send = tpdu_msg_send,
+                               .recv = tpdu_msg_recv,
+                               .ctx = &slot_ctx,
+                               .msg_tx = &msg_tx,
+                               .msg_rx = &msg_rx,
+                               .msg_rx_spec = &msg_rx_spec,
+                               .id = slot_num};
+    ifd_tpdu_icc_st icc = tpdu_icc_get(slot_num);
+    int32_t const ret =
+        ifd_tpdu_transceive(&io, &icc, apdu, apdu_len, rsp, rsp_len);
+    tpdu_icc_put(slot_num, &icc);
+    return ret;
+}
+
+/**
+ * @brief Send the commands of a channel which were answered from the response
+ * cache but changed what is selected, so the ICC catches up before it gets
+ * another command on the channel.
+ * @param[in] slot_num Must have a response cache.
+ * @param[in] chan
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t memo_catch_up(uint16_t const slot_num, uint8_t const chan)
+{
+    ifd_memo_st *const memo = client_icc[slot_num].memo;
+    uint8_t const *cmd;
+    uint32_t cmd_len;
+    while (ifd_memo_lag_pop(memo, chan, &cmd, &cmd_len))
+    {
+        uint8_t rsp[IFD_MEMO_RSP_LEN_MAX];
+        uint32_t rsp_len = sizeof(rsp);
+        if (apdu_exchange(slot_num, cmd, cmd_len, rsp, &rsp_len) != 0 ||
+            !ifd_memo_rsp_ok(rsp, rsp_len))
+        {
+            Log2(PCSC_LOG_ERROR,
+                 "ICC in slot %u no longer matches its cached responses.",
+                 slot_num);
+            ifd_memo_invalidate(memo);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Transmit an APDU to a present ICC and receive the response, or answer
+ * it from the response cache.
+ * @param[in] slot_num
+ * @param[in] apdu
+ * @param[in] apdu_len
+ * @param[out] rsp
+ * @param[in, out] rsp_len Gives the size of the response buffer. On success,
+ * receives the length of the response.
+ * @return Response code (RESPONSECODE).
+ */
+static int32_t apdu_transmit(uint16_t const slot_num,
+                             uint8_t const *const apdu, uint32_t apdu_len,
+                             uint8_t *const rsp, uint32_t *const rsp_len)
+{
+    /* APDU must contain a header. */
+    if (apdu_len < 5U)
+    {
+        Log1(PCSC_LOG_ERROR, "APDU is missing a header.");
+        return (int32_t)IFD_COMMUNICATION_ERROR;
+    }
+    else if (apdu_len > 5U)
+    {
+        /**
+         * This makes sure that any extra data in the APDU buffer is ignored
+         * and only the APDU is transmitted.
+         */
+        Log2(PCSC_LOG_DEBUG, "APDU data length is %uB.", apdu[4U]);
+        apdu_len = 5U + apdu[4U]; /* 5 + Lc = header_len + data_len. */
     }
 
-    /* Only protocol selection is supported, PTS negotiation is not. */
-    if (Flags != 0 || PTS1 != 0 || PTS2 != 0 || PTS3 != 0)
+    uint8_t const chan = apdu_chan(apdu[0U]);
+    ifd_memo_st *const memo = client_icc[slot_num].memo;
+    uint64_t memo_io_ns;
+    if (memo != NULL &&
+        ifd_memo_get(memo, chan, apdu, apdu_len, rsp, rsp_len, &memo_io_ns))
     {
-        return IFD_NOT_SUPPORTED;
+        /* The rate limit is for the ICC, which is not bothered. */
+        ++client_icc[slot_num].memo_hit_count;
+        client_icc[slot_num].memo_saved_ns += memo_io_ns;
+        apdu_done(slot_num, apdu, apdu_len, rsp, *rsp_len, 0U);
+        return (int32_t)IFD_SUCCESS;
     }
 
-    /* Check if ICC is present. */
-    if (icc_present(slot_num))
+    if (!apdu_rate_take(slot_num))
     {
-        switch (Protocol)
+        return (int32_t)IFD_RESPONSE_TIMEOUT;
+    }
+    if (memo != NULL && memo_catch_up(slot_num, chan) != 0)
+    {
+        apdu_done(slot_num, apdu, apdu_len, NULL, 0U, 0U);
+        return (int32_t)IFD_COMMUNICATION_ERROR;
+    }
+    uint64_t const io_start = ifd_clock_ns();
+    int32_t const ret = apdu_exchange(slot_num, apdu, apdu_len, rsp, rsp_len);
+    uint64_t const io_ns = ifd_clock_ns() - io_start;
+    apdu_done(slot_num, apdu, apdu_len, ret == 0 ? rsp : NULL, *rsp_len,
+              io_ns);
+    if (ret != 0)
+    {
+        if (memo != NULL)
         {
-        case SCARD_PROTOCOL_T0:
-            return IFD_SUCCESS;
-        case SCARD_PROTOCOL_T1:
-            /* swICC does not support T=1. */
-            return IFD_PROTOCOL_NOT_SUPPORTED;
-        default:
-            /* Unexpected. */
-            return IFD_COMMUNICATION_ERROR;
+            /* What the ICC did with the APDU is not known. */
+            ifd_memo_invalidate(memo);
         }
+        return (int32_t)IFD_COMMUNICATION_ERROR;
     }
-    else
+    if (memo != NULL &&
+        ifd_memo_put(memo, chan, apdu, apdu_len, rsp, *rsp_len, io_ns))
     {
-        return IFD_COMMUNICATION_ERROR;
+        ++client_icc[slot_num].memo_miss_count;
     }
+    return (int32_t)IFD_SUCCESS;
 }
 
-RESPONSECODE IFDHPowerICC(DWORD Lun, DWORD Action, PUCHAR Atr, PDWORD AtrLength)
+/**
+ * @brief Transmit an APDU to the ICC and receive the response.
+ * @param[in, out] arg Arguments (transmit_args_st).
+ * @return Response code (RESPONSECODE).
+ */
+static int32_t transmit_work(void *const arg)
 {
-    Log5(PCSC_LOG_DEBUG, "Lun=0x%04lX, Action=%lu, Atr=%p, AtrLength=%p.", Lun,
-         Action, Atr, AtrLength);
-
-    uint16_t reader_num;
-    uint16_t slot_num;
-    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
-    {
-        return IFD_COMMUNICATION_ERROR;
-    }
+    msg_thread_init();
+    transmit_args_st *const args = arg;
+    uint16_t const slot_num = args->slot_num;
 
     /* Check if ICC is present. */
-    if (!icc_present(slot_num))
-    {
-        return IFD_COMMUNICATION_ERROR;
-    }
-
-    switch (Action)
+    if (icc_present(slot_num))
     {
-    case IFD_RESET:
-        /**
-         * A warm reset is not a cold reset but functionally they
-         * are the same.
-         */
-        if (icc_powerup(slot_num) != 0)
-        {
-            return IFD_ERROR_POWER_ACTION;
-        }
-        __attribute__((fallthrough));
-    case IFD_POWER_UP:
-        /**
-         * If ICC is already powered-up, give back the ATR, otherwise power up
-         * the ICC.
-         */
-        if (client_icc[slot_num].atr_len <= 0)
-        {
-            if (icc_powerup(slot_num) != 0)
-            {
-                return IFD_ERROR_POWER_ACTION;
-            }
-        }
-
-        /* Check if the AtrBuffer can contain the ICC ATR. */
-        if (*AtrLength < client_icc[slot_num].atr_len)
+        /* Safe casts since the lengths are clamped to 32 bits. */
+        uint32_t const apdu_len = (uint32_t)(
+            args->tx_len > UINT32_MAX ? UINT32_MAX : args->tx_len);
+        uint32_t rsp_len = (uint32_t)(
+            args->rx_buf_len > UINT32_MAX ? UINT32_MAX : args->rx_buf_len);
+        int32_t const ret = apdu_transmit(slot_num, args->tx, apdu_len,
+                                          args->rx, &rsp_len);
+        if (ret == (int32_t)IFD_SUCCESS)
         {
-            Log1(PCSC_LOG_ERROR,
-                 "Supplied ATR buffer is too small to contain ICC ATR.");
-            return IFD_COMMUNICATION_ERROR;
+            *args->rx_len = rsp_len;
         }
-
-        *AtrLength = client_icc[slot_num].atr_len;
-        memcpy(Atr, client_icc[slot_num].atr, client_icc[slot_num].atr_len);
-        return IFD_SUCCESS;
-    case IFD_POWER_DOWN:
-        /* No need to do power management so do nothing on power-down. */
-        return IFD_SUCCESS;
-    default:
-        break;
+        return ret;
+    }
+    else
+    {
+        return (int32_t)IFD_ICC_NOT_PRESENT;
     }
-    return IFD_ERROR_NOT_SUPPORTED;
 }
 
-RESPONSECODE IFDHTransmitToICC(DWORD Lun, SCARD_IO_HEADER SendPci,
-                               PUCHAR TxBuffer, DWORD TxLength, PUCHAR RxBuffer,
-                               PDWORD RxLength, PSCARD_IO_HEADER RecvPci)
+static RESPONSECODE ifdh_transmit_to_icc(DWORD Lun, SCARD_IO_HEADER SendPci,
+                                         PUCHAR TxBuffer, DWORD TxLength,
+                                         PUCHAR RxBuffer, PDWORD RxLength,
+                                         PSCARD_IO_HEADER RecvPci)
 {
     Log9(PCSC_LOG_DEBUG,
          "Lun=0x%04lX, SendPci=%p, TxBuffer=%p, TxLength=%lu, RxBuffer=%p, "
@@ -536,177 +3347,308 @@ RESPONSECODE IFDHTransmitToICC(DWORD Lun, SCARD_IO_HEADER SendPci,
      * @warning SendPci is not used (stated in PC/SC-lite docs).
      */
 
-    /* Check if ICC is present. */
-    if (icc_present(slot_num))
+    transmit_args_st args = {.slot_num = slot_num,
+                             .tx = TxBuffer,
+                             .tx_len = TxLength,
+                             .rx = RxBuffer,
+                             .rx_len = RxLength,
+                             .rx_buf_len = rx_buf_len};
+    uint64_t const call_start = ifd_clock_ns();
+    uint8_t prio_class;
+    RESPONSECODE const ret =
+        slot_run(slot_num, transmit_work, &args, &prio_class);
+    if (ret == IFD_SUCCESS)
     {
-        /* APDU must contain a header. */
-        if (TxLength < 5U)
+        uint64_t const lat_ns = ifd_clock_ns() - call_start;
+        ++client_icc[slot_num].apdu_count;
+        client_icc[slot_num].apdu_lat_ns_sum += lat_ns;
+        if (lat_ns > client_icc[slot_num].apdu_lat_ns_max)
         {
-            Log1(PCSC_LOG_ERROR, "APDU is missing a header.");
-            return IFD_COMMUNICATION_ERROR;
+            client_icc[slot_num].apdu_lat_ns_max = lat_ns;
         }
-        else if (TxLength > 5U)
+        client_stats_st *const stats = client_stats(slot_num);
+        if (stats != NULL)
         {
-            /**
-             * This makes sure that any extra data in the TxBuffer is ignored
-             * and only the APDU is transmitted.
-             */
-            Log2(PCSC_LOG_DEBUG, "APDU data length is %uB.", TxBuffer[4U]);
-            TxLength = 5U + TxBuffer[4U]; /* 5 + Lc = header_len + data_len. */
+            ifd_lat_hist_add(&stats->apdu_lat_hist, lat_ns);
         }
 
-        uint8_t const apdu_ins = TxBuffer[1U];
-        uint8_t const apdu_ins_xor_ff = apdu_ins ^ 0xFF;
-        uint64_t len_rem = TxLength;
+        pthread_mutex_lock(&class_stats_lock);
+        ++class_stats[prio_class].apdu_count;
+        class_stats[prio_class].apdu_lat_ns_sum += lat_ns;
+        if (lat_ns > class_stats[prio_class].apdu_lat_ns_max)
+        {
+            class_stats[prio_class].apdu_lat_ns_max = lat_ns;
+        }
+        ifd_lat_hist_add(&class_lat_hist[prio_class], lat_ns);
+        pthread_mutex_unlock(&class_stats_lock);
+    }
 
-        /**
-         * Iterate as many times as are needed to transfer all data from the
-         * buffer and until ICC needs more data than can be provided.
-         */
-        while (len_rem > 0 || client_icc[slot_num].buf_len_exp == 0)
+    /**
+     * @warning RecvPci is not used (stated in PC/SC-lite docs).
+     */
+    return ret;
+}
+
+RESPONSECODE IFDHTransmitToICC(DWORD Lun, SCARD_IO_HEADER SendPci,
+                               PUCHAR TxBuffer, DWORD TxLength, PUCHAR RxBuffer,
+                               PDWORD RxLength, PSCARD_IO_HEADER RecvPci)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHTransmitToICC", Lun, TxLength, *RxLength);
+    RESPONSECODE const ret = ifdh_transmit_to_icc(
+        Lun, SendPci, TxBuffer, TxLength, RxBuffer, RxLength, RecvPci);
+    IFD_PROBE4(ifdh_return, "IFDHTransmitToICC", Lun, ret, *RxLength);
+    return ret;
+}
+
+/**
+ * Arguments of the batch control code for running it on a worker.
+ */
+typedef struct batch_args_s
+{
+    uint16_t slot_num;
+    uint8_t const *tx;
+    uint32_t tx_len;
+    uint8_t *rx;
+    uint32_t rx_len;
+    uint32_t *rx_returned;
+} batch_args_st;
+
+/**
+ * @brief Read the length of an entry of a batch (2 bytes, big endian).
+ * @param[in] buf
+ * @return Length.
+ */
+static uint32_t batch_entry_len(uint8_t const *const buf)
+{
+    return (uint32_t)(buf[0U] << 8U) | buf[1U];
+}
+
+/**
+ * @brief Transmit a run of APDUs without a data phase, which start a batch, in
+ * one message.
+ * @param[in] slot_num
+ * @param[in] tx Entries of the batch which are left.
+ * @param[in] tx_len
+ * @param[out] rx Where to write the responses with their lengths.
+ * @param[in] rx_len
+ * @param[out] tx_done How much of tx was answered.
+ * @param[out] rx_done How much of rx was written.
+ * @return Response code (RESPONSECODE). tx_done is 0 if the run was too short
+ * to be worth a batch message, or if the ICC answered none of it.
+ */
+static int32_t batch_run(uint16_t const slot_num, uint8_t const *const tx,
+                         uint32_t const tx_len, uint8_t *const rx,
+                         uint32_t const rx_len, uint32_t *const tx_done,
+                         uint32_t *const rx_done)
+{
+    uint8_t hdr[IFD_MSG_BUF_LEN_MAX];
+    uint32_t hdr_count = 0U;
+    uint32_t rsp_len_max = 0U;
+    uint32_t tx_idx = 0U;
+    *tx_done = 0U;
+    *rx_done = 0U;
+    while (tx_idx < tx_len && batch_entry_len(&tx[tx_idx]) == 5U &&
+           (hdr_count + 1U) * 5U <= sizeof(hdr))
+    {
+        uint32_t const len = ifd_tpdu_batch_rsp_len_max(&tx[tx_idx + 2U]);
+        if (rsp_len_max + len > IFD_MSG_BUF_LEN_MAX ||
+            rsp_len_max + len > rx_len)
         {
-            /* How much data was requested by the ICC. */
-            uint32_t const icc_buf_len_exp = client_icc[slot_num].buf_len_exp;
+            break;
+        }
+        memcpy(&hdr[hdr_count * 5U], &tx[tx_idx + 2U], 5U);
+        rsp_len_max += len;
+        ++hdr_count;
+        tx_idx += 2U + 5U;
+    }
+    if (hdr_count < 2U)
+    {
+        return (int32_t)IFD_SUCCESS;
+    }
+    for (uint32_t hdr_i = 0U; hdr_i < hdr_count; ++hdr_i)
+    {
+        if (!apdu_rate_take(slot_num))
+        {
+            hdr_count = hdr_i;
+            break;
+        }
+    }
+    if (hdr_count == 0U)
+    {
+        return (int32_t)IFD_RESPONSE_TIMEOUT;
+    }
 
-            Log3(PCSC_LOG_DEBUG, "ICC expects %uB. %luB remaining in TxBuffer.",
-                 icc_buf_len_exp, len_rem);
-            if (len_rem < icc_buf_len_exp)
-            {
-                Log3(PCSC_LOG_ERROR,
-                     "ICC expects %uB, have only %luB to transmit.",
-                     icc_buf_len_exp, len_rem);
-                return IFD_COMMUNICATION_ERROR;
-            }
+    uint64_t const io_start = ifd_clock_ns();
+    uint16_t slot_ctx = slot_num;
+    ifd_tpdu_io_st const io = {.send = tpdu_msg_send,
+                               .recv = tpdu_msg_recv,
+                               .ctx = &slot_ctx,
+                               .msg_tx = &msg_tx,
+                               .msg_rx = &msg_rx,
+                               .msg_rx_spec = &msg_rx_spec,
+                               .id = slot_num};
+    ifd_tpdu_icc_st icc = tpdu_icc_get(slot_num);
+    uint32_t rsp_len = rx_len;
+    uint32_t rsp_count;
+    int32_t const ret = ifd_tpdu_batch(&io, &icc, hdr, hdr_count, rx, &rsp_len,
+                                       &rsp_count);
+    tpdu_icc_put(slot_num, &icc);
+    if (ret != 0)
+    {
+        return (int32_t)IFD_COMMUNICATION_ERROR;
+    }
 
-            memset(&msg_tx, 0U, sizeof(msg_tx));
-            msg_tx.data.cont_state = client_icc[slot_num].cont_iface;
-            memcpy(msg_tx.data.buf, &TxBuffer[TxLength - len_rem],
-                   icc_buf_len_exp);
-            msg_tx.hdr.size =
-                offsetof(swicc_net_msg_data_st, buf) + icc_buf_len_exp;
-            if (client_msg_io(slot_num, true) != 0 ||
-                msg_rx.data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
-            {
-                return IFD_COMMUNICATION_ERROR;
-            }
+    /* The time of the message is split evenly between the APDUs. */
+    uint64_t const io_ns = (ifd_clock_ns() - io_start) / hdr_count;
+    uint32_t rx_idx = 0U;
+    for (uint32_t rsp_i = 0U; rsp_i < rsp_count; ++rsp_i)
+    {
+        uint32_t const len = batch_entry_len(&rx[rx_idx]);
+        apdu_done(slot_num, &hdr[rsp_i * 5U], 5U, &rx[rx_idx + 2U], len,
+                  io_ns);
+        rx_idx += 2U + len;
+    }
+    *tx_done = rsp_count * (2U + 5U);
+    *rx_done = rsp_len;
+    return (int32_t)IFD_SUCCESS;
+}
 
-            /**
-             * After I/O, if the remaining length is 0, it means the command was
-             * sent and ICC should have responsed with a response TPDU.
-             */
-            len_rem -= icc_buf_len_exp;
-            Log2(PCSC_LOG_DEBUG, "TxBuffer contains %luB after transmission.",
-                 len_rem);
+/**
+ * @brief Transmit a batch of APDUs, see IFD_VENDOR_CTL_BATCH. Runs of APDUs
+ * without a data phase go in one message to ICCs which support it, the rest
+ * are transmitted one by one.
+ * @param[in, out] arg Arguments (batch_args_st).
+ * @return Response code (RESPONSECODE).
+ */
+static int32_t batch_work(void *const arg)
+{
+    msg_thread_init();
+    batch_args_st *const args = arg;
+    uint16_t const slot_num = args->slot_num;
+    *args->rx_returned = 0U;
+    if (!icc_present(slot_num))
+    {
+        return (int32_t)IFD_ICC_NOT_PRESENT;
+    }
 
-            /* Safe cast since the swICC net functions validated the message. */
-            uint32_t const msg_rx_buf_len =
-                (uint32_t)(msg_rx.hdr.size -
-                           offsetof(swicc_net_msg_data_st, buf));
-            Log2(PCSC_LOG_DEBUG, "Received %uB from ICC.", msg_rx_buf_len);
+    /* Check that the batch is well-formed before transmitting any of it. */
+    uint32_t tx_idx = 0U;
+    while (tx_idx < args->tx_len)
+    {
+        if (args->tx_len - tx_idx < 2U ||
+            batch_entry_len(&args->tx[tx_idx]) > args->tx_len - tx_idx - 2U)
+        {
+            Log1(PCSC_LOG_ERROR, "Batch of APDUs is malformed.");
+            return (int32_t)IFD_COMMUNICATION_ERROR;
+        }
+        tx_idx += 2U + batch_entry_len(&args->tx[tx_idx]);
+    }
 
-            /**
-             * While transmitting the APDU, shall not receive any data in
-             * responses, procedure bytes are ok.
-             */
-            if (msg_rx_buf_len == 1U)
-            {
-                /* Got a procedure byte. */
-                uint8_t const procedure = msg_rx.data.buf[0U];
-                if (procedure == 0x60) /* NACK */
-                {
-                    /* Stop processing command here. */
-                    /**
-                     * @todo What should the response APDU be for NACK?
-                     */
-                    break;
-                }
-                else if (procedure == apdu_ins ||
-                         procedure == apdu_ins_xor_ff) /* ACK */
-                {
-                    /* Continue sending data. */
-                }
-                else
-                {
-                    Log2(PCSC_LOG_ERROR,
-                         "Received an invalid procedure: 0x%02X.", procedure);
-                    return IFD_COMMUNICATION_ERROR;
-                }
-            }
-            else if (msg_rx_buf_len == 2U)
+    /* Batch messages would get past the response cache. */
+    bool const batch_supported =
+        (client_icc[slot_num].features & IFD_NET_FEATURE_BATCH) != 0 &&
+        client_icc[slot_num].memo == NULL;
+    int32_t ret = (int32_t)IFD_SUCCESS;
+    uint32_t rx_idx = 0U;
+    tx_idx = 0U;
+    while (tx_idx < args->tx_len)
+    {
+        uint32_t tx_done = 0U;
+        uint32_t rx_done = 0U;
+        if (batch_supported && client_icc[slot_num].buf_len_exp == 5U)
+        {
+            ret = batch_run(slot_num, &args->tx[tx_idx], args->tx_len - tx_idx,
+                            &args->rx[rx_idx], args->rx_len - rx_idx, &tx_done,
+                            &rx_done);
+        }
+        if (ret == (int32_t)IFD_SUCCESS && tx_done == 0U)
+        {
+            /* Transmit one APDU, leaving room for its response length. */
+            if (args->rx_len - rx_idx < 2U + 2U)
             {
-                /**
-                 * Got a status before transmitting the whole message. This is
-                 * our response to the APDU.
-                 */
+                ret = (int32_t)IFD_COMMUNICATION_ERROR;
                 break;
             }
-            else if (msg_rx_buf_len == 0U)
-            {
-                /**
-                 * 0 means the ICC is most likely changing state, this is okay.
-                 */
-                /* Continue sending data. */
-            }
-            else
+            uint32_t rsp_len = args->rx_len - rx_idx - 2U;
+            ret = apdu_transmit(slot_num, &args->tx[tx_idx + 2U],
+                                batch_entry_len(&args->tx[tx_idx]),
+                                &args->rx[rx_idx + 2U], &rsp_len);
+            if (ret == (int32_t)IFD_SUCCESS)
             {
-                /**
-                 * This would mean we got a response because there is no more
-                 * data to send.
-                 */
-                if (len_rem == 0)
-                {
-                    break;
-                }
-
-                /* Didn't send all the data but got more data than expected. */
-                Log1(PCSC_LOG_ERROR,
-                     "Received too much or too little data from ICC.");
-                return IFD_COMMUNICATION_ERROR;
+                args->rx[rx_idx] = (uint8_t)(rsp_len >> 8U);
+                args->rx[rx_idx + 1U] = (uint8_t)rsp_len;
+                tx_done = 2U + batch_entry_len(&args->tx[tx_idx]);
+                rx_done = 2U + rsp_len;
             }
         }
-
-        /* Safe cast since the swICC net functions validated the message. */
-        uint32_t const tpdu_len =
-            (uint32_t)(msg_rx.hdr.size - offsetof(swicc_net_msg_data_st, buf));
-        Log2(PCSC_LOG_DEBUG, "TPDU response length is %u.", tpdu_len);
-
-        /* Expecting at least a status word or a TPDU header. */
-        if (tpdu_len >= 2U)
+        if (ret != (int32_t)IFD_SUCCESS)
         {
-            /* RxBuffer is too small to contain the APDU response. */
-            if (rx_buf_len < tpdu_len)
-            {
-                return IFD_COMMUNICATION_ERROR;
-            }
+            break;
+        }
+        tx_idx += tx_done;
+        rx_idx += rx_done;
+    }
 
-            /**
-             * Write the response TPDU to the RX buffer (and set length
-             * accordingly).
-             */
-            memcpy(RxBuffer, msg_rx.data.buf, tpdu_len);
-            *RxLength = tpdu_len;
+    /* The responses up to the first failed APDU are returned. */
+    *args->rx_returned = rx_idx;
+    return rx_idx > 0U ? (int32_t)IFD_SUCCESS : ret;
+}
 
-            /**
-             * @warning RecvPci is not used (stated in PC/SC-lite docs).
-             */
+static RESPONSECODE ifdh_control(DWORD Lun, DWORD dwControlCode,
+                                 PUCHAR TxBuffer, DWORD TxLength,
+                                 PUCHAR RxBuffer, DWORD RxLength,
+                                 LPDWORD pdwBytesReturned)
+{
+    Log9(PCSC_LOG_DEBUG,
+         "Lun=0x%04lX, dwControlCode=%lu, TxBuffer=%p, TxLength=%lu, "
+         "RxBuffer=%p, RxLength=%lu, pdwBytesReturned=%p.%c",
+         Lun, dwControlCode, TxBuffer, TxLength, RxBuffer, RxLength,
+         pdwBytesReturned, '\0');
 
-            return IFD_SUCCESS;
-        }
-        else
-        {
-            Log2(PCSC_LOG_ERROR,
-                 "ICC sent an invalid TPDU: tpdu_len=%u, expected =2 or >=5.",
-                 tpdu_len);
-            return IFD_COMMUNICATION_ERROR;
-        }
+    uint16_t reader_num;
+    uint16_t slot_num;
+    if (lun_parse(Lun, &reader_num, &slot_num) != 0)
+    {
+        return IFD_COMMUNICATION_ERROR;
     }
-    else
+    *pdwBytesReturned = 0U;
+
+    if (dwControlCode == SCARD_CTL_CODE(IFD_VENDOR_CTL_BATCH))
     {
-        return IFD_ICC_NOT_PRESENT;
+        if (!reader_present())
+        {
+            return IFD_NO_SUCH_DEVICE;
+        }
+        /* Safe casts since the lengths are clamped to 32 bits. */
+        uint32_t rx_returned = 0U;
+        batch_args_st args = {
+            .slot_num = slot_num,
+            .tx = TxBuffer,
+            .tx_len = (uint32_t)(TxLength > UINT32_MAX ? UINT32_MAX : TxLength),
+            .rx = RxBuffer,
+            .rx_len = (uint32_t)(RxLength > UINT32_MAX ? UINT32_MAX : RxLength),
+            .rx_returned = &rx_returned,
+        };
+        RESPONSECODE const ret = slot_run(slot_num, batch_work, &args, NULL);
+        *pdwBytesReturned = rx_returned;
+        return ret;
     }
+    return IFD_ERROR_NOT_SUPPORTED;
 }
 
-RESPONSECODE IFDHICCPresence(DWORD Lun)
+RESPONSECODE IFDHControl(DWORD Lun, DWORD dwControlCode, PUCHAR TxBuffer,
+                         DWORD TxLength, PUCHAR RxBuffer, DWORD RxLength,
+                         LPDWORD pdwBytesReturned)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHControl", Lun, dwControlCode, TxLength);
+    RESPONSECODE const ret =
+        ifdh_control(Lun, dwControlCode, TxBuffer, TxLength, RxBuffer,
+                     RxLength, pdwBytesReturned);
+    IFD_PROBE4(ifdh_return, "IFDHControl", Lun, ret, *pdwBytesReturned);
+    return ret;
+}
+
+static RESPONSECODE ifdh_icc_presence(DWORD Lun)
 {
     Log2(PCSC_LOG_DEBUG, "Lun=0x%04lX.", Lun);
 
@@ -716,34 +3658,81 @@ RESPONSECODE IFDHICCPresence(DWORD Lun)
     {
         return IFD_COMMUNICATION_ERROR;
     }
+    msg_thread_init();
 
     uint16_t slot_num_open_min = IFD_SLOT_COUNT_MAX;
-    for (uint16_t slot_i = 0; slot_i < IFD_SLOT_COUNT_MAX; ++slot_i)
+    for (uint16_t slot_i = 0; slot_i < cfg.slot_count; ++slot_i)
     {
-        if (server_ctx.sock_client[slot_i] < 0 && slot_i < slot_num_open_min)
+        if (slot_free(slot_i) && slot_i < slot_num_open_min)
         {
             slot_num_open_min = slot_i;
             break;
         }
     }
 
-    /* Check if ICC is already thought to be present. */
-    if (reader_present() && icc_present(slot_num))
+    /**
+     * No slot gets checked for a new client while all of them are occupied, so
+     * clients which are waiting are handled here.
+     */
+    if (reader_present() && slot_num_open_min == IFD_SLOT_COUNT_MAX &&
+        client_pending())
     {
-        /* Send a keep-alive message to ICC to see if it's still connected. */
-        memset(&msg_tx, 0U, sizeof(msg_tx));
-        msg_tx.data.cont_state = client_icc[slot_num].cont_iface;
-        msg_tx.data.ctrl = SWICC_NET_MSG_CTRL_KEEPALIVE;
-        msg_tx.hdr.size = offsetof(swicc_net_msg_data_st, buf);
+        client_overflow();
+    }
 
-        if (client_msg_io(slot_num, false) == 0 &&
-            msg_rx.data.ctrl == SWICC_NET_MSG_CTRL_SUCCESS)
+    /**
+     * An ICC that can resume its session stays present while its slot is held
+     * so no removal event reaches the applications.
+     */
+    if (reader_present() && slot_held(slot_num))
+    {
+        if (ifd_clock_ns() < client_icc[slot_num].resume_deadline_ns)
         {
             return IFD_ICC_PRESENT;
         }
+        Log2(PCSC_LOG_INFO, "ICC did not reconnect to held slot %u.",
+             slot_num);
+        client_clear(slot_num);
+        return IFD_ICC_NOT_PRESENT;
+    }
 
-        /* Sending or receiving errors are treated as a missing ICC. */
-        Log1(PCSC_LOG_INFO, "Client keep-alive failed. Disconnecting it.");
+    /* Check if ICC is already thought to be present. */
+    if (reader_present() && icc_present(slot_num))
+    {
+        /**
+         * With workers, the ICC is checked on the worker's schedule and only
+         * the result is looked at here.
+         */
+        bool alive;
+        if (cfg.workers && slot_worker_start(slot_num) == 0)
+        {
+            alive = atomic_load_explicit(&slot_alive[slot_num],
+                                         memory_order_relaxed);
+        }
+        else if (cfg.presence_window_ms != 0U)
+        {
+            alive = presence_swept_alive(slot_num);
+        }
+        else
+        {
+            alive = client_alive(slot_num);
+        }
+        if (alive)
+        {
+            /**
+             * A reloaded ICC is reported removed once, so it gets powered up
+             * again as if it was reinserted.
+             */
+            if (atomic_exchange_explicit(&slot_reload[slot_num], false,
+                                         memory_order_relaxed))
+            {
+                client_icc[slot_num].atr_len = 0U;
+                return IFD_ICC_NOT_PRESENT;
+            }
+            return IFD_ICC_PRESENT;
+        }
+        Log2(PCSC_LOG_INFO, "ICC in slot %u is gone. Disconnecting it.",
+             slot_num);
         client_disconnect(slot_num);
         return IFD_ICC_NOT_PRESENT;
     }
@@ -761,15 +3750,33 @@ RESPONSECODE IFDHICCPresence(DWORD Lun)
             return IFD_ICC_NOT_PRESENT;
         }
 
-        if (reader_present())
+        if (reader_present() && client_admit())
         {
             /* Safe cast since parsing Lun rejects invalid slots. */
-            if (swicc_net_server_client_connect(&server_ctx,
-                                                (uint16_t)slot_num) == 0)
+            if (server_client_connect((uint16_t)slot_num) == 0)
             {
+                if (client_setup(slot_num) != 0)
+                {
+                    client_disconnect(slot_num);
+                    return IFD_ICC_NOT_PRESENT;
+                }
+                if (!client_resume(slot_num))
+                {
+                    return IFD_ICC_NOT_PRESENT;
+                }
                 return IFD_ICC_PRESENT;
             }
         }
         return IFD_ICC_NOT_PRESENT;
     }
 }
+
+RESPONSECODE IFDHICCPresence(DWORD Lun)
+{
+    IFD_PROBE4(ifdh_entry, "IFDHICCPresence", Lun, 0U, 0U);
+    pthread_mutex_lock(&reader_lock);
+    RESPONSECODE const ret = ifdh_icc_presence(Lun);
+    pthread_mutex_unlock(&reader_lock);
+    IFD_PROBE4(ifdh_return, "IFDHICCPresence", Lun, ret, 0U);
+    return ret;
+}
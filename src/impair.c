@@ -0,0 +1,136 @@
+/**
+ * Network impairment of the connections to the ICCs.
+ */
+
+#include <clock.h>
+#include <impair.h>
+#include <math.h>
+#include <sys/socket.h>
+
+/* A single random delay is at most this many times the jitter. */
+#define IMPAIR_JITTER_SCALE_MAX 100.0
+
+/**
+ * @brief Get the next random number (xorshift64*).
+ * @param[in, out] impair
+ * @return Random number.
+ */
+static uint64_t impair_rand(ifd_impair_st *const impair)
+{
+    impair->rng ^= impair->rng >> 12U;
+    impair->rng ^= impair->rng << 25U;
+    impair->rng ^= impair->rng >> 27U;
+    return impair->rng * 0x2545F4914F6CDD1DU;
+}
+
+/**
+ * @brief Get a random number in (0, 1].
+ * @param[in, out] impair
+ * @return Random number.
+ */
+static double impair_rand_unit(ifd_impair_st *const impair)
+{
+    return (double)((impair_rand(impair) >> 11U) + 1U) / 9007199254740992.0;
+}
+
+/**
+ * @brief Decide if something with a given chance happens.
+ * @param[in, out] impair
+ * @param[in] chance_ppm
+ * @return true if it happens, false if not.
+ */
+static bool impair_chance(ifd_impair_st *const impair,
+                          uint32_t const chance_ppm)
+{
+    return chance_ppm > 0U && impair_rand(impair) % 1000000U < chance_ppm;
+}
+
+/**
+ * @brief Get a random delay.
+ * @param[in, out] impair
+ * @return Delay in microseconds.
+ */
+static uint64_t impair_delay_us(ifd_impair_st *const impair)
+{
+    ifd_impair_cfg_st const *const cfg = impair->cfg;
+    double jitter = 0.0;
+    if (cfg->jitter_us > 0U)
+    {
+        double const unit = impair_rand_unit(impair);
+        switch (cfg->dist)
+        {
+        case IFD_IMPAIR_DIST_EXP:
+            jitter = -log(unit);
+            break;
+        case IFD_IMPAIR_DIST_PARETO:
+            /* Scale of 1/3 gives a mean of 1 for a shape of 1.5. */
+            jitter = pow(unit, -1.0 / 1.5) / 3.0;
+            break;
+        case IFD_IMPAIR_DIST_UNIFORM:
+        default:
+            jitter = unit;
+            break;
+        }
+        if (jitter > IMPAIR_JITTER_SCALE_MAX)
+        {
+            jitter = IMPAIR_JITTER_SCALE_MAX;
+        }
+    }
+    return cfg->delay_us + (uint64_t)(jitter * cfg->jitter_us);
+}
+
+bool ifd_impair_enabled(ifd_impair_cfg_st const *const cfg)
+{
+    return cfg->delay_us > 0U || cfg->jitter_us > 0U ||
+           cfg->partial_ppm > 0U || cfg->reset_ppm > 0U;
+}
+
+void ifd_impair_init(ifd_impair_st *const impair,
+                     ifd_impair_cfg_st const *const cfg, uint32_t const stream)
+{
+    uint64_t seed = cfg->seed;
+    if (seed == 0U)
+    {
+        seed = ifd_clock_ns();
+    }
+    impair->cfg = cfg;
+    /* The state of xorshift must never be 0. */
+    impair->rng = (seed ^ ((uint64_t)stream << 32U)) | 1U;
+    impair->delay_count = 0U;
+    impair->delay_us_sum = 0U;
+    impair->partial_count = 0U;
+    impair->reset_count = 0U;
+}
+
+int32_t ifd_impair_msg(ifd_impair_st *const impair, int32_t const sock)
+{
+    if (impair_chance(impair, impair->cfg->reset_ppm))
+    {
+        /* Dissolving a TCP association sends a reset to the peer. */
+        struct sockaddr const addr_unspec = {.sa_family = AF_UNSPEC};
+        connect(sock, &addr_unspec, sizeof(addr_unspec));
+        shutdown(sock, SHUT_RDWR);
+        ++impair->reset_count;
+        return -1;
+    }
+
+    uint64_t const delay_us = impair_delay_us(impair);
+    if (delay_us > 0U)
+    {
+        ifd_clock_sleep_ns(delay_us * 1000U);
+        ++impair->delay_count;
+        impair->delay_us_sum += delay_us;
+    }
+    return 0;
+}
+
+uint32_t ifd_impair_chunk(ifd_impair_st *const impair, uint32_t const len)
+{
+    if (len < 2U || !impair_chance(impair, impair->cfg->partial_ppm))
+    {
+        return len;
+    }
+    ++impair->partial_count;
+    /* Safe cast since the result is less than len. */
+    return 1U + (uint32_t)(impair_rand(impair) % (len - 1U));
+}
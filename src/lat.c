@@ -0,0 +1,77 @@
+/**
+ * Latency histogram.
+ */
+
+#include <lat.h>
+
+/* Buckets per power of 2 is 2^LAT_SUB_BITS. */
+#define LAT_SUB_BITS 2U
+#define LAT_SUB_COUNT (1U << LAT_SUB_BITS)
+
+/**
+ * @brief Get the bucket of a latency.
+ * @param[in] lat_ns
+ * @return Index of the bucket.
+ */
+static uint32_t lat_bucket(uint64_t const lat_ns)
+{
+    if (lat_ns < LAT_SUB_COUNT)
+    {
+        return (uint32_t)lat_ns;
+    }
+    /* Safe cast since the index of the MSB of a 64-bit integer is below 64. */
+    uint32_t const msb = 63U - (uint32_t)__builtin_clzll(lat_ns);
+    uint32_t const sub =
+        (uint32_t)(lat_ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB_COUNT - 1U);
+    uint32_t const idx = (msb - LAT_SUB_BITS + 1U) * LAT_SUB_COUNT + sub;
+    return idx < IFD_LAT_HIST_LEN ? idx : IFD_LAT_HIST_LEN - 1U;
+}
+
+/**
+ * @brief Get the largest latency that goes in a bucket.
+ * @param[in] idx Index of the bucket.
+ * @return Latency in nanoseconds.
+ */
+static uint64_t lat_bucket_max(uint32_t const idx)
+{
+    if (idx < LAT_SUB_COUNT)
+    {
+        return idx;
+    }
+    uint32_t const shift = idx / LAT_SUB_COUNT - 1U;
+    uint64_t const sub = idx % LAT_SUB_COUNT;
+    return ((LAT_SUB_COUNT + sub + 1U) << shift) - 1U;
+}
+
+void ifd_lat_hist_add(ifd_lat_hist_st *const hist, uint64_t const lat_ns)
+{
+    ++hist->count;
+    ++hist->bucket[lat_bucket(lat_ns)];
+    if (lat_ns > hist->max_ns)
+    {
+        hist->max_ns = lat_ns;
+    }
+}
+
+uint64_t ifd_lat_hist_quantile(ifd_lat_hist_st const *const hist,
+                               uint32_t const q_ppm)
+{
+    if (hist->count == 0U)
+    {
+        return 0U;
+    }
+    /* Rank of the quantile, rounded up, so p100 is the largest latency. */
+    uint64_t const rank = (hist->count * q_ppm + 999999U) / 1000000U;
+    /* A bucket can go further up than the largest latency in it. */
+    uint64_t seen = 0U;
+    for (uint32_t idx = 0U; idx < IFD_LAT_HIST_LEN; ++idx)
+    {
+        seen += hist->bucket[idx];
+        if (seen >= rank && seen > 0U)
+        {
+            uint64_t const bucket_max = lat_bucket_max(idx);
+            return bucket_max < hist->max_ns ? bucket_max : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
@@ -0,0 +1,414 @@
+/**
+ * Cache of the responses of an ICC to commands which only read.
+ */
+
+#include <memo.h>
+#include <string.h>
+
+/* FNV-1a (64-bit). */
+#define MEMO_HASH_OFFSET 0xCBF29CE484222325U
+#define MEMO_HASH_PRIME 0x100000001B3U
+
+/* Instructions (ISO 7816-4:2020 sec.5.1.1). */
+#define MEMO_INS_SELECT 0xA4
+#define MEMO_INS_READ_BINARY 0xB0
+#define MEMO_INS_READ_RECORD 0xB2
+#define MEMO_INS_GET_RESPONSE 0xC0
+#define MEMO_INS_MANAGE_CHANNEL 0x70
+#define MEMO_INS_GET_CHALLENGE 0x84
+#define MEMO_INS_GET_DATA 0xCA
+#define MEMO_INS_STATUS 0xF2
+
+/**
+ * What a command does, as far as the cache is concerned.
+ */
+typedef enum memo_kind_e
+{
+    /* Might change files or what can be read. */
+    MEMO_KIND_WRITE,
+    /* Changes nothing but is not cached either. */
+    MEMO_KIND_NONE,
+    MEMO_KIND_CHANNEL,
+    MEMO_KIND_SELECT,
+    MEMO_KIND_READ,
+} memo_kind_et;
+
+/**
+ * @brief Add data to a hash.
+ * @param[in] hash
+ * @param[in] buf
+ * @param[in] buf_len
+ * @return New hash.
+ */
+static uint64_t memo_hash(uint64_t hash, uint8_t const *const buf,
+                          uint32_t const buf_len)
+{
+    for (uint32_t buf_i = 0U; buf_i < buf_len; ++buf_i)
+    {
+        hash ^= buf[buf_i];
+        hash *= MEMO_HASH_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Get what is selected on a channel which was just opened, or after a
+ * reset.
+ * @param[in] chan
+ * @return Selection.
+ */
+static uint64_t memo_sel_init(uint8_t const chan)
+{
+    return memo_hash(MEMO_HASH_OFFSET, &chan, 1U);
+}
+
+/**
+ * @brief Tell what a command does.
+ * @param[in] cmd
+ * @return Kind of command.
+ */
+static memo_kind_et memo_kind(uint8_t const *const cmd)
+{
+    /**
+     * Only the interindustry classes and the class of GSM 11.11 (which uses
+     * the same instructions) are understood.
+     */
+    if ((cmd[0U] & 0x80) != 0U && cmd[0U] != 0xA0)
+    {
+        return MEMO_KIND_WRITE;
+    }
+    switch (cmd[1U])
+    {
+    case MEMO_INS_SELECT:
+        return MEMO_KIND_SELECT;
+    case MEMO_INS_READ_BINARY:
+    case MEMO_INS_READ_RECORD:
+    case MEMO_INS_GET_RESPONSE:
+        return MEMO_KIND_READ;
+    case MEMO_INS_MANAGE_CHANNEL:
+        return MEMO_KIND_CHANNEL;
+    case MEMO_INS_GET_CHALLENGE:
+    case MEMO_INS_GET_DATA:
+    case MEMO_INS_STATUS:
+        return MEMO_KIND_NONE;
+    default:
+        return MEMO_KIND_WRITE;
+    }
+}
+
+/**
+ * @brief Check if a command changes what is selected when it succeeds, i.e.,
+ * a SELECT, or a read with a short EF identifier.
+ * @param[in] cmd
+ * @return true if it does, false otherwise.
+ */
+static bool memo_cmd_sel(uint8_t const *const cmd)
+{
+    switch (cmd[1U])
+    {
+    case MEMO_INS_SELECT:
+        return true;
+    case MEMO_INS_READ_BINARY:
+        return (cmd[2U] & 0x80) != 0U;
+    case MEMO_INS_READ_RECORD:
+        return (cmd[3U] >> 3U) != 0U;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Check if a SELECT does not depend on what was selected before, i.e.,
+ * it selects the MF, a path from the MF, or the first DF with a name.
+ * @param[in] cmd
+ * @param[in] cmd_len
+ * @return true if it is absolute, false otherwise.
+ */
+static bool memo_sel_abs(uint8_t const *const cmd, uint32_t const cmd_len)
+{
+    uint8_t const p1 = cmd[2U];
+    uint8_t const p2 = cmd[3U];
+    uint32_t const data_len = cmd_len - 5U;
+    return p1 == 0x08 || (p1 == 0x04 && (p2 & 0x03) == 0U) ||
+           (p1 == 0x00 &&
+            (data_len == 0U ||
+             (data_len == 2U && cmd[5U] == 0x3F && cmd[6U] == 0x00)));
+}
+
+/**
+ * @brief Get the key of the entry of a command in the current state of a
+ * channel.
+ * @param[in] chan_state
+ * @param[in] cmd
+ * @param[in] cmd_len
+ * @return Key.
+ */
+static uint64_t memo_key(ifd_memo_chan_st const *const chan_state,
+                         uint8_t const *const cmd, uint32_t const cmd_len)
+{
+    if (cmd[1U] == MEMO_INS_SELECT && memo_sel_abs(cmd, cmd_len))
+    {
+        /* Same response whatever was selected before. */
+        return MEMO_HASH_OFFSET;
+    }
+    if (cmd[1U] != MEMO_INS_GET_RESPONSE)
+    {
+        return chan_state->sel;
+    }
+    /* What GET RESPONSE gets depends on the command before it. */
+    uint8_t prev[sizeof(chan_state->prev)];
+    memcpy(prev, &chan_state->prev, sizeof(prev));
+    return memo_hash(chan_state->sel, prev, sizeof(prev));
+}
+
+/**
+ * @brief Update the state of a channel after a command succeeded.
+ * @param[in, out] chan_state
+ * @param[in] cmd
+ * @param[in] cmd_len
+ */
+static void memo_track(ifd_memo_chan_st *const chan_state,
+                       uint8_t const *const cmd, uint32_t const cmd_len)
+{
+    if (memo_cmd_sel(cmd))
+    {
+        chan_state->sel = memo_hash(cmd[1U] == MEMO_INS_SELECT &&
+                                            memo_sel_abs(cmd, cmd_len)
+                                        ? MEMO_HASH_OFFSET
+                                        : chan_state->sel,
+                                    cmd, cmd_len);
+    }
+}
+
+/**
+ * @brief Drop all entries.
+ * @param[in, out] memo
+ */
+static void memo_clear(ifd_memo_st *const memo)
+{
+    for (uint32_t ent_i = 0U; ent_i < IFD_MEMO_ENT_COUNT; ++ent_i)
+    {
+        memo->ent[ent_i].cmd_len = 0U;
+    }
+}
+
+/**
+ * @brief Drop the lagging commands of a channel, e.g., when it was closed.
+ * @param[in, out] chan_state
+ */
+static void memo_lag_clear(ifd_memo_chan_st *const chan_state)
+{
+    chan_state->lag_count = 0U;
+    chan_state->lag_next = 0U;
+}
+
+/**
+ * @brief Find the entry of a command.
+ * @param[in] memo
+ * @param[in] key
+ * @param[in] cmd
+ * @param[in] cmd_len
+ * @return Entry, or NULL if there is none.
+ */
+static ifd_memo_ent_st *memo_find(ifd_memo_st *const memo, uint64_t const key,
+                                  uint8_t const *const cmd,
+                                  uint32_t const cmd_len)
+{
+    for (uint32_t ent_i = 0U; ent_i < IFD_MEMO_ENT_COUNT; ++ent_i)
+    {
+        ifd_memo_ent_st *const ent = &memo->ent[ent_i];
+        if (ent->cmd_len == cmd_len && ent->key == key &&
+            memcmp(ent->cmd, cmd, cmd_len) == 0)
+        {
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+void ifd_memo_reset(ifd_memo_st *const memo)
+{
+    memo_clear(memo);
+    memo->learn = true;
+    memo->tick = 0U;
+    for (uint8_t chan = 0U; chan < IFD_VENDOR_CHAN_COUNT_MAX; ++chan)
+    {
+        memo->chan[chan].sel = memo_sel_init(chan);
+        memo->chan[chan].prev = 0U;
+        memo_lag_clear(&memo->chan[chan]);
+    }
+}
+
+void ifd_memo_invalidate(ifd_memo_st *const memo)
+{
+    memo_clear(memo);
+    memo->learn = false;
+    for (uint8_t chan = 0U; chan < IFD_VENDOR_CHAN_COUNT_MAX; ++chan)
+    {
+        memo_lag_clear(&memo->chan[chan]);
+    }
+}
+
+bool ifd_memo_gen_set(ifd_memo_st *const memo, uint32_t const gen)
+{
+    bool const changed = !memo->gen_known || memo->gen != gen;
+    memo->gen_known = true;
+    memo->gen = gen;
+    if (changed)
+    {
+        memo_clear(memo);
+    }
+    return changed;
+}
+
+bool ifd_memo_get(ifd_memo_st *const memo, uint8_t const chan,
+                  uint8_t const *const cmd, uint32_t const cmd_len,
+                  uint8_t *const rsp, uint32_t *const rsp_len,
+                  uint64_t *const io_ns)
+{
+    memo_kind_et const kind = memo_kind(cmd);
+    if ((kind != MEMO_KIND_SELECT && kind != MEMO_KIND_READ) ||
+        cmd_len > IFD_MEMO_CMD_LEN_MAX)
+    {
+        return false;
+    }
+    ifd_memo_chan_st *const chan_state = &memo->chan[chan];
+    bool const lag = memo_cmd_sel(cmd);
+    if (lag && chan_state->lag_count >= IFD_MEMO_LAG_LEN_MAX)
+    {
+        return false;
+    }
+
+    ifd_memo_ent_st *const ent =
+        memo_find(memo, memo_key(chan_state, cmd, cmd_len), cmd, cmd_len);
+    if (ent == NULL || ent->rsp_len > *rsp_len)
+    {
+        return false;
+    }
+    memcpy(rsp, ent->rsp, ent->rsp_len);
+    *rsp_len = ent->rsp_len;
+    *io_ns = ent->io_ns;
+    ent->used = ++memo->tick;
+
+    memo_track(chan_state, cmd, cmd_len);
+    chan_state->prev = memo_hash(MEMO_HASH_OFFSET, cmd, cmd_len);
+    if (lag)
+    {
+        /* Safe cast since cached commands are short. */
+        chan_state->lag_len[chan_state->lag_count] = (uint8_t)cmd_len;
+        memcpy(chan_state->lag[chan_state->lag_count], cmd, cmd_len);
+        ++chan_state->lag_count;
+    }
+    return true;
+}
+
+bool ifd_memo_lag_pop(ifd_memo_st *const memo, uint8_t const chan,
+                      uint8_t const **const cmd, uint32_t *const cmd_len)
+{
+    ifd_memo_chan_st *const chan_state = &memo->chan[chan];
+    if (chan_state->lag_next >= chan_state->lag_count)
+    {
+        memo_lag_clear(chan_state);
+        return false;
+    }
+    *cmd = chan_state->lag[chan_state->lag_next];
+    *cmd_len = chan_state->lag_len[chan_state->lag_next];
+    ++chan_state->lag_next;
+    return true;
+}
+
+bool ifd_memo_put(ifd_memo_st *const memo, uint8_t const chan,
+                  uint8_t const *const cmd, uint32_t const cmd_len,
+                  uint8_t const *const rsp, uint32_t const rsp_len,
+                  uint64_t const io_ns)
+{
+    ifd_memo_chan_st *const chan_state = &memo->chan[chan];
+    bool const ok = ifd_memo_rsp_ok(rsp, rsp_len);
+    uint64_t const key = memo_key(chan_state, cmd, cmd_len);
+    memo_kind_et const kind = memo_kind(cmd);
+    chan_state->prev = memo_hash(MEMO_HASH_OFFSET, cmd, cmd_len);
+    switch (kind)
+    {
+    case MEMO_KIND_WRITE:
+        memo_clear(memo);
+        memo->learn = false;
+        return false;
+    case MEMO_KIND_NONE:
+        return false;
+    case MEMO_KIND_CHANNEL:
+        if (ok && cmd[2U] == 0x00)
+        {
+            /* Opened channel is in P2, or in the response if P2 is 0. */
+            uint8_t const chan_new =
+                cmd[3U] != 0U ? cmd[3U] : (rsp_len == 3U ? rsp[0U] : 0U);
+            if (chan_new != 0U && chan_new < IFD_VENDOR_CHAN_COUNT_MAX)
+            {
+                /* It starts out with what the opening channel selected. */
+                memo->chan[chan_new].sel =
+                    memo_hash(chan_state->sel, cmd, cmd_len);
+                memo->chan[chan_new].prev = 0U;
+                memo_lag_clear(&memo->chan[chan_new]);
+            }
+        }
+        else if (ok && cmd[2U] == 0x80)
+        {
+            /* Closed channel is in P2, or in CLA if P2 is 0. */
+            uint8_t const chan_old = cmd[3U] != 0U ? cmd[3U] : chan;
+            if (chan_old < IFD_VENDOR_CHAN_COUNT_MAX)
+            {
+                memo->chan[chan_old].sel = memo_sel_init(chan_old);
+                memo_lag_clear(&memo->chan[chan_old]);
+            }
+        }
+        return false;
+    case MEMO_KIND_SELECT:
+    case MEMO_KIND_READ:
+        break;
+    }
+
+    if (ok)
+    {
+        memo_track(chan_state, cmd, cmd_len);
+    }
+    bool const cacheable = cmd_len <= IFD_MEMO_CMD_LEN_MAX;
+    if (!cacheable || !ok || !memo->learn || rsp_len > IFD_MEMO_RSP_LEN_MAX ||
+        memo_find(memo, key, cmd, cmd_len) != NULL)
+    {
+        return cacheable;
+    }
+
+    /* Take a free entry, or else the least recently used one. */
+    ifd_memo_ent_st *ent = &memo->ent[0U];
+    for (uint32_t ent_i = 0U; ent_i < IFD_MEMO_ENT_COUNT; ++ent_i)
+    {
+        if (memo->ent[ent_i].cmd_len == 0U)
+        {
+            ent = &memo->ent[ent_i];
+            break;
+        }
+        if (memo->ent[ent_i].used < ent->used)
+        {
+            ent = &memo->ent[ent_i];
+        }
+    }
+    /* Safe casts since the lengths were checked. */
+    ent->key = key;
+    ent->cmd_len = (uint8_t)cmd_len;
+    memcpy(ent->cmd, cmd, cmd_len);
+    ent->rsp_len = (uint16_t)rsp_len;
+    memcpy(ent->rsp, rsp, rsp_len);
+    ent->io_ns = io_ns;
+    ent->used = ++memo->tick;
+    return cacheable;
+}
+
+bool ifd_memo_rsp_ok(uint8_t const *const rsp, uint32_t const rsp_len)
+{
+    if (rsp_len < 2U)
+    {
+        return false;
+    }
+    uint8_t const sw1 = rsp[rsp_len - 2U];
+    uint8_t const sw2 = rsp[rsp_len - 1U];
+    return (sw1 == 0x90 && sw2 == 0x00) || sw1 == 0x61;
+}
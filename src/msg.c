@@ -0,0 +1,65 @@
+/**
+ * Storage of swICC network messages.
+ */
+
+#include <msg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Get the length of the inline data buffer, which is never longer than
+ * a full one.
+ * @return Length of the inline data buffer.
+ */
+static uint32_t msg_buf_len_inline(void)
+{
+    return IFD_MSG_BUF_LEN_INLINE < IFD_MSG_BUF_LEN_MAX
+               ? IFD_MSG_BUF_LEN_INLINE
+               : (uint32_t)IFD_MSG_BUF_LEN_MAX;
+}
+
+void ifd_msg_init(ifd_msg_st *const msg)
+{
+    if (msg->msg != NULL)
+    {
+        return;
+    }
+    /* Safe cast since swICC messages are packed. */
+    msg->msg = (swicc_net_msg_st *)msg->msg_inline;
+    msg->buf_size = msg_buf_len_inline();
+    memset(msg->msg_inline, 0U, sizeof(msg->msg_inline));
+}
+
+int32_t ifd_msg_reserve(ifd_msg_st *const msg, uint32_t const buf_len)
+{
+    if (buf_len <= msg->buf_size)
+    {
+        return 0;
+    }
+    if (buf_len > IFD_MSG_BUF_LEN_MAX)
+    {
+        return -1;
+    }
+    swicc_net_msg_st *const msg_full = calloc(1U, sizeof(*msg_full));
+    if (msg_full == NULL)
+    {
+        return -1;
+    }
+    memcpy(msg_full, msg->msg,
+           sizeof(msg->msg->hdr) + offsetof(swicc_net_msg_data_st, buf) +
+               msg->buf_size);
+    msg->msg = msg_full;
+    msg->buf_size = IFD_MSG_BUF_LEN_MAX;
+    return 0;
+}
+
+void ifd_msg_free(ifd_msg_st *const msg)
+{
+    if ((uint8_t *)msg->msg == msg->msg_inline)
+    {
+        return;
+    }
+    free(msg->msg);
+    msg->msg = NULL;
+    ifd_msg_init(msg);
+}
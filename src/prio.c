@@ -0,0 +1,122 @@
+/**
+ * Scheduler of the exchanges with the ICCs of all slots.
+ */
+
+#include <prio.h>
+
+/* Pass of a slot advances by this divided by its weight. */
+#define PRIO_STRIDE 1000000U
+
+/**
+ * @brief Let the best waiting slot go, i.e., the one in the lowest class with
+ * the lowest pass.
+ * @param[in, out] sched Must be locked and have a waiting slot.
+ */
+static void prio_grant(ifd_prio_st *const sched)
+{
+    ifd_prio_ent_st **best = &sched->wait;
+    for (ifd_prio_ent_st **ent = &sched->wait; *ent != NULL;
+         ent = &(*ent)->next)
+    {
+        if ((*ent)->cls < (*best)->cls ||
+            ((*ent)->cls == (*best)->cls && (*ent)->pass < (*best)->pass))
+        {
+            best = ent;
+        }
+    }
+    ifd_prio_ent_st *const ent = *best;
+    *best = ent->next;
+    ent->next = NULL;
+    sched->vtime[ent->cls] = ent->pass;
+    ent->pass += PRIO_STRIDE / ent->weight;
+    ent->granted = true;
+    pthread_cond_signal(&ent->cond);
+}
+
+int32_t ifd_prio_ent_init(ifd_prio_ent_st *const ent, uint8_t const cls,
+                          uint16_t const weight)
+{
+    ent->cls = cls;
+    ent->weight = weight;
+    ent->pass = 0U;
+    ent->granted = false;
+    ent->next = NULL;
+    return pthread_cond_init(&ent->cond, NULL) == 0 ? 0 : -1;
+}
+
+void ifd_prio_set(ifd_prio_st *const sched, ifd_prio_ent_st *const ent,
+                  uint8_t const cls, uint16_t const weight)
+{
+    pthread_mutex_lock(&sched->lock);
+    ent->cls = cls;
+    ent->weight = weight;
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void ifd_prio_get(ifd_prio_st *const sched, ifd_prio_ent_st const *const ent,
+                  uint8_t *const cls, uint16_t *const weight)
+{
+    pthread_mutex_lock(&sched->lock);
+    *cls = ent->cls;
+    *weight = ent->weight;
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void ifd_prio_concurrency_set(ifd_prio_st *const sched,
+                              uint32_t const concurrency)
+{
+    pthread_mutex_lock(&sched->lock);
+    sched->concurrency = concurrency;
+    while (sched->wait != NULL &&
+           (concurrency == 0U || sched->running < concurrency))
+    {
+        ++sched->running;
+        prio_grant(sched);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+bool ifd_prio_enter(ifd_prio_st *const sched, ifd_prio_ent_st *const ent,
+                    uint8_t *const cls)
+{
+    pthread_mutex_lock(&sched->lock);
+    *cls = ent->cls;
+    if (sched->concurrency == 0U ||
+        (sched->running < sched->concurrency && sched->wait == NULL))
+    {
+        ++sched->running;
+        pthread_mutex_unlock(&sched->lock);
+        return false;
+    }
+
+    /* A slot which was idle gets no credit for the time it did not use. */
+    if (ent->pass < sched->vtime[ent->cls])
+    {
+        ent->pass = sched->vtime[ent->cls];
+    }
+    ent->granted = false;
+    ent->next = sched->wait;
+    sched->wait = ent;
+    while (!ent->granted)
+    {
+        pthread_cond_wait(&ent->cond, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return true;
+}
+
+void ifd_prio_leave(ifd_prio_st *const sched)
+{
+    pthread_mutex_lock(&sched->lock);
+    /* The place goes to the next slot, unless the limit went down. */
+    if (sched->wait != NULL &&
+        (sched->concurrency == 0U || sched->running <= sched->concurrency))
+    {
+        prio_grant(sched);
+    }
+    else
+    {
+        --sched->running;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
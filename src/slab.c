@@ -0,0 +1,78 @@
+/**
+ * Allocator of objects which all have the same size.
+ */
+
+#include <slab.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Get the distance between objects in a chunk.
+ * @param[in] slab
+ * @return Size of an object rounded up so every object is aligned.
+ */
+static size_t slab_stride(ifd_slab_st const *const slab)
+{
+    size_t const align = alignof(max_align_t);
+    size_t const size = slab->obj_size > sizeof(ifd_slab_obj_st)
+                            ? slab->obj_size
+                            : sizeof(ifd_slab_obj_st);
+    return (size + align - 1U) / align * align;
+}
+
+/**
+ * @brief Allocate a chunk and put all its objects in the free list.
+ * @param[in, out] slab
+ * @return 0 on success, -1 on failure.
+ * @note Chunks are never freed, so they are not kept track of.
+ */
+static int32_t slab_grow(ifd_slab_st *const slab)
+{
+    size_t const stride = slab_stride(slab);
+    uint8_t *const chunk = malloc(stride * slab->chunk_obj_count);
+    if (chunk == NULL)
+    {
+        return -1;
+    }
+    for (uint32_t obj_i = slab->chunk_obj_count; obj_i > 0U; --obj_i)
+    {
+        ifd_slab_obj_st *const obj =
+            (ifd_slab_obj_st *)&chunk[stride * (obj_i - 1U)];
+        obj->next = slab->free;
+        slab->free = obj;
+    }
+    ++slab->chunk_count;
+    return 0;
+}
+
+void *ifd_slab_alloc(ifd_slab_st *const slab)
+{
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free == NULL && slab_grow(slab) != 0)
+    {
+        pthread_mutex_unlock(&slab->lock);
+        return NULL;
+    }
+    ifd_slab_obj_st *const obj = slab->free;
+    slab->free = obj->next;
+    ++slab->obj_used;
+    pthread_mutex_unlock(&slab->lock);
+
+    memset(obj, 0U, slab->obj_size);
+    return obj;
+}
+
+void ifd_slab_free(ifd_slab_st *const slab, void *const obj)
+{
+    if (obj == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&slab->lock);
+    ifd_slab_obj_st *const obj_free = obj;
+    obj_free->next = slab->free;
+    slab->free = obj_free;
+    --slab->obj_used;
+    pthread_mutex_unlock(&slab->lock);
+}
@@ -0,0 +1,363 @@
+/**
+ * Transmission of a command APDU to an ICC as T=0 TPDUs.
+ */
+
+#include <debuglog.h>
+#include <net.h>
+#include <probe.h>
+#include <stddef.h>
+#include <string.h>
+#include <tpdu.h>
+
+/**
+ * @brief Send a message and receive the reply, keeping the ICC state in sync
+ * with the reply.
+ * @param[in] io
+ * @param[in, out] icc
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t msg_io(ifd_tpdu_io_st const *const io,
+                      ifd_tpdu_icc_st *const icc)
+{
+    if (io->send(io->ctx) != 0 || io->recv(io->ctx) != 0)
+    {
+        return -1;
+    }
+    icc->cont_icc = io->msg_rx->msg->data.cont_state;
+    icc->buf_len_exp = io->msg_rx->msg->data.buf_len_exp;
+    return 0;
+}
+
+/**
+ * @brief Send the header and the data of a command back-to-back, without
+ * waiting for the ACK procedure byte in between. The ICC either consumes the
+ * data after acknowledging the header, or answers the header with something
+ * else (NULL, status) and the data with IFD_NET_MSG_CTRL_DISCARD.
+ * @param[in] io The TX message must fit the command APDU.
+ * @param[in, out] icc
+ * @param[in] apdu Command APDU with data.
+ * @param[in] apdu_len Length of the command APDU (more than 5).
+ * @param[out] len_rem Where to write how much of the command APDU is left to
+ * send.
+ * @return 0 on success, -1 on failure. On success, the RX message holds the
+ * reply to the last part of the command that was consumed by the ICC.
+ */
+static int32_t pipeline(ifd_tpdu_io_st const *const io,
+                        ifd_tpdu_icc_st *const icc, uint8_t const *const apdu,
+                        uint32_t const apdu_len, uint32_t *const len_rem)
+{
+    swicc_net_msg_st *const msg_tx = io->msg_tx->msg;
+
+    memset(&msg_tx->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx->data.cont_state = icc->cont_iface;
+    memcpy(msg_tx->data.buf, apdu, 5U);
+    msg_tx->hdr.size = offsetof(swicc_net_msg_data_st, buf) + 5U;
+    if (io->send(io->ctx) != 0)
+    {
+        return -1;
+    }
+    memcpy(msg_tx->data.buf, &apdu[5U], apdu_len - 5U);
+    msg_tx->hdr.size = offsetof(swicc_net_msg_data_st, buf) + apdu_len - 5U;
+    if (io->send(io->ctx) != 0 || io->recv(io->ctx) != 0)
+    {
+        return -1;
+    }
+    swicc_net_msg_st const *msg_rx = io->msg_rx->msg;
+    /* Safe cast since the swICC net functions validated the message. */
+    uint32_t const spec_buf_len =
+        (uint32_t)(msg_rx->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    if (ifd_msg_reserve(io->msg_rx_spec, spec_buf_len) != 0)
+    {
+        return -1;
+    }
+    swicc_net_msg_st *const msg_rx_spec = io->msg_rx_spec->msg;
+    memcpy(msg_rx_spec, msg_rx, sizeof(msg_rx->hdr) + msg_rx->hdr.size);
+
+    /* Both replies are received before checking them to stay in sync. */
+    if (io->recv(io->ctx) != 0)
+    {
+        return -1;
+    }
+    msg_rx = io->msg_rx->msg;
+    icc->cont_icc = msg_rx->data.cont_state;
+    icc->buf_len_exp = msg_rx->data.buf_len_exp;
+    if (msg_rx_spec->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return -1;
+    }
+    if (msg_rx->data.ctrl == IFD_NET_MSG_CTRL_DISCARD)
+    {
+        IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_DISCARD, 0U,
+                   apdu_len - 5U);
+        /**
+         * Carry on from the reply to the header as if data was never sent.
+         * It fits since the RX message held it before, and never shrinks.
+         */
+        memcpy(io->msg_rx->msg, msg_rx_spec,
+               sizeof(msg_rx_spec->hdr) + msg_rx_spec->hdr.size);
+        icc->cont_icc = msg_rx_spec->data.cont_state;
+        icc->buf_len_exp = msg_rx_spec->data.buf_len_exp;
+        *len_rem = apdu_len - 5U;
+        return 0;
+    }
+    if (msg_rx->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return -1;
+    }
+
+    /* The data was consumed so the header must have been acknowledged. */
+    uint8_t const apdu_ins = apdu[1U];
+    uint8_t const apdu_ins_xor_ff = apdu_ins ^ 0xFF;
+    if (spec_buf_len > 1U ||
+        (spec_buf_len == 1U && msg_rx_spec->data.buf[0U] != apdu_ins &&
+         msg_rx_spec->data.buf[0U] != apdu_ins_xor_ff))
+    {
+        Log1(PCSC_LOG_ERROR, "ICC consumed data of an unacknowledged header.");
+        return -1;
+    }
+    IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_PIPELINE, spec_buf_len, 0U);
+    *len_rem = 0U;
+    return 0;
+}
+
+int32_t ifd_tpdu_transceive(ifd_tpdu_io_st const *const io,
+                            ifd_tpdu_icc_st *const icc,
+                            uint8_t const *const apdu, uint32_t const apdu_len,
+                            uint8_t *const rsp, uint32_t *const rsp_len)
+{
+    /* APDU must contain a header and fit in a message. */
+    if (apdu_len < 5U || apdu_len > IFD_MSG_BUF_LEN_MAX)
+    {
+        Log2(PCSC_LOG_ERROR, "APDU length %uB is invalid.", apdu_len);
+        return -1;
+    }
+    if (ifd_msg_reserve(io->msg_tx, apdu_len) != 0)
+    {
+        return -1;
+    }
+    swicc_net_msg_st *const msg_tx = io->msg_tx->msg;
+
+    uint8_t const apdu_ins = apdu[1U];
+    uint8_t const apdu_ins_xor_ff = apdu_ins ^ 0xFF;
+    uint32_t len_rem = apdu_len;
+    /* The ICC sent a NULL procedure byte and has not sent the next one yet. */
+    bool proc_null = false;
+
+    /**
+     * Iterate as many times as are needed to transfer all data from the
+     * buffer and until ICC needs more data than can be provided.
+     */
+    while (len_rem > 0 || icc->buf_len_exp == 0 || proc_null)
+    {
+        /**
+         * How much data was requested by the ICC. After a NULL procedure
+         * byte, nothing is sent and only the next procedure byte is waited
+         * for.
+         */
+        uint32_t const icc_buf_len_exp = proc_null ? 0U : icc->buf_len_exp;
+        proc_null = false;
+
+        Log3(PCSC_LOG_DEBUG, "ICC expects %uB. %uB remaining in TxBuffer.",
+             icc_buf_len_exp, len_rem);
+        if (len_rem < icc_buf_len_exp)
+        {
+            Log3(PCSC_LOG_ERROR, "ICC expects %uB, have only %uB to transmit.",
+                 icc_buf_len_exp, len_rem);
+            return -1;
+        }
+
+        if (icc->pipeline && icc_buf_len_exp == 5U && len_rem == apdu_len &&
+            apdu_len > 5U)
+        {
+            if (pipeline(io, icc, apdu, apdu_len, &len_rem) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            memset(&msg_tx->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+            msg_tx->data.cont_state = icc->cont_iface;
+            memcpy(msg_tx->data.buf, &apdu[apdu_len - len_rem],
+                   icc_buf_len_exp);
+            msg_tx->hdr.size =
+                offsetof(swicc_net_msg_data_st, buf) + icc_buf_len_exp;
+            if (msg_io(io, icc) != 0 ||
+                io->msg_rx->msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+            {
+                return -1;
+            }
+
+            /**
+             * After I/O, if the remaining length is 0, it means the command
+             * was sent and ICC should have responsed with a response TPDU.
+             */
+            len_rem -= icc_buf_len_exp;
+        }
+        Log2(PCSC_LOG_DEBUG, "TxBuffer contains %uB after transmission.",
+             len_rem);
+
+        swicc_net_msg_st const *const msg_rx = io->msg_rx->msg;
+        /* Safe cast since the swICC net functions validated the message. */
+        uint32_t const msg_rx_buf_len =
+            (uint32_t)(msg_rx->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+        Log2(PCSC_LOG_DEBUG, "Received %uB from ICC.", msg_rx_buf_len);
+
+        /**
+         * While transmitting the APDU, shall not receive any data in
+         * responses, procedure bytes are ok.
+         */
+        if (msg_rx_buf_len == 1U)
+        {
+            /* Got a procedure byte. */
+            uint8_t const procedure = msg_rx->data.buf[0U];
+            if (procedure == 0x60) /* NULL */
+            {
+                /* The ICC needs more time, so keep waiting for it. */
+                IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_NULL_BYTE, 1U,
+                           len_rem);
+                proc_null = true;
+                continue;
+            }
+            else if (procedure == apdu_ins ||
+                     procedure == apdu_ins_xor_ff) /* ACK */
+            {
+                /* Continue sending data. */
+                IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_ACK, 1U,
+                           len_rem);
+            }
+            else
+            {
+                IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_INVALID, 1U,
+                           len_rem);
+                Log2(PCSC_LOG_ERROR, "Received an invalid procedure: 0x%02X.",
+                     procedure);
+                return -1;
+            }
+        }
+        else if (msg_rx_buf_len == 2U)
+        {
+            /**
+             * Got a status before transmitting the whole message. This is
+             * our response to the APDU.
+             */
+            IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_STATUS, 2U, len_rem);
+            break;
+        }
+        else if (msg_rx_buf_len == 0U)
+        {
+            /**
+             * 0 means the ICC is most likely changing state, this is okay.
+             */
+            /* Continue sending data. */
+            IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_NULL, 0U, len_rem);
+        }
+        else
+        {
+            /**
+             * This would mean we got a response because there is no more
+             * data to send.
+             */
+            if (len_rem == 0)
+            {
+                IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_RSP,
+                           msg_rx_buf_len, 0U);
+                break;
+            }
+
+            /* Didn't send all the data but got more data than expected. */
+            IFD_PROBE4(tpdu_proc, io->id, IFD_PROBE_PROC_INVALID,
+                       msg_rx_buf_len, len_rem);
+            Log1(PCSC_LOG_ERROR,
+                 "Received too much or too little data from ICC.");
+            return -1;
+        }
+    }
+
+    swicc_net_msg_st const *const msg_rx = io->msg_rx->msg;
+    /* Safe cast since the swICC net functions validated the message. */
+    uint32_t const tpdu_len =
+        (uint32_t)(msg_rx->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    Log2(PCSC_LOG_DEBUG, "TPDU response length is %u.", tpdu_len);
+
+    /* Expecting at least a status word or a TPDU header. */
+    if (tpdu_len < 2U)
+    {
+        Log2(PCSC_LOG_ERROR,
+             "ICC sent an invalid TPDU: tpdu_len=%u, expected =2 or >=5.",
+             tpdu_len);
+        return -1;
+    }
+    /* Response buffer is too small to contain the APDU response. */
+    if (*rsp_len < tpdu_len)
+    {
+        return -1;
+    }
+    memcpy(rsp, msg_rx->data.buf, tpdu_len);
+    *rsp_len = tpdu_len;
+    return 0;
+}
+
+uint32_t ifd_tpdu_batch_rsp_len_max(uint8_t const *const hdr)
+{
+    /* P3 of 0 means 256 bytes are expected. */
+    uint32_t const le = hdr[4U] == 0U ? 256U : hdr[4U];
+    return 2U + le + 2U;
+}
+
+int32_t ifd_tpdu_batch(ifd_tpdu_io_st const *const io,
+                       ifd_tpdu_icc_st *const icc, uint8_t const *const hdr,
+                       uint32_t const hdr_count, uint8_t *const rsp,
+                       uint32_t *const rsp_len, uint32_t *const rsp_count)
+{
+    if (hdr_count == 0U || hdr_count * 5U > IFD_MSG_BUF_LEN_MAX ||
+        icc->buf_len_exp != 5U ||
+        ifd_msg_reserve(io->msg_tx, hdr_count * 5U) != 0)
+    {
+        return -1;
+    }
+    swicc_net_msg_st *const msg_tx = io->msg_tx->msg;
+    memset(&msg_tx->data, 0U, offsetof(swicc_net_msg_data_st, buf));
+    msg_tx->data.cont_state = icc->cont_iface;
+    msg_tx->data.ctrl = IFD_NET_MSG_CTRL_BATCH;
+    memcpy(msg_tx->data.buf, hdr, hdr_count * 5U);
+    msg_tx->hdr.size = offsetof(swicc_net_msg_data_st, buf) + hdr_count * 5U;
+    if (msg_io(io, icc) != 0 ||
+        io->msg_rx->msg->data.ctrl != SWICC_NET_MSG_CTRL_SUCCESS)
+    {
+        return -1;
+    }
+
+    swicc_net_msg_st const *const msg_rx = io->msg_rx->msg;
+    /* Safe cast since the swICC net functions validated the message. */
+    uint32_t const msg_rx_buf_len =
+        (uint32_t)(msg_rx->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    if (msg_rx_buf_len > *rsp_len)
+    {
+        return -1;
+    }
+
+    /* Every response must have at least a status and fit in the reply. */
+    uint32_t count = 0U;
+    uint32_t idx = 0U;
+    while (idx < msg_rx_buf_len)
+    {
+        if (msg_rx_buf_len - idx < 2U || count >= hdr_count)
+        {
+            return -1;
+        }
+        uint32_t const len = (uint32_t)(msg_rx->data.buf[idx] << 8U) |
+                             msg_rx->data.buf[idx + 1U];
+        if (len < 2U || len > msg_rx_buf_len - idx - 2U)
+        {
+            Log1(PCSC_LOG_ERROR, "ICC sent an invalid batch response.");
+            return -1;
+        }
+        idx += 2U + len;
+        ++count;
+    }
+    memcpy(rsp, msg_rx->data.buf, msg_rx_buf_len);
+    *rsp_len = msg_rx_buf_len;
+    *rsp_count = count;
+    return 0;
+}
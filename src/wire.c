@@ -0,0 +1,329 @@
+/**
+ * Framing of swICC network messages on the wire.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <wire.h>
+
+/* An unsigned LEB128 encoding of a 32-bit integer takes at most 5 bytes. */
+#define VARINT_LEN_MAX 5U
+/* Flags, cont_state, ctrl, and buf_len_exp. */
+#define HDR_V2_LEN_MAX (1U + VARINT_LEN_MAX + 1U + VARINT_LEN_MAX)
+
+/**
+ * @brief Encode an unsigned LEB128 integer.
+ * @param[out] buf Must fit at least VARINT_LEN_MAX bytes.
+ * @param[in] val
+ * @return Length of the encoded integer.
+ */
+static uint32_t varint_enc(uint8_t *const buf, uint32_t val)
+{
+    uint32_t len = 0U;
+    do
+    {
+        uint8_t byte = val & 0x7F;
+        val >>= 7U;
+        if (val != 0U)
+        {
+            byte |= 0x80;
+        }
+        buf[len++] = byte;
+    } while (val != 0U);
+    return len;
+}
+
+/**
+ * @brief Decode an unsigned LEB128 integer.
+ * @param[in] buf
+ * @param[in] buf_len
+ * @param[out] val
+ * @return Length of the encoded integer, 0 if it is malformed or truncated.
+ */
+static uint32_t varint_dec(uint8_t const *const buf, uint32_t const buf_len,
+                           uint32_t *const val)
+{
+    uint64_t val_dec = 0U;
+    for (uint32_t i = 0U; i < buf_len && i < VARINT_LEN_MAX; ++i)
+    {
+        val_dec |= (uint64_t)(buf[i] & 0x7F) << (7U * i);
+        if ((buf[i] & 0x80) == 0U)
+        {
+            if (val_dec > UINT32_MAX)
+            {
+                return 0U;
+            }
+            *val = (uint32_t)val_dec;
+            return i + 1U;
+        }
+    }
+    return 0U;
+}
+
+/**
+ * @brief Get how much of a buffer to pass to the next read or write.
+ * @param[in, out] impair NULL for no impairment.
+ * @param[in] len Length of what is left of the buffer.
+ * @return Between 1 and len.
+ */
+static uint32_t io_len(ifd_impair_st *const impair, uint32_t const len)
+{
+    return impair == NULL ? len : ifd_impair_chunk(impair, len);
+}
+
+/**
+ * @brief Send a whole buffer.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t send_all(int32_t const sock, ifd_impair_st *const impair,
+                        uint8_t const *const buf, uint32_t const buf_len)
+{
+    uint32_t sent = 0U;
+    while (sent < buf_len)
+    {
+        ssize_t const ret = send(sock, &buf[sent],
+                                 io_len(impair, buf_len - sent), MSG_NOSIGNAL);
+        if (ret <= 0)
+        {
+            return -1;
+        }
+        sent += (uint32_t)ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receive exactly the requested number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+static int32_t recv_all(int32_t const sock, ifd_impair_st *const impair,
+                        uint8_t *const buf, uint32_t const buf_len)
+{
+    uint32_t received = 0U;
+    while (received < buf_len)
+    {
+        ssize_t const ret =
+            recv(sock, &buf[received], io_len(impair, buf_len - received),
+                 MSG_WAITALL);
+        if (ret <= 0)
+        {
+            return -1;
+        }
+        received += (uint32_t)ret;
+    }
+    return 0;
+}
+
+void ifd_wire_reset(ifd_wire_st *const wire)
+{
+    ifd_impair_st *const impair = wire->impair;
+    memset(wire, 0U, sizeof(*wire));
+    wire->version = IFD_WIRE_VERSION_1;
+    wire->impair = impair;
+}
+
+void ifd_wire_version_set(ifd_wire_st *const wire, uint8_t const version)
+{
+    wire->version = version;
+    memset(&wire->hdr_tx, 0U, sizeof(wire->hdr_tx));
+    memset(&wire->hdr_rx, 0U, sizeof(wire->hdr_rx));
+}
+
+int32_t ifd_wire_send(int32_t const sock, ifd_wire_st *const wire,
+                      swicc_net_msg_st const *const msg)
+{
+    if (msg->hdr.size < offsetof(swicc_net_msg_data_st, buf) ||
+        msg->hdr.size > sizeof(msg->data))
+    {
+        return -1;
+    }
+    uint32_t const buf_len =
+        (uint32_t)(msg->hdr.size - offsetof(swicc_net_msg_data_st, buf));
+    if (wire->impair != NULL && ifd_impair_msg(wire->impair, sock) != 0)
+    {
+        return -1;
+    }
+
+    if (wire->version != IFD_WIRE_VERSION_2)
+    {
+        if (swicc_net_send(sock, msg) != SWICC_RET_SUCCESS)
+        {
+            return -1;
+        }
+        wire->tx_len += sizeof(msg->hdr) + msg->hdr.size;
+        wire->tx_count += 1U;
+        return 0;
+    }
+
+    uint8_t hdr_v2[HDR_V2_LEN_MAX];
+    uint32_t hdr_v2_len = 1U;
+    uint8_t flags = 0U;
+    if (msg->data.cont_state != wire->hdr_tx.cont_state)
+    {
+        flags |= IFD_WIRE_FLAG_CONT_STATE;
+        hdr_v2_len += varint_enc(&hdr_v2[hdr_v2_len], msg->data.cont_state);
+    }
+    if (msg->data.ctrl != wire->hdr_tx.ctrl)
+    {
+        flags |= IFD_WIRE_FLAG_CTRL;
+        hdr_v2[hdr_v2_len++] = msg->data.ctrl;
+    }
+    if (msg->data.buf_len_exp != wire->hdr_tx.buf_len_exp)
+    {
+        flags |= IFD_WIRE_FLAG_BUF_LEN_EXP;
+        hdr_v2_len += varint_enc(&hdr_v2[hdr_v2_len], msg->data.buf_len_exp);
+    }
+    hdr_v2[0U] = flags;
+
+    /* Frame length and header are sent together with the buffer. */
+    uint8_t hdr[VARINT_LEN_MAX + HDR_V2_LEN_MAX];
+    uint32_t const hdr_len = varint_enc(hdr, hdr_v2_len + buf_len);
+    memcpy(&hdr[hdr_len], hdr_v2, hdr_v2_len);
+    uint32_t const frame_hdr_len = hdr_len + hdr_v2_len;
+    uint32_t const frame_len = frame_hdr_len + buf_len;
+
+    /* An impaired send goes piece by piece instead of in one go. */
+    uint32_t sent_len = 0U;
+    if (wire->impair == NULL)
+    {
+        struct iovec iov[2U] = {
+            {.iov_base = hdr, .iov_len = frame_hdr_len},
+            {.iov_base = (void *)msg->data.buf, .iov_len = buf_len},
+        };
+        struct msghdr msg_hdr = {.msg_iov = iov, .msg_iovlen = 2U};
+        ssize_t const sent = sendmsg(sock, &msg_hdr, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            return -1;
+        }
+        sent_len = (uint32_t)sent;
+    }
+
+    /* Finish a partial send. */
+    if (sent_len < frame_hdr_len &&
+        send_all(sock, wire->impair, &hdr[sent_len],
+                 frame_hdr_len - sent_len) != 0)
+    {
+        return -1;
+    }
+    uint32_t const buf_sent =
+        sent_len > frame_hdr_len ? sent_len - frame_hdr_len : 0U;
+    if (send_all(sock, wire->impair, &msg->data.buf[buf_sent],
+                 buf_len - buf_sent) != 0)
+    {
+        return -1;
+    }
+
+    wire->hdr_tx.cont_state = msg->data.cont_state;
+    wire->hdr_tx.ctrl = msg->data.ctrl;
+    wire->hdr_tx.buf_len_exp = msg->data.buf_len_exp;
+    wire->tx_len += frame_len;
+    wire->tx_count += 1U;
+    return 0;
+}
+
+int32_t ifd_wire_recv(int32_t const sock, ifd_wire_st *const wire,
+                      ifd_msg_st *const msg)
+{
+    if (wire->version != IFD_WIRE_VERSION_2)
+    {
+        /**
+         * Same as swICC does it, except that the data buffer is made to fit
+         * the message once its size is known.
+         */
+        swicc_net_msg_hdr_st hdr;
+        if (recv_all(sock, NULL, (uint8_t *)&hdr, sizeof(hdr)) != 0 ||
+            hdr.size < offsetof(swicc_net_msg_data_st, buf))
+        {
+            return -1;
+        }
+        /* Safe cast since the size was checked. */
+        uint32_t const buf_len =
+            (uint32_t)(hdr.size - offsetof(swicc_net_msg_data_st, buf));
+        if (ifd_msg_reserve(msg, buf_len) != 0 ||
+            recv_all(sock, NULL, (uint8_t *)&msg->msg->data, hdr.size) != 0)
+        {
+            return -1;
+        }
+        msg->msg->hdr = hdr;
+        wire->rx_len += sizeof(hdr) + hdr.size;
+        wire->rx_count += 1U;
+        return 0;
+    }
+
+    /* The frame length is read byte by byte since its length is unknown. */
+    uint8_t frame_len_enc[VARINT_LEN_MAX];
+    uint32_t frame_len_enc_len = 0U;
+    do
+    {
+        if (frame_len_enc_len >= VARINT_LEN_MAX ||
+            recv_all(sock, wire->impair, &frame_len_enc[frame_len_enc_len],
+                     1U) != 0)
+        {
+            return -1;
+        }
+    } while (frame_len_enc[frame_len_enc_len++] & 0x80);
+    uint32_t frame_len;
+    if (varint_dec(frame_len_enc, frame_len_enc_len, &frame_len) == 0U)
+    {
+        return -1;
+    }
+
+    uint8_t frame[HDR_V2_LEN_MAX + IFD_MSG_BUF_LEN_MAX];
+    if (frame_len < 1U || frame_len > sizeof(frame) ||
+        recv_all(sock, wire->impair, frame, frame_len) != 0)
+    {
+        return -1;
+    }
+
+    uint8_t const flags = frame[0U];
+    uint32_t frame_idx = 1U;
+    ifd_wire_hdr_st hdr = wire->hdr_rx;
+    if (flags & IFD_WIRE_FLAG_CONT_STATE)
+    {
+        uint32_t const len = varint_dec(&frame[frame_idx],
+                                        frame_len - frame_idx, &hdr.cont_state);
+        if (len == 0U)
+        {
+            return -1;
+        }
+        frame_idx += len;
+    }
+    if (flags & IFD_WIRE_FLAG_CTRL)
+    {
+        if (frame_idx >= frame_len)
+        {
+            return -1;
+        }
+        hdr.ctrl = frame[frame_idx++];
+    }
+    if (flags & IFD_WIRE_FLAG_BUF_LEN_EXP)
+    {
+        uint32_t const len = varint_dec(
+            &frame[frame_idx], frame_len - frame_idx, &hdr.buf_len_exp);
+        if (len == 0U)
+        {
+            return -1;
+        }
+        frame_idx += len;
+    }
+
+    uint32_t const buf_len = frame_len - frame_idx;
+    if (ifd_msg_reserve(msg, buf_len) != 0)
+    {
+        return -1;
+    }
+    msg->msg->data.cont_state = hdr.cont_state;
+    msg->msg->data.ctrl = hdr.ctrl;
+    msg->msg->data.buf_len_exp = hdr.buf_len_exp;
+    memcpy(msg->msg->data.buf, &frame[frame_idx], buf_len);
+    msg->msg->hdr.size =
+        (uint32_t)offsetof(swicc_net_msg_data_st, buf) + buf_len;
+
+    wire->hdr_rx = hdr;
+    wire->rx_len += frame_len_enc_len + frame_len;
+    wire->rx_count += 1U;
+    return 0;
+}
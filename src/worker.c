@@ -0,0 +1,140 @@
+/**
+ * A thread which does all the work for one slot.
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <worker.h>
+
+/**
+ * @brief Wait for the worker to be woken up, at most for the idle time.
+ * @param[in, out] worker
+ * @return true if woken up, false if the idle time ran out.
+ */
+static bool worker_wait(ifd_worker_st *const worker)
+{
+    if (worker->idle_fn == NULL)
+    {
+        while (sem_wait(&worker->wake) != 0 && errno == EINTR)
+        {
+        }
+        return true;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += worker->idle_ms / 1000U;
+    deadline.tv_nsec += (long)(worker->idle_ms % 1000U) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (sem_timedwait(&worker->wake, &deadline) != 0)
+    {
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *worker_main(void *const arg)
+{
+    ifd_worker_st *const worker = arg;
+    while (true)
+    {
+        if (!worker_wait(worker))
+        {
+            worker->idle_fn(worker->idle_arg);
+            continue;
+        }
+
+        uint32_t const tail =
+            atomic_load_explicit(&worker->ring_tail, memory_order_relaxed);
+        uint32_t const head =
+            atomic_load_explicit(&worker->ring_head, memory_order_acquire);
+        if (tail == head)
+        {
+            /* Woken up without a request, so this is a stop. */
+            if (atomic_load_explicit(&worker->stop, memory_order_acquire))
+            {
+                break;
+            }
+            continue;
+        }
+        ifd_worker_req_st *const req =
+            worker->ring[tail & (IFD_WORKER_RING_LEN - 1U)];
+        atomic_store_explicit(&worker->ring_tail, tail + 1U,
+                              memory_order_release);
+        req->ret = req->fn(req->arg);
+        sem_post(&req->done);
+    }
+    return NULL;
+}
+
+int32_t ifd_worker_start(ifd_worker_st *const worker,
+                         ifd_worker_fn *const idle_fn, void *const idle_arg,
+                         uint32_t const idle_ms)
+{
+    worker->running = false;
+    atomic_init(&worker->ring_head, 0U);
+    atomic_init(&worker->ring_tail, 0U);
+    atomic_init(&worker->stop, false);
+    worker->idle_fn = idle_fn;
+    worker->idle_arg = idle_arg;
+    worker->idle_ms = idle_ms;
+    if (sem_init(&worker->wake, 0, 0U) != 0)
+    {
+        return -1;
+    }
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+    {
+        sem_destroy(&worker->wake);
+        return -1;
+    }
+    worker->running = true;
+    return 0;
+}
+
+void ifd_worker_stop(ifd_worker_st *const worker)
+{
+    if (!worker->running)
+    {
+        return;
+    }
+    atomic_store_explicit(&worker->stop, true, memory_order_release);
+    sem_post(&worker->wake);
+    pthread_join(worker->thread, NULL);
+    sem_destroy(&worker->wake);
+    worker->running = false;
+}
+
+int32_t ifd_worker_call(ifd_worker_st *const worker, ifd_worker_fn *const fn,
+                        void *const arg, int32_t *const ret)
+{
+    uint32_t const head =
+        atomic_load_explicit(&worker->ring_head, memory_order_relaxed);
+    uint32_t const tail =
+        atomic_load_explicit(&worker->ring_tail, memory_order_acquire);
+    if (!worker->running || head - tail >= IFD_WORKER_RING_LEN)
+    {
+        return -1;
+    }
+
+    ifd_worker_req_st req = {.fn = fn, .arg = arg, .ret = -1};
+    if (sem_init(&req.done, 0, 0U) != 0)
+    {
+        return -1;
+    }
+    worker->ring[head & (IFD_WORKER_RING_LEN - 1U)] = &req;
+    atomic_store_explicit(&worker->ring_head, head + 1U, memory_order_release);
+    sem_post(&worker->wake);
+    while (sem_wait(&req.done) != 0 && errno == EINTR)
+    {
+    }
+    sem_destroy(&req.done);
+    *ret = req.ret;
+    return 0;
+}